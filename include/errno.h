@@ -7,11 +7,15 @@
  * System error numbers.
  */
 
+#ifndef __ASSEMBLER__
+
 /**
  * Number of the last error.
  */
 extern int errno;
 
+#endif  // !__ASSEMBLER__
+
 #define E2BIG         1     ///< Arg list too long
 #define EACCESS       2     ///< Permission denied
 #define EAGAIN        3     ///< Resource temporarily unavailable
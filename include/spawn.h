@@ -0,0 +1,58 @@
+#ifndef __SPAWN_H__
+#define __SPAWN_H__
+
+/**
+ * @file include/spawn.h
+ * 
+ * Creating new processes that execute a file.
+ */
+
+#include <sys/types.h>
+
+/** The maximum number of file actions passed to a single posix_spawn(). */
+#define SPAWN_ACTIONS_MAX   8
+
+#define SPAWN_ACTION_CLOSE  1       ///< Close the file descriptor
+#define SPAWN_ACTION_OPEN   2       ///< Open a file at the file descriptor
+
+/**
+ * A file action performed in the new process before executing the file.
+ */
+struct spawn_action {
+  int         sa_type;              ///< SPAWN_ACTION_CLOSE or SPAWN_ACTION_OPEN
+  int         sa_fd;                ///< The file descriptor
+  int         sa_oflag;             ///< Flags for open()
+  mode_t      sa_mode;              ///< Mode for open()
+  const char *sa_path;              ///< Path name for open()
+};
+
+/**
+ * The list of file actions, performed in the order they were added.
+ */
+typedef struct {
+  int                 count;
+  struct spawn_action actions[SPAWN_ACTIONS_MAX];
+} posix_spawn_file_actions_t;
+
+/**
+ * Spawn attributes. No attributes are supported yet.
+ */
+typedef struct {
+  short               flags;
+} posix_spawnattr_t;
+
+int posix_spawn(pid_t *, const char *, const posix_spawn_file_actions_t *,
+                const posix_spawnattr_t *, char *const[], char *const[]);
+int posix_spawnp(pid_t *, const char *, const posix_spawn_file_actions_t *,
+                 const posix_spawnattr_t *, char *const[], char *const[]);
+
+int posix_spawn_file_actions_init(posix_spawn_file_actions_t *);
+int posix_spawn_file_actions_destroy(posix_spawn_file_actions_t *);
+int posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *, int);
+int posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *, int,
+                                     const char *, int, mode_t);
+
+int posix_spawnattr_init(posix_spawnattr_t *);
+int posix_spawnattr_destroy(posix_spawnattr_t *);
+
+#endif  // !__SPAWN_H__
@@ -0,0 +1,45 @@
+#ifndef __SYS_MEMINFO_H__
+#define __SYS_MEMINFO_H__
+
+/**
+ * @file include/sys/meminfo.h
+ *
+ * Physical memory statistics.
+ */
+
+/** The number of page block orders supported by the page allocator. */
+#define __MEMINFO_ORDERS  11
+
+/**
+ * Physical memory statistics. All amounts are given in pages.
+ */
+struct meminfo {
+  unsigned long page_size;    ///< The size of a page in bytes
+  unsigned long total;        ///< Total number of usable pages
+  unsigned long free;         ///< Free pages (including the cached ones)
+  unsigned long cached;       ///< Free pages kept in per-CPU caches and pools
+  unsigned long used;         ///< Allocated pages
+
+  // Breakdown of the allocated pages by owner
+  unsigned long slab;         ///< Object pools
+  unsigned long pgtab;        ///< Translation tables
+  unsigned long user;         ///< User process memory
+  unsigned long kstack;       ///< Kernel stacks
+  unsigned long buf;          ///< Buffer cache
+  unsigned long kernel;       ///< Everything else (kernel image, drivers, etc.)
+
+  // Swap space
+  unsigned long swap_total;   ///< Total number of swap slots
+  unsigned long swap_free;    ///< Free swap slots
+  unsigned long swap_in;      ///< The number of pages read from swap
+  unsigned long swap_out;     ///< The number of pages written to swap
+
+  /** The number of free blocks of each order */
+  unsigned long free_blocks[__MEMINFO_ORDERS];
+  /** Fragmentation index of each order (see page_frag_index) */
+  int           frag_index[__MEMINFO_ORDERS];
+};
+
+int meminfo(struct meminfo *);
+
+#endif  // !__SYS_MEMINFO_H__
@@ -0,0 +1,34 @@
+#ifndef __SYS_MMAN_H__
+#define __SYS_MMAN_H__
+
+/**
+ * @file include/sys/mman.h
+ * 
+ * Memory management declarations.
+ */
+
+#include <sys/types.h>
+
+#define PROT_NONE       0           ///< Page cannot be accessed
+#define PROT_READ       (1 << 0)    ///< Page can be read
+#define PROT_WRITE      (1 << 1)    ///< Page can be written
+#define PROT_EXEC       (1 << 2)    ///< Page can be executed
+
+#define MAP_SHARED      (1 << 0)    ///< Share changes
+#define MAP_PRIVATE     (1 << 1)    ///< Changes are private
+#define MAP_FIXED       (1 << 4)    ///< Interpret addr exactly
+#define MAP_ANONYMOUS   (1 << 5)    ///< Not backed by a file (fd is ignored)
+#define MAP_ANON        MAP_ANONYMOUS
+
+/** Returned by mmap() on failure. */
+#define MAP_FAILED      ((void *) -1)
+
+#define MS_ASYNC        (1 << 0)    ///< Perform asynchronous writes
+#define MS_INVALIDATE   (1 << 1)    ///< Invalidate cached data
+#define MS_SYNC         (1 << 2)    ///< Perform synchronous writes
+
+void *mmap(void *, size_t, int, int, int, off_t);
+int   msync(void *, size_t, int);
+int   munmap(void *, size_t);
+
+#endif  // !__SYS_MMAN_H__
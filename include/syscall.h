@@ -29,6 +29,11 @@
 #define __SYS_SBRK        22
 #define __SYS_UNAME       23
 #define __SYS_CHMOD       24
+#define __SYS_MEMINFO     25
+#define __SYS_MMAP        26
+#define __SYS_MUNMAP      27
+#define __SYS_MSYNC       28
+#define __SYS_SPAWN       29
 
 // Generic system call: pass system call number as an immediate operand of the
 // SVC instruction, and up to three parameters in R0, R1, R2.
@@ -58,4 +63,36 @@ __syscall(uint8_t num, uint32_t a1, uint32_t a2, uint32_t a3)
   return r0;
 }
 
+// System call with up to six parameters: pass the first four parameters in
+// R0-R3, and the remaining two in R4 and R5.
+static inline int32_t
+__syscall6(uint8_t num, uint32_t a1, uint32_t a2, uint32_t a3, uint32_t a4,
+           uint32_t a5, uint32_t a6)
+{
+  register int32_t r0 asm("r0") = a1;
+  register int32_t r1 asm("r1") = a2;
+  register int32_t r2 asm("r2") = a3;
+  register int32_t r3 asm("r3") = a4;
+  register int32_t r4 asm("r4") = a5;
+  register int32_t r5 asm("r5") = a6;
+
+  asm volatile("svc %1\n"
+               : "=r"(r0)
+               : "I" (num),
+                 "r" (r0),
+                 "r" (r1),
+                 "r" (r2),
+                 "r" (r3),
+                 "r" (r4),
+                 "r" (r5)
+               : "memory", "cc");
+
+  if (r0 < 0) {
+    errno = -r0;
+    return -1;
+  }
+
+  return r0;
+}
+
 #endif  // !__SYSCALL_H__
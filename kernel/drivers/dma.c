@@ -0,0 +1,587 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+
+#include <armv7.h>
+#include <cprintf.h>
+#include <drivers/gic.h>
+#include <drivers/l2cc.h>
+#include <list.h>
+#include <mm/memlayout.h>
+#include <mm/page.h>
+#include <mm/vm.h>
+#include <scheduler.h>
+#include <sync.h>
+#include <trap.h>
+#include <types.h>
+
+#include <drivers/dma.h>
+
+#define DMAC_BASE       0x10030000    // DMA controller memory base address
+
+static volatile uint32_t *dmac;
+
+// DMA controller registers, divided by 4 for use as uint32_t[] indices
+#define DMACIntTCStatus     (0x004 / 4) // Interrupt Terminal Count Status
+#define DMACIntTCClear      (0x008 / 4) // Interrupt Terminal Count Clear
+#define DMACIntErrorStatus  (0x00C / 4) // Interrupt Error Status
+#define DMACIntErrClr       (0x010 / 4) // Interrupt Error Clear
+#define DMACRawIntTCStatus  (0x014 / 4) // Raw Interrupt Terminal Count Status
+#define DMACRawIntErrStatus (0x018 / 4) // Raw Error Interrupt Status
+#define DMACConfiguration   (0x030 / 4) // Configuration Register
+  #define DMAC_E            (1U << 0)   //   DMA controller enable
+#define DMACPeriphID0       (0xFE0 / 4) // Peripheral Identification Register 0
+  #define PERIPH_PL081      0x81        //   Part number of the PL081
+
+// Channel registers, divided by 4 for use as uint32_t[] indices
+#define DMACCx(n, reg)      ((0x100 + (n) * 0x20) / 4 + (reg))
+#define DMACCxSrcAddr       (0x000 / 4) // Source Address Register
+#define DMACCxDestAddr      (0x004 / 4) // Destination Address Register
+#define DMACCxLLI           (0x008 / 4) // Linked List Item Register
+#define DMACCxControl       (0x00C / 4) // Control Register
+  #define CTRL_SIZE_MAX     0xFFF       //   Maximum transfer size
+  #define CTRL_SBSIZE_4     (1U << 12)  //   Source burst size: 4 transfers
+  #define CTRL_DBSIZE_4     (1U << 15)  //   Dest. burst size: 4 transfers
+  #define CTRL_SWIDTH(w)    ((w) << 18) //   Source transfer width
+  #define CTRL_DWIDTH(w)    ((w) << 21) //   Destination transfer width
+  #define CTRL_SI           (1U << 26)  //   Source increment
+  #define CTRL_DI           (1U << 27)  //   Destination increment
+  #define CTRL_I            (1U << 31)  //   Terminal count interrupt enable
+#define DMACCxConfiguration (0x010 / 4) // Configuration Register
+  #define CFG_E             (1U << 0)   //   Channel enable
+  #define CFG_SRCPERIPH(p)  ((p) << 1)  //   Source peripheral
+  #define CFG_DESTPERIPH(p) ((p) << 6)  //   Destination peripheral
+  #define CFG_FLOW_M2M      (0U << 11)  //   Memory to memory
+  #define CFG_FLOW_M2P      (1U << 11)  //   Memory to peripheral
+  #define CFG_FLOW_P2M      (2U << 11)  //   Peripheral to memory
+  #define CFG_IE            (1U << 14)  //   Error interrupt mask
+  #define CFG_ITC           (1U << 15)  //   Terminal count interrupt mask
+
+// The maximum number of channels (PL080 has 8, PL081 has 2)
+#define DMA_CHANNELS_MAX    8
+
+// Size of the data cache lines in bytes, both L1 and L2
+#define DMA_CACHE_LINE      32
+
+/**
+ * Linked list item, in the format the controller loads from memory.
+ */
+struct DMADesc {
+  uint32_t src;             ///< Source address
+  uint32_t dst;             ///< Destination address
+  uint32_t lli;             ///< Physical address of the next item, or 0
+  uint32_t ctrl;            ///< Value of the channel control register
+};
+
+// Channel states
+enum {
+  DMA_FREE,                 // Not allocated
+  DMA_IDLE,                 // Allocated, no transfer in progress
+  DMA_RUNNING,              // Transfer in progress
+  DMA_DONE,                 // Transfer completed successfully
+  DMA_ERROR,                // Transfer aborted because of a bus error
+};
+
+/**
+ * DMA channel.
+ */
+struct DMAChannel {
+  unsigned         id;          ///< Channel number
+  int              state;       ///< Channel state
+  int              flags;       ///< Flags passed to dma_start()
+  uint32_t         config;      ///< Flow control and peripherals
+  struct DMADesc  *desc;        ///< Linked list items
+  unsigned         ndesc;       ///< The number of prepared items
+  unsigned         max_desc;    ///< The maximum number of items
+  struct ListLink  wait_queue;  ///< Tasks waiting for the transfer
+};
+
+static struct {
+  struct DMAChannel channels[DMA_CHANNELS_MAX];
+  unsigned          nchannels;
+  struct SpinLock   lock;
+} dma = {
+  .lock = SPIN_INITIALIZER("dma"),
+};
+
+static void dma_complete(struct DMAChannel *, int);
+
+/*
+ * ----------------------------------------------------------------------------
+ * DMA Controller
+ * ----------------------------------------------------------------------------
+ *
+ * See PrimeCell DMA Controller (PL080) Technical Reference Manual.
+ *
+ * A driver allocates a channel, describes the transfer with one or more
+ * dma_prep_*() calls, each appending items to the linked list of the channel,
+ * and then starts the transfer with dma_start() and waits for it to finish
+ * with dma_wait(). The buffers must be in the kernel direct mapping, and
+ * the caller is responsible for the cache maintenance around them (see
+ * dma_cache_clean() and friends below). dma_memcpy() does all of this for
+ * simple memory-to-memory copies.
+ *
+ */
+
+/**
+ * Initialize the DMA controller.
+ */
+void
+dma_init(void)
+{
+  struct Page *page;
+  struct DMADesc *desc;
+  unsigned i;
+
+  dmac = (volatile uint32_t *) KADDR(DMAC_BASE);
+
+  dma.nchannels = (dmac[DMACPeriphID0] & 0xFF) == PERIPH_PL081
+                ? 2
+                : DMA_CHANNELS_MAX;
+
+  // The linked list items of all channels share a single page.
+  if ((page = page_alloc_one(PAGE_ALLOC_ZERO)) == NULL)
+    panic("cannot allocate DMA descriptors");
+  page->ref_count++;
+  desc = (struct DMADesc *) page2kva(page);
+
+  for (i = 0; i < dma.nchannels; i++) {
+    dma.channels[i].id       = i;
+    dma.channels[i].state    = DMA_FREE;
+    dma.channels[i].max_desc = PAGE_SIZE / sizeof(*desc) / dma.nchannels;
+    dma.channels[i].desc     = desc + i * dma.channels[i].max_desc;
+    list_init(&dma.channels[i].wait_queue);
+
+    dmac[DMACCx(i, DMACCxConfiguration)] = 0;
+  }
+
+  dmac[DMACIntTCClear] = 0xFF;
+  dmac[DMACIntErrClr]  = 0xFF;
+  dmac[DMACConfiguration] = DMAC_E;
+
+  gic_enable(IRQ_DMA, 0);
+}
+
+/**
+ * Allocate a DMA channel.
+ *
+ * @return Pointer to the channel, or NULL if all channels are in use.
+ */
+struct DMAChannel *
+dma_channel_alloc(void)
+{
+  struct DMAChannel *ch;
+  unsigned i;
+
+  // The console may try to use DMA before the controller is initialized.
+  if (dmac == NULL)
+    return NULL;
+
+  spin_lock(&dma.lock);
+
+  for (i = 0; i < dma.nchannels; i++) {
+    ch = &dma.channels[i];
+    if (ch->state == DMA_FREE) {
+      ch->state  = DMA_IDLE;
+      ch->ndesc  = 0;
+      ch->config = 0;
+      spin_unlock(&dma.lock);
+      return ch;
+    }
+  }
+
+  spin_unlock(&dma.lock);
+
+  return NULL;
+}
+
+/**
+ * Release a DMA channel. The channel must not have a transfer in progress.
+ *
+ * @param ch The channel to be released.
+ */
+void
+dma_channel_free(struct DMAChannel *ch)
+{
+  spin_lock(&dma.lock);
+
+  if (ch->state == DMA_RUNNING)
+    panic("DMA channel %u busy", ch->id);
+  ch->state = DMA_FREE;
+
+  spin_unlock(&dma.lock);
+}
+
+// Get the transfer width (as encoded in the control register) suitable for
+// the given addresses and size.
+static unsigned
+dma_width(physaddr_t dst, physaddr_t src, size_t n)
+{
+  unsigned long align = dst | src | n;
+
+  if ((align & 3) == 0)
+    return 2;
+  if ((align & 1) == 0)
+    return 1;
+  return 0;
+}
+
+// Append linked list items describing a single transfer to the channel.
+static int
+dma_prep(struct DMAChannel *ch, physaddr_t dst, physaddr_t src, size_t n,
+         unsigned width, uint32_t ctrl, uint32_t config)
+{
+  struct DMADesc *desc;
+  size_t count, max_bytes;
+  unsigned ndesc;
+
+  if (ch->state != DMA_IDLE)
+    return -EBUSY;
+
+  // All items of a single transfer share the same channel configuration.
+  if ((ch->ndesc > 0) && (ch->config != config))
+    return -EINVAL;
+
+  max_bytes = CTRL_SIZE_MAX << width;
+
+  ndesc = (n + max_bytes - 1) / max_bytes;
+  if ((n == 0) || (ch->ndesc + ndesc > ch->max_desc))
+    return -ENOSPC;
+
+  while (n > 0) {
+    count = MIN(n, max_bytes);
+
+    desc = &ch->desc[ch->ndesc];
+    desc->src  = src;
+    desc->dst  = dst;
+    desc->lli  = 0;
+    desc->ctrl = ctrl | CTRL_SWIDTH(width) | CTRL_DWIDTH(width) |
+                 CTRL_SBSIZE_4 | CTRL_DBSIZE_4 | (count >> width);
+
+    if (ch->ndesc > 0)
+      ch->desc[ch->ndesc - 1].lli = PADDR(desc);
+    ch->ndesc++;
+
+    if (ctrl & CTRL_SI)
+      src += count;
+    if (ctrl & CTRL_DI)
+      dst += count;
+    n -= count;
+  }
+
+  ch->config = config;
+
+  return 0;
+}
+
+/**
+ * Append a memory-to-memory copy to the channel.
+ *
+ * @param ch  The channel.
+ * @param dst Physical address of the destination buffer.
+ * @param src Physical address of the source buffer.
+ * @param n   The number of bytes to copy.
+ *
+ * @return 0 on success, -ENOSPC if there are not enough linked list items,
+ *         or -EINVAL if the transfer cannot be combined with the already
+ *         prepared ones.
+ */
+int
+dma_prep_memcpy(struct DMAChannel *ch, physaddr_t dst, physaddr_t src,
+                size_t n)
+{
+  return dma_prep(ch, dst, src, n, dma_width(dst, src, n),
+                  CTRL_SI | CTRL_DI, CFG_FLOW_M2M);
+}
+
+/**
+ * Append a transfer between memory and a peripheral FIFO to the channel. The
+ * data is transferred in words, 4 words per request of the peripheral.
+ *
+ * @param ch     The channel.
+ * @param mem    Physical address of the memory buffer.
+ * @param fifo   Physical address of the peripheral FIFO register.
+ * @param n      The number of bytes to transfer (a multiple of 4).
+ * @param periph The DMA request line of the peripheral.
+ * @param dir    DMA_TO_DEVICE or DMA_FROM_DEVICE.
+ *
+ * @return 0 on success, -ENOSPC if there are not enough linked list items,
+ *         or -EINVAL if the arguments are invalid or the transfer cannot be
+ *         combined with the already prepared ones.
+ */
+int
+dma_prep_slave(struct DMAChannel *ch, physaddr_t mem, physaddr_t fifo,
+               size_t n, unsigned periph, int dir)
+{
+  if ((periph > 15) || (dma_width(mem, fifo, n) != 2))
+    return -EINVAL;
+
+  switch (dir) {
+  case DMA_TO_DEVICE:
+    return dma_prep(ch, fifo, mem, n, 2, CTRL_SI,
+                    CFG_FLOW_M2P | CFG_DESTPERIPH(periph));
+  case DMA_FROM_DEVICE:
+    return dma_prep(ch, mem, fifo, n, 2, CTRL_DI,
+                    CFG_FLOW_P2M | CFG_SRCPERIPH(periph));
+  default:
+    return -EINVAL;
+  }
+}
+
+/**
+ * Start the transfer prepared on the channel.
+ *
+ * @param ch    The channel.
+ * @param flags DMA_POLL if dma_wait() must busy-wait for the transfer to
+ *              complete instead of sleeping (e.g., if it is called while
+ *              holding a spinlock).
+ *
+ * @return 0 on success, or -EINVAL if no transfer has been prepared.
+ */
+int
+dma_start(struct DMAChannel *ch, int flags)
+{
+  struct DMADesc *first, *last;
+  uint32_t config;
+
+  if ((ch->state != DMA_IDLE) || (ch->ndesc == 0))
+    return -EINVAL;
+
+  first = &ch->desc[0];
+  last  = &ch->desc[ch->ndesc - 1];
+
+  last->ctrl |= CTRL_I;
+
+  // The controller fetches the items directly from memory.
+  dma_cache_clean(ch->desc, ch->ndesc * sizeof(struct DMADesc));
+
+  config = ch->config | CFG_E;
+  if (!(flags & DMA_POLL))
+    config |= CFG_IE | CFG_ITC;
+
+  spin_lock(&dma.lock);
+
+  ch->state = DMA_RUNNING;
+  ch->flags = flags;
+
+  dmac[DMACIntTCClear] = (1U << ch->id);
+  dmac[DMACIntErrClr]  = (1U << ch->id);
+
+  dmac[DMACCx(ch->id, DMACCxSrcAddr)]       = first->src;
+  dmac[DMACCx(ch->id, DMACCxDestAddr)]      = first->dst;
+  dmac[DMACCx(ch->id, DMACCxLLI)]           = first->lli;
+  dmac[DMACCx(ch->id, DMACCxControl)]       = first->ctrl;
+  dmac[DMACCx(ch->id, DMACCxConfiguration)] = config;
+
+  spin_unlock(&dma.lock);
+
+  return 0;
+}
+
+/**
+ * Wait for the transfer on the channel to complete. Unless the transfer was
+ * started with DMA_POLL, the current task is put to sleep.
+ *
+ * @param ch The channel.
+ *
+ * @return 0 on success, or -EIO if the transfer was aborted.
+ */
+int
+dma_wait(struct DMAChannel *ch)
+{
+  uint32_t mask = (1U << ch->id);
+  int r;
+
+  if (ch->flags & DMA_POLL) {
+    while (!(dmac[DMACRawIntTCStatus] & mask) &&
+           !(dmac[DMACRawIntErrStatus] & mask))
+      ;
+
+    spin_lock(&dma.lock);
+    if (ch->state == DMA_RUNNING)
+      dma_complete(ch, dmac[DMACRawIntErrStatus] & mask);
+  } else {
+    spin_lock(&dma.lock);
+    while (ch->state == DMA_RUNNING)
+      task_sleep(&ch->wait_queue, &dma.lock);
+  }
+
+  r = (ch->state == DMA_ERROR) ? -EIO : 0;
+
+  ch->state = DMA_IDLE;
+  ch->ndesc = 0;
+
+  spin_unlock(&dma.lock);
+
+  return r;
+}
+
+// Mark the transfer on the channel as finished.
+static void
+dma_complete(struct DMAChannel *ch, int error)
+{
+  assert(spin_holding(&dma.lock));
+
+  dmac[DMACIntTCClear] = (1U << ch->id);
+  dmac[DMACIntErrClr]  = (1U << ch->id);
+
+  // Disable the channel explicitly in case it is stopped because of an error.
+  dmac[DMACCx(ch->id, DMACCxConfiguration)] = 0;
+
+  ch->state = error ? DMA_ERROR : DMA_DONE;
+  task_wakeup(&ch->wait_queue);
+}
+
+/**
+ * Handle the DMA controller interrupt. Wake up the tasks waiting for the
+ * completed transfers.
+ */
+void
+dma_intr(void)
+{
+  uint32_t tc, err;
+  unsigned i;
+
+  spin_lock(&dma.lock);
+
+  tc  = dmac[DMACIntTCStatus];
+  err = dmac[DMACIntErrorStatus];
+
+  for (i = 0; i < dma.nchannels; i++)
+    if ((tc | err) & (1U << i))
+      dma_complete(&dma.channels[i], err & (1U << i));
+
+  spin_unlock(&dma.lock);
+}
+
+/**
+ * Copy memory using DMA, including the cache maintenance of both buffers.
+ *
+ * @param dst   The destination address (in the kernel direct mapping).
+ * @param src   The source address (in the kernel direct mapping).
+ * @param n     The number of bytes to copy.
+ * @param flags DMA_POLL to busy-wait for the copy to complete.
+ *
+ * @return 0 on success, -EBUSY if no channel is available, or -EIO if the
+ *         transfer was aborted. The caller may fall back to memmove() in case
+ *         of an error.
+ */
+int
+dma_memcpy(void *dst, const void *src, size_t n, int flags)
+{
+  struct DMAChannel *ch;
+  physaddr_t dst_pa, src_pa;
+  size_t chunk, max_bytes, left;
+  int r;
+
+  if ((ch = dma_channel_alloc()) == NULL)
+    return -EBUSY;
+
+  dst_pa = PADDR(dst);
+  src_pa = PADDR((void *) src);
+
+  dma_cache_clean(src, n);
+  dma_cache_flush(dst, n);
+
+  max_bytes = (CTRL_SIZE_MAX << dma_width(dst_pa, src_pa, n)) * ch->max_desc;
+
+  for (r = 0, left = n; (r == 0) && (left > 0); left -= chunk) {
+    chunk = MIN(left, max_bytes);
+
+    if (((r = dma_prep_memcpy(ch, dst_pa, src_pa, chunk)) != 0) ||
+        ((r = dma_start(ch, flags)) != 0))
+      break;
+    r = dma_wait(ch);
+
+    dst_pa += chunk;
+    src_pa += chunk;
+  }
+
+  dma_channel_free(ch);
+
+  // Drop the lines that may have been speculatively fetched during the copy.
+  dma_cache_inv(dst, n);
+
+  return r;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Cache maintenance
+ * ----------------------------------------------------------------------------
+ *
+ * The controller accesses the physical memory directly, bypassing both the L1
+ * data cache and the L2 cache. Before a device reads a buffer, the buffer must
+ * be cleaned, so that the data written by the CPU reach the memory. After a
+ * device writes to a buffer, the buffer must be invalidated, so that the CPU
+ * does not read stale data from the caches.
+ *
+ */
+
+/**
+ * Write back the cached data of the buffer to the memory.
+ *
+ * @param va The buffer address (in the kernel direct mapping).
+ * @param n  The buffer size in bytes.
+ */
+void
+dma_cache_clean(const void *va, size_t n)
+{
+  uintptr_t p, end;
+
+  end = (uintptr_t) va + n;
+  for (p = ROUND_DOWN((uintptr_t) va, DMA_CACHE_LINE); p < end;
+       p += DMA_CACHE_LINE)
+    cp15_dccmvac(p);
+  dsb();
+
+  l2cc_clean_range(PADDR((void *) va), n);
+}
+
+/**
+ * Discard the cached data of the buffer. Partial cache lines at either end
+ * of the buffer are written back first to preserve the neighboring data.
+ *
+ * @param va The buffer address (in the kernel direct mapping).
+ * @param n  The buffer size in bytes.
+ */
+void
+dma_cache_inv(void *va, size_t n)
+{
+  uintptr_t p, start, end;
+
+  start = (uintptr_t) va;
+  end   = start + n;
+
+  // Invalidate the outer cache first, so that the lines cannot be refilled
+  // into L1 from stale L2 lines.
+  l2cc_inv_range(PADDR(va), n);
+
+  for (p = ROUND_DOWN(start, DMA_CACHE_LINE); p < end; p += DMA_CACHE_LINE) {
+    if ((p < start) || (p + DMA_CACHE_LINE > end))
+      cp15_dccimvac(p);
+    else
+      cp15_dcimvac(p);
+  }
+  dsb();
+}
+
+/**
+ * Write back and discard the cached data of the buffer.
+ *
+ * @param va The buffer address (in the kernel direct mapping).
+ * @param n  The buffer size in bytes.
+ */
+void
+dma_cache_flush(void *va, size_t n)
+{
+  uintptr_t p, end;
+
+  end = (uintptr_t) va + n;
+  for (p = ROUND_DOWN((uintptr_t) va, DMA_CACHE_LINE); p < end;
+       p += DMA_CACHE_LINE)
+    cp15_dccimvac(p);
+  dsb();
+
+  l2cc_flush_range(PADDR(va), n);
+}
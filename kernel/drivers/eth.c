@@ -4,8 +4,8 @@
 #include <cpu.h>
 #include <cprintf.h>
 #include <drivers/gic.h>
+#include <mm/kmalloc.h>
 #include <mm/memlayout.h>
-#include <mm/page.h>
 #include <trap.h>
 #include <types.h>
 
@@ -250,28 +250,28 @@ eth_rx(void)
 
   while(rx_used > 0) {
     uint32_t rx_status, packet_len;
+    uint8_t *packet;
 
     rx_status = eth[RX_STATUS_FIFO_PORT];
     packet_len = (rx_status >> 16) & 0x3FFF;
 
-    if (rx_status & (1 << 15)) {
-      // Packet has error: discard and update status
+    // Packet has error or there is no memory to store it: discard and update
+    // status
+    if ((rx_status & (1 << 15)) ||
+        ((packet = kmalloc(ROUND_UP(packet_len + 2, sizeof(uint32_t)),
+                           KMALLOC_ZERO)) == NULL)) {
       uint32_t i, tmp;
 
-      for (i = ROUND_UP(packet_len, sizeof(uint32_t)); i > 0; i--)
+      for (i = ROUND_UP(packet_len, sizeof(uint32_t)) / 4; i > 0; i--)
         tmp = eth[RX_DATA_FIFO_PORT];
       (void) tmp;
     } else {
       uint32_t i;
-      struct Page *p;
       uint32_t *data;
-      uint8_t *packet;
-  
-      p = page_alloc_one(PAGE_ALLOC_ZERO);
-      packet = (uint8_t *) page2kva(p);
-      data = (uint32_t *) page2kva(p);
 
-      for (i = ROUND_UP(packet_len, sizeof(uint32_t)); i > 0; i--)
+      data = (uint32_t *) packet;
+
+      for (i = ROUND_UP(packet_len, sizeof(uint32_t)) / 4; i > 0; i--)
         *data++ = eth[RX_DATA_FIFO_PORT];
 
       cprintf("Received packet (length = %d):\n", packet_len);
@@ -281,7 +281,7 @@ eth_rx(void)
           cprintf("\n");
       }
 
-      page_free_one(p);
+      kfree(packet);
     }
 
     rx_used = (eth[RX_FIFO_INF] >> 16) & 0xFF;
@@ -0,0 +1,329 @@
+#include <stdint.h>
+
+#include <armv7.h>
+#include <cprintf.h>
+#include <mm/memlayout.h>
+#include <mm/vm.h>
+#include <sync.h>
+#include <types.h>
+
+#include <drivers/l2cc.h>
+
+#define L2CC_BASE     0x1F002000    // L2 cache controller memory base address
+
+static volatile uint32_t *l2cc;
+
+// L2C-310 registers, divided by 4 for use as uint32_t[] indices
+#define L2CC_ID       (0x000 / 4)   // Cache ID Register
+  #define ID_IMPL(x)    (((x) >> 24) & 0xFF)  // Implementer
+  #define ID_PART(x)    (((x) >> 6) & 0xF)    // Part number
+  #define ID_RTL(x)     ((x) & 0x3F)          // RTL release
+  #define ID_IMPL_ARM   0x41
+  #define ID_PART_L310  0x3
+  #define ID_RTL_R2P0   0x4
+#define L2CC_CTRL     (0x100 / 4)   // Control Register
+  #define CTRL_EN       (1U << 0)   //   L2 Cache enable
+#define L2CC_AUX      (0x104 / 4)   // Auxiliary Control Register
+  #define AUX_ASSOC     (1U << 16)  //   Associativity (0 = 8-way, 1 = 16-way)
+  #define AUX_WAYSIZE(x) (((x) >> 17) & 0x7)  // Way size
+  #define AUX_EVMON     (1U << 20)  //   Event monitor bus enable
+  #define AUX_SHOVR     (1U << 22)  //   Shared attribute override enable
+  #define AUX_DPF       (1U << 28)  //   Data prefetch enable
+  #define AUX_IPF       (1U << 29)  //   Instruction prefetch enable
+  #define AUX_EBRESP    (1U << 30)  //   Early BRESP enable
+#define L2CC_TAG_LAT  (0x108 / 4)   // Tag RAM Latency Control Register
+#define L2CC_DATA_LAT (0x10C / 4)   // Data RAM Latency Control Register
+  #define LAT(s, r, w)  (((w) << 8) | ((r) << 4) | (s))
+  #define LAT_SETUP(x)  (((x) & 0x7) + 1)
+  #define LAT_READ(x)   ((((x) >> 4) & 0x7) + 1)
+  #define LAT_WRITE(x)  ((((x) >> 8) & 0x7) + 1)
+#define L2CC_EV_CTRL  (0x200 / 4)   // Event Counter Control Register
+  #define EV_CTRL_EN    (1U << 0)   //   Event counting enable
+  #define EV_CTRL_RST0  (1U << 1)   //   Reset counter 0
+  #define EV_CTRL_RST1  (1U << 2)   //   Reset counter 1
+#define L2CC_EV_CFG1  (0x204 / 4)   // Event Counter 1 Configuration Register
+#define L2CC_EV_CFG0  (0x208 / 4)   // Event Counter 0 Configuration Register
+  #define EV_CFG_DRHIT  (0x2 << 2)  //   Data read hits
+  #define EV_CFG_DRREQ  (0x3 << 2)  //   Data read requests
+#define L2CC_EV_CNT1  (0x20C / 4)   // Event Counter 1 Value Register
+#define L2CC_EV_CNT0  (0x210 / 4)   // Event Counter 0 Value Register
+#define L2CC_INT_MASK (0x214 / 4)   // Interrupt Mask Register
+#define L2CC_INT_CLR  (0x220 / 4)   // Interrupt Clear Register
+  #define INT_ALL       0x1FF
+#define L2CC_SYNC     (0x730 / 4)   // Cache Sync Register
+#define L2CC_INV_PA   (0x770 / 4)   // Invalidate Line by PA Register
+#define L2CC_INV_WAY  (0x77C / 4)   // Invalidate by Way Register
+#define L2CC_CLN_PA   (0x7B0 / 4)   // Clean Line by PA Register
+#define L2CC_FLS_PA   (0x7F0 / 4)   // Clean and Invalidate Line by PA Register
+#define L2CC_PF_CTRL  (0xF60 / 4)   // Prefetch Control Register
+  #define PF_OFFSET(x)  ((x) & 0x1F)  // Prefetch offset
+  #define PF_DROP       (1U << 24)  //   Prefetch drop enable
+  #define PF_DPF        (1U << 28)  //   Data prefetch enable
+  #define PF_IPF        (1U << 29)  //   Instruction prefetch enable
+  #define PF_DLF        (1U << 30)  //   Double linefill enable
+
+// Cache line size in bytes
+#define L2CC_LINE_SIZE  32
+
+// Spinlock serializing the maintenance operations.
+static struct SpinLock l2cc_lock;
+
+static unsigned l2cc_ways(void);
+static unsigned l2cc_way_size(void);
+static void     l2cc_sync(void);
+
+/*
+ * ----------------------------------------------------------------------------
+ * L2 Cache Controller
+ * ----------------------------------------------------------------------------
+ *
+ * See CoreLink Level 2 Cache Controller L2C-310 Technical Reference Manual.
+ *
+ * The controller is shared by all processors, so it is initialized once by the
+ * bootstrap processor, before the other processors are started. The cache
+ * operates on physical addresses and is completely transparent to the CPUs,
+ * but not to bus masters that access memory directly. Drivers for such
+ * devices must clean the L1 cache by virtual address first, and then use
+ * l2cc_clean_range(), l2cc_inv_range(), or l2cc_flush_range() on the physical
+ * addresses of their buffers.
+ *
+ */
+
+/**
+ * Initialize and enable the L2 cache controller.
+ */
+void
+l2cc_init(void)
+{
+  volatile uint32_t *regs;
+  uint32_t id, aux, ways;
+
+  regs = (volatile uint32_t *) KADDR(L2CC_BASE);
+
+  id = regs[L2CC_ID];
+  if ((ID_IMPL(id) != ID_IMPL_ARM) || (ID_PART(id) != ID_PART_L310)) {
+    cprintf("L2 cache controller not found (ID %08x)\n", id);
+    return;
+  }
+
+  spin_init(&l2cc_lock, "l2cc");
+  l2cc = regs;
+
+  // The auxiliary control and latency registers can be written only while
+  // the cache is disabled.
+  if (!(l2cc[L2CC_CTRL] & CTRL_EN)) {
+    // Keep the associativity and way size configured by the hardware. Enable
+    // prefetching of both instructions and data, early write responses, and
+    // the event monitor bus required by the event counters. Also keep the
+    // controller from turning shareable normal memory accesses into
+    // non-cacheable ones.
+    aux  = l2cc[L2CC_AUX];
+    aux |= AUX_EVMON | AUX_SHOVR | AUX_DPF | AUX_IPF | AUX_EBRESP;
+    l2cc[L2CC_AUX] = aux;
+
+    // The RAMs on the PBX-A9 core tile need only 1 cycle for all accesses.
+    l2cc[L2CC_TAG_LAT]  = LAT(0, 0, 0);
+    l2cc[L2CC_DATA_LAT] = LAT(0, 0, 0);
+
+    // The prefetch control register is implemented since r2p0. Fetch the
+    // line 8 lines ahead, which is enough to hide the DRAM latency for
+    // sequential accesses, and drop prefetches that would stall the bus.
+    if (ID_RTL(id) >= ID_RTL_R2P0)
+      l2cc[L2CC_PF_CTRL] = PF_DPF | PF_IPF | PF_DROP | PF_DLF | PF_OFFSET(7);
+
+    // The contents of the cache are undefined after reset.
+    ways = (1U << l2cc_ways()) - 1;
+    l2cc[L2CC_INV_WAY] = ways;
+    while (l2cc[L2CC_INV_WAY] & ways)
+      ;
+    l2cc_sync();
+
+    l2cc[L2CC_INT_MASK] = 0;
+    l2cc[L2CC_INT_CLR]  = INT_ALL;
+
+    l2cc[L2CC_CTRL] = CTRL_EN;
+  }
+
+  // Count data read requests and hits to estimate the hit rate.
+  l2cc[L2CC_EV_CFG0] = EV_CFG_DRREQ;
+  l2cc[L2CC_EV_CFG1] = EV_CFG_DRHIT;
+  l2cc[L2CC_EV_CTRL] = EV_CTRL_EN | EV_CTRL_RST0 | EV_CTRL_RST1;
+
+  cprintf("L2 cache: %uK, %u-way, %u-byte lines\n",
+          l2cc_ways() * l2cc_way_size() / 1024, l2cc_ways(), L2CC_LINE_SIZE);
+}
+
+// Get the number of ways.
+static unsigned
+l2cc_ways(void)
+{
+  return (l2cc[L2CC_AUX] & AUX_ASSOC) ? 16 : 8;
+}
+
+// Get the size of a single way in bytes.
+static unsigned
+l2cc_way_size(void)
+{
+  unsigned way_size = AUX_WAYSIZE(l2cc[L2CC_AUX]);
+
+  // Encoding 0 is reserved and behaves as 16 KB.
+  return 8192U << (way_size == 0 ? 1 : way_size);
+}
+
+// Wait for all buffered operations to complete.
+static void
+l2cc_sync(void)
+{
+  l2cc[L2CC_SYNC] = 0;
+  while (l2cc[L2CC_SYNC] & 1)
+    ;
+}
+
+// Apply a line maintenance operation to all lines in the given range.
+static void
+l2cc_range_op(unsigned reg, physaddr_t start, physaddr_t end)
+{
+  physaddr_t pa;
+
+  for (pa = start; pa < end; pa += L2CC_LINE_SIZE)
+    l2cc[reg] = pa;
+}
+
+/**
+ * Write back the dirty L2 cache lines in the given physical memory range
+ * (e.g., before a device reads the memory).
+ *
+ * @param pa The starting physical address.
+ * @param n  The size of the range in bytes.
+ */
+void
+l2cc_clean_range(physaddr_t pa, size_t n)
+{
+  if ((l2cc == NULL) || (n == 0))
+    return;
+
+  // Make sure the writes from the L1 cache have reached the controller.
+  dsb();
+
+  spin_lock(&l2cc_lock);
+  l2cc_range_op(L2CC_CLN_PA, ROUND_DOWN(pa, L2CC_LINE_SIZE), pa + n);
+  l2cc_sync();
+  spin_unlock(&l2cc_lock);
+}
+
+/**
+ * Discard the L2 cache lines in the given physical memory range (e.g., after
+ * a device writes to the memory). Partial lines at either end of the range
+ * are written back first to preserve the neighboring data.
+ *
+ * @param pa The starting physical address.
+ * @param n  The size of the range in bytes.
+ */
+void
+l2cc_inv_range(physaddr_t pa, size_t n)
+{
+  physaddr_t start, end;
+
+  if ((l2cc == NULL) || (n == 0))
+    return;
+
+  start = pa;
+  end   = pa + n;
+
+  dsb();
+
+  spin_lock(&l2cc_lock);
+
+  if (start & (L2CC_LINE_SIZE - 1)) {
+    start = ROUND_DOWN(start, L2CC_LINE_SIZE);
+    l2cc[L2CC_FLS_PA] = start;
+    start += L2CC_LINE_SIZE;
+  }
+
+  if ((end & (L2CC_LINE_SIZE - 1)) && (end > start)) {
+    end = ROUND_DOWN(end, L2CC_LINE_SIZE);
+    l2cc[L2CC_FLS_PA] = end;
+  }
+
+  l2cc_range_op(L2CC_INV_PA, start, end);
+  l2cc_sync();
+
+  spin_unlock(&l2cc_lock);
+}
+
+/**
+ * Write back and discard the L2 cache lines in the given physical memory
+ * range.
+ *
+ * @param pa The starting physical address.
+ * @param n  The size of the range in bytes.
+ */
+void
+l2cc_flush_range(physaddr_t pa, size_t n)
+{
+  if ((l2cc == NULL) || (n == 0))
+    return;
+
+  dsb();
+
+  spin_lock(&l2cc_lock);
+  l2cc_range_op(L2CC_FLS_PA, ROUND_DOWN(pa, L2CC_LINE_SIZE), pa + n);
+  l2cc_sync();
+  spin_unlock(&l2cc_lock);
+}
+
+/**
+ * Reset the event counters.
+ */
+void
+l2cc_reset_counters(void)
+{
+  if (l2cc == NULL)
+    return;
+
+  l2cc[L2CC_EV_CTRL] = EV_CTRL_EN | EV_CTRL_RST0 | EV_CTRL_RST1;
+}
+
+/**
+ * Display the L2 cache configuration and the event counters.
+ */
+void
+l2cc_info(void)
+{
+  uint32_t id, aux, tag, data, pf, reqs, hits;
+
+  if (l2cc == NULL) {
+    cprintf("L2 cache controller not present\n");
+    return;
+  }
+
+  id   = l2cc[L2CC_ID];
+  aux  = l2cc[L2CC_AUX];
+  tag  = l2cc[L2CC_TAG_LAT];
+  data = l2cc[L2CC_DATA_LAT];
+  pf   = ID_RTL(id) >= ID_RTL_R2P0 ? l2cc[L2CC_PF_CTRL] : 0;
+  reqs = l2cc[L2CC_EV_CNT0];
+  hits = l2cc[L2CC_EV_CNT1];
+
+  cprintf("ID:        %08x (RTL release %u)\n", id, ID_RTL(id));
+  cprintf("State:     %s\n",
+          (l2cc[L2CC_CTRL] & CTRL_EN) ? "enabled" : "disabled");
+  cprintf("Size:      %uK, %u-way, %uK ways, %u-byte lines\n",
+          l2cc_ways() * l2cc_way_size() / 1024, l2cc_ways(),
+          l2cc_way_size() / 1024, L2CC_LINE_SIZE);
+  cprintf("Aux:       %08x (prefetch i%s d%s, early BRESP %s, "
+          "shared override %s)\n", aux,
+          (aux & AUX_IPF) ? "+" : "-",
+          (aux & AUX_DPF) ? "+" : "-",
+          (aux & AUX_EBRESP) ? "on" : "off",
+          (aux & AUX_SHOVR) ? "on" : "off");
+  cprintf("Latency:   tag %u/%u/%u, data %u/%u/%u cycles (setup/read/write)\n",
+          LAT_SETUP(tag), LAT_READ(tag), LAT_WRITE(tag),
+          LAT_SETUP(data), LAT_READ(data), LAT_WRITE(data));
+  cprintf("Prefetch:  %08x (offset %u, double linefill %s, drop %s)\n", pf,
+          PF_OFFSET(pf),
+          (pf & PF_DLF) ? "on" : "off",
+          (pf & PF_DROP) ? "on" : "off");
+  cprintf("Reads:     %u requests, %u hits (%u%%)\n", reqs, hits,
+          reqs ? (unsigned) ((uint64_t) hits * 100 / reqs) : 0);
+}
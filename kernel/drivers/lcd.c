@@ -5,7 +5,9 @@
 #include <string.h>
 
 #include <drivers/console.h>
+#include <drivers/dma.h>
 
+#include <mm/cma.h>
 #include <mm/memlayout.h>
 #include <mm/page.h>
 #include <mm/vm.h>
@@ -92,13 +94,16 @@ struct PsfHeader {
 
 /**
  * Initialize the LCD driver.
+ *
+ * The frame buffer comes from the contiguous memory reserve, which is not
+ * available this early, so only the text buffer is set up here. The output is
+ * displayed after lcd_init_fb() is called.
  */
 int
 lcd_init(void)
 {
   extern uint8_t _binary_kernel_drivers_vga_font_psf_start[];
 
-  struct Page *page;
   struct PsfHeader *psf;
 
   // Load the font file.
@@ -109,12 +114,6 @@ lcd_init(void)
 
   font = (uint8_t *) (psf + 1);
 
-  // Allocate the frame buffer.
-  if ((page = page_alloc_block(8, PAGE_ALLOC_ZERO)) == NULL)
-    return -ENOMEM;
-  page->ref_count++;
-  frame_buf = (uint16_t *) page2kva(page);
-
   lcd = (volatile uint32_t *) KADDR(LCD_BASE);
 
   // Display resolution: VGA (640x480) on VGA.
@@ -122,15 +121,40 @@ lcd_init(void)
   lcd[LCD_TIMING1] = 0x090B61DF;
   lcd[LCD_TIMING2] = 0x067F1800;
 
+  // Clear the screen
+  lcd_buf_fill(0, BUF_SIZE, colors[COLOR_WHITE], colors[COLOR_BLACK]);
+
+  return 0;
+}
+
+/**
+ * Allocate the frame buffer and enable the display. Must be called after the
+ * page allocator is fully initialized.
+ */
+int
+lcd_init_fb(void)
+{
+  struct Page *page;
+  unsigned pos;
+
+  if (font == NULL)
+    return -EINVAL;
+
+  if ((page = cma_alloc(DISPLAY_SIZE * sizeof(*frame_buf), 0)) == NULL)
+    return -ENOMEM;
+  frame_buf = (uint16_t *) page2kva(page);
+
+  // Draw everything printed so far.
+  for (pos = 0; pos < BUF_SIZE; pos++)
+    lcd_vid_draw(pos, buf[pos].ch, buf[pos].fg, buf[pos].bg);
+  lcd_vid_draw(cur_pos, buf[cur_pos].ch, buf[cur_pos].bg, buf[cur_pos].fg);
+
   // Frame buffer physical base address.
   lcd[LCD_UPBASE] = PADDR(frame_buf);
 
   // Enable LCD, 16 bpp.
   lcd[LCD_CONTROL] = LCD_EN | LCD_BPP16 | LCD_PWR;
 
-  // Clear the screen
-  lcd_buf_fill(0, BUF_SIZE, colors[COLOR_WHITE], colors[COLOR_BLACK]);
-
   return 0;
 }
 
@@ -204,13 +228,42 @@ lcd_buf_putc(unsigned i, char c, uint16_t fg, uint16_t bg)
  * ----------------------------------------------------------------------------
  */
 
+// Until lcd_init_fb() allocates the frame buffer, only the text buffer is
+// updated.
+
 static void
 lcd_vid_copy(unsigned to, unsigned from, size_t n)
 {
-  unsigned x, y;
-  size_t i;
+  unsigned x, y, pos;
+  size_t i, size;
   uint16_t *src, *dst;
 
+  if (frame_buf == NULL)
+    return;
+
+  // Scrolling copies whole rows of text, which occupy a contiguous region of
+  // the frame buffer, so move them with a single DMA transfer. The console
+  // calls us while holding a spinlock, so we cannot sleep.
+  if ((to % BUF_WIDTH == 0) && (from % BUF_WIDTH == 0) &&
+      (n % BUF_WIDTH == 0)) {
+    dst  = &frame_buf[(to / BUF_WIDTH) * GLYPH_HEIGHT * DISPLAY_WIDTH];
+    src  = &frame_buf[(from / BUF_WIDTH) * GLYPH_HEIGHT * DISPLAY_WIDTH];
+    size = (n / BUF_WIDTH) * GLYPH_HEIGHT * DISPLAY_WIDTH * sizeof(*dst);
+
+    // The controller copies in the ascending order, so it cannot be used if
+    // the destination overlaps the end of the source.
+    if (((to > from) && (to < from + n)) ||
+        (dma_memcpy(dst, src, size, DMA_POLL) != 0))
+      memmove(dst, src, size);
+
+    // Erase the cursor that has been copied along with the text.
+    if ((cur_pos >= from) && (cur_pos < from + n)) {
+      pos = to + (cur_pos - from);
+      lcd_vid_draw(pos, buf[pos].ch, buf[pos].fg, buf[pos].bg);
+    }
+    return;
+  }
+
   for (i = 0; i < n; to++, from++, i++) {
     if (from == cur_pos) {
       lcd_vid_draw(to, buf[from].ch, buf[from].fg, buf[from].bg);
@@ -234,6 +287,9 @@ lcd_vid_fill(unsigned to, size_t n, uint16_t color)
   unsigned x, y, x0, y0;
   size_t i;
 
+  if (frame_buf == NULL)
+    return;
+
   for (i = 0; i < n; to++, i++) {
     x0 = (to % BUF_WIDTH) * GLYPH_WIDTH;
     y0 = (to / BUF_WIDTH) * GLYPH_HEIGHT;
@@ -256,6 +312,9 @@ lcd_vid_draw(unsigned pos, char c, uint16_t fg, uint16_t bg)
   uint8_t *glyph;
   uint16_t x0, y0, x, y;
 
+  if (frame_buf == NULL)
+    return;
+
   if (c == '\0')
     c = ' ';
   glyph = &font[c * GLYPH_HEIGHT];
@@ -160,6 +160,8 @@ sd_request(struct Buf *buf)
   if (buf->block_size % SD_BLOCKLEN != 0)
     panic("block size must be a multiple of %u", SD_BLOCKLEN);
 
+  buf->flags &= ~BUF_ERROR;
+
   spin_lock(&sd_queue.lock);
 
   // Add the request to the queue.
@@ -187,6 +189,7 @@ sd_intr(void)
   struct ListLink *link;
   struct Buf *buf, *next_buf;
   size_t nblocks;
+  int err;
 
   spin_lock(&sd_queue.lock);
 
@@ -201,15 +204,19 @@ sd_intr(void)
 
   nblocks = buf->block_size / SD_BLOCKLEN;
 
-  // Transfer the data and update the corresponding buffer flags.
+  // Transfer the data and update the corresponding buffer flags. The request
+  // is completed even if it fails, so that the waiting process wakes up.
   if (buf->flags & BUF_DIRTY) {
-    mmci_write_data(buf->data, buf->block_size);
+    err = mmci_write_data(buf->data, buf->block_size);
     buf->flags &= ~BUF_DIRTY;
   } else {
-    mmci_read_data(buf->data, buf->block_size);
+    err = mmci_read_data(buf->data, buf->block_size);
     buf->flags |= BUF_VALID;
   }
 
+  if (err)
+    buf->flags |= BUF_ERROR;
+
   // Multiple block transfers must be stopped manually by issuing CMD12
   if (nblocks > 1)
     mmci_send_command(CMD_STOP_TRANSMISSION, 0, RESPONSE_R1B, NULL);
@@ -50,11 +50,23 @@ copy_args(struct VM *vm, char *const args[], uintptr_t limit, char **sp)
   return i;
 }
 
+/**
+ * Load the program from a file into a new address space of the process, and
+ * set up the user-mode registers to start executing it with the given
+ * arguments and environment. The previous address space is not destroyed;
+ * this is left to the caller.
+ *
+ * @param proc The process.
+ * @param path The path name of the executable file.
+ * @param argv The argument list.
+ * @param envp The environment.
+ *
+ * @return The number of arguments on success, or a negative value on error.
+ */
 int
-process_exec(const char *path, char *const argv[], char *const envp[])
+process_load(struct Process *proc, const char *path, char *const argv[],
+             char *const envp[])
 {
-  struct Page *vm_page;
-  struct Process *proc;
   struct Inode *ip;
   Elf32_Ehdr elf;
   Elf32_Phdr ph;
@@ -62,7 +74,7 @@ process_exec(const char *path, char *const argv[], char *const envp[])
   struct VM *vm;
   uintptr_t heap, ustack;
   char *usp, *uargv, *uenvp;
-  int r, argc;
+  int r, argc, prot;
 
   if ((r = fs_name_lookup(path, &ip)) < 0)
     return r;
@@ -79,13 +91,11 @@ process_exec(const char *path, char *const argv[], char *const envp[])
     goto out1;
   }
 
-  if ((vm_page = page_alloc_block(1, PAGE_ALLOC_ZERO)) == NULL) {
+  if ((vm = vm_create()) == NULL) {
     r = -ENOMEM;
     goto out1;
   }
 
-  vm = vm_create();
-
   off = 0;
   if ((r = fs_inode_read(ip, &elf, sizeof(elf), &off)) != sizeof(elf))
     goto out2;
@@ -116,11 +126,24 @@ process_exec(const char *path, char *const argv[], char *const envp[])
       goto out2;
     }
 
-    if ((r = vm_user_alloc(vm, (void *) ph.vaddr, ph.memsz,
-                             VM_READ | VM_WRITE | VM_EXEC | VM_USER) < 0))
+    // Segments must be sorted by address and must not share pages, since
+    // mapping a segment replaces whatever was mapped at its pages before.
+    if (ROUND_DOWN(ph.vaddr, PAGE_SIZE) < ROUND_UP(heap, PAGE_SIZE)) {
+      r = -EINVAL;
       goto out2;
+    }
 
-    if ((r = vm_user_load(vm, (void *) ph.vaddr, ip, ph.filesz, ph.offset)) < 0)
+    // Segment contents are read from the file on first access. Read-only
+    // segments (the program text) are never copied, so their pages are
+    // shared by all processes running the program.
+    prot = VM_READ | VM_USER;
+    if (ph.flags & PF_W)
+      prot |= VM_WRITE;
+    if (ph.flags & PF_X)
+      prot |= VM_EXEC;
+
+    if ((r = vm_user_map_file(vm, (void *) ph.vaddr, ph.memsz, prot,
+                              ip, ph.offset, ph.filesz)) < 0)
       goto out2;
 
     heap = MAX(heap, ph.vaddr + ph.memsz);
@@ -128,8 +151,8 @@ process_exec(const char *path, char *const argv[], char *const envp[])
 
   // Allocate user stack.
   if ((r = vm_user_alloc(vm, (void *) ustack, USTACK_SIZE,
-                           VM_READ | VM_WRITE | VM_USER)) < 0)
-    return r;
+                         VM_READ | VM_WRITE | VM_USER)) < 0)
+    goto out2;
 
   // Copy args and environment.
   usp = (char *) USTACK_TOP;
@@ -146,11 +169,6 @@ process_exec(const char *path, char *const argv[], char *const envp[])
 
   fs_inode_unlock_put(ip);
 
-  proc = my_process();
-
-  vm_switch_user(vm);
-  vm_destroy(proc->vm);
-
   proc->vm    = vm;
   proc->heap  = heap;
   proc->stack = ustack;
@@ -168,10 +186,41 @@ process_exec(const char *path, char *const argv[], char *const envp[])
   return argc;
 
 out2:
+  // The areas hold references to the inode, and dropping them requires the
+  // inode lock.
+  fs_inode_unlock(ip);
   vm_destroy(vm);
+  fs_inode_put(ip);
+
+  return r;
 
 out1:
   fs_inode_unlock_put(ip);
 
   return r;
 }
+
+/**
+ * Replace the program executed by the current process.
+ *
+ * @param path The path name of the executable file.
+ * @param argv The argument list.
+ * @param envp The environment.
+ *
+ * @return The number of arguments on success, or a negative value on error.
+ */
+int
+process_exec(const char *path, char *const argv[], char *const envp[])
+{
+  struct Process *proc = my_process();
+  struct VM *vm = proc->vm;
+  int r;
+
+  if ((r = process_load(proc, path, argv, envp)) < 0)
+    return r;
+
+  vm_switch_user(proc->vm);
+  vm_destroy(vm);
+
+  return r;
+}
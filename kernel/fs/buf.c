@@ -4,6 +4,8 @@
 #include <drivers/sd.h>
 #include <list.h>
 #include <mm/kobject.h>
+#include <mm/page.h>
+#include <mm/shrinker.h>
 #include <sync.h>
 
 #include <fs/buf.h>
@@ -19,18 +21,90 @@ static struct {
   struct SpinLock lock;
 } buf_cache;
 
+static int           buf_ctor(void *);
+static unsigned long buf_shrink(unsigned long);
+
+static struct Shrinker buf_shrinker = {
+  .name   = "buf_cache",
+  .shrink = buf_shrink,
+};
+
 /**
  * Initialize the buffer cache.
  */
 void
 buf_init(void)
 {
-  buf_pool = kobject_pool_create("buf_pool", sizeof(struct Buf), 0);
+  buf_pool = kobject_pool_create("buf_pool", sizeof(struct Buf), 0,
+                                 buf_ctor, NULL);
   if (buf_pool == NULL)
     panic("cannot allocate buf_pool");
 
+  // Account the slab pages as buffer cache memory.
+  buf_pool->page_tag = PAGE_TAG_BUF;
+
   spin_init(&buf_cache.lock, "buf_cache");
   list_init(&buf_cache.head);
+
+  shrinker_register(&buf_shrinker);
+}
+
+// Shrinker callback: release unused buffers, starting from the least recently
+// used ones. The memory is returned to the page allocator by the object pool
+// shrinker once entire slabs become free, so report nothing here.
+static unsigned long
+buf_shrink(unsigned long nr)
+{
+  struct ListLink *l, *prev;
+  struct Buf *b;
+  unsigned long n, max;
+
+  if (!spin_trylock(&buf_cache.lock))
+    return 0;
+
+  // The allocation may have been triggered by growing the pool itself, so
+  // don't wait for the pool lock, and return the buffers directly to the slabs
+  // (kobject_free() may need to allocate a magazine).
+  if (!spin_trylock(&buf_pool->lock)) {
+    spin_unlock(&buf_cache.lock);
+    return 0;
+  }
+
+  // Release enough buffers to fill 'nr' pages.
+  max = nr * ((PAGE_SIZE + sizeof(struct Buf) - 1) / sizeof(struct Buf));
+
+  n = 0;
+  for (l = buf_cache.head.prev; (l != &buf_cache.head) && (n < max); l = prev) {
+    prev = l->prev;
+
+    b = LIST_CONTAINER(l, struct Buf, cache_link);
+    if ((b->ref_count != 0) || (b->flags & BUF_DIRTY))
+      continue;
+
+    list_remove(&b->cache_link);
+    buf_cache.size--;
+
+    kobject_free_locked(buf_pool, b);
+    n++;
+  }
+
+  spin_unlock(&buf_pool->lock);
+  spin_unlock(&buf_cache.lock);
+
+  return 0;
+}
+
+// Object pool constructor. Buffers are returned to the pool unlocked and with
+// no waiting processes, so this needs to be done only once per object.
+static int
+buf_ctor(void *p)
+{
+  struct Buf *buf = (struct Buf *) p;
+
+  list_init(&buf->wait_queue);
+  mutex_init(&buf->mutex, "buf");
+
+  return 0;
 }
 
 static struct Buf *
@@ -49,8 +123,6 @@ buf_alloc(void)
   buf->flags      = 0;
   buf->ref_count  = 0;
   buf->block_size = BLOCK_SIZE;
-  list_init(&buf->wait_queue);
-  mutex_init(&buf->mutex, "buf");
 
   list_add_front(&buf_cache.head, &buf->cache_link);
   buf_cache.size++;
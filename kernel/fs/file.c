@@ -18,7 +18,8 @@ static struct KObjectPool *file_pool;
 void
 file_init(void)
 {
-  if (!(file_pool = kobject_pool_create("file_pool", sizeof(struct File), 0)))
+  if (!(file_pool = kobject_pool_create("file_pool", sizeof(struct File), 0,
+                                         NULL, NULL)))
     panic("Cannot allocate file pool");
 
   spin_init(&file_lock, "file_lock");
@@ -11,6 +11,7 @@
 #include <fs/buf.h>
 #include <fs/ext2.h>
 #include <fs/fs.h>
+#include <mm/filemap.h>
 #include <process.h>
 #include <types.h>
 
@@ -95,6 +96,7 @@ fs_inode_put(struct Inode *ip)
     spin_unlock(&inode_cache.lock);
 
     if (r == 1) {
+      filemap_invalidate(ip);
       ext2_put_inode(ip);
       ip->flags = 0;
     }
@@ -381,6 +383,8 @@ fs_inode_write(struct Inode *ip, const void *buf, size_t nbyte, off_t *off)
   total = ext2_inode_write(ip, buf, nbyte, *off);
 
   if (total > 0) {
+    filemap_update(ip, buf, total, *off);
+
     *off += total;
 
     if ((size_t) *off > ip->size)
@@ -423,6 +427,7 @@ fs_inode_trunc(struct Inode *ip)
     return -EACCESS;
 
   ext2_inode_trunc(ip);
+  filemap_invalidate(ip);
 
   ip->size = 0;
   ip->ctime = ip->mtime = rtc_time();
@@ -49,6 +49,10 @@
 #define CP15_DFAR(x)    p15, 0, x, c6, c0, 0  ///< Data Fault Address
 #define CP15_IFAR(x)    p15, 0, x, c6, c0, 1  ///< Instruction Fault Address
 #define CP15_DACR(x)    p15, 0, x, c3, c0, 0  ///< Domain Access Control
+#define CP15_PRRR(x)    p15, 0, x, c10, c2, 0 ///< Primary Region Remap
+#define CP15_NMRR(x)    p15, 0, x, c10, c2, 1 ///< Normal Memory Remap
+#define CP15_VBAR(x)    p15, 0, x, c12, c0, 0 ///< Vector Base Address
+#define CP15_CONTEXTIDR(x) p15, 0, x, c13, c0, 1  ///< Context ID
 /** @} */
 
 /** @defgroup SctlrBits System Control Register bits
@@ -72,6 +76,30 @@
 #define CP15_SCTLR_TE     (1 << 30)   ///< Thumb Exception enable
 /** @} */
 
+/** @defgroup RemapBits Memory Remap Register bits
+ *  @{
+ */
+#define PRRR_TR(n, x)     ((x) << (2 * (n)))  ///< Memory type for region n
+#define PRRR_TR_SO        0x0                 ///<   Strongly-ordered
+#define PRRR_TR_DEVICE    0x1                 ///<   Device
+#define PRRR_TR_NORMAL    0x2                 ///<   Normal memory
+#define PRRR_DS1          (1 << 17)   ///< Device memory with S=1 is shareable
+#define PRRR_NS1          (1 << 19)   ///< Normal memory with S=1 is shareable
+
+#define NMRR_IR(n, x)     ((x) << (2 * (n)))       ///< Inner attribute
+#define NMRR_OR(n, x)     ((x) << (2 * (n) + 16))  ///< Outer attribute
+#define NMRR_NC           0x0         ///<   Non-cacheable
+#define NMRR_WB_WA        0x1         ///<   Write-Back, Write-Allocate
+#define NMRR_WT           0x2         ///<   Write-Through
+#define NMRR_WB           0x3         ///<   Write-Back, no Write-Allocate
+/** @} */
+
+/** @defgroup FsrBits Fault Status Register bits
+ *  @{
+ */
+#define DFSR_WNR          (1 << 11)   ///< Write not Read (DFSR only)
+/** @} */
+
 /** @defgroup CPAccessRights Coprocessor Access Rights
  *  @{
  */
@@ -163,6 +191,10 @@ CP15_GETTER(cp15_dfsr_get, CP15_DFSR(%0));
 CP15_GETTER(cp15_ifsr_get, CP15_IFSR(%0));
 CP15_GETTER(cp15_dfar_get, CP15_DFAR(%0));
 CP15_GETTER(cp15_ifar_get, CP15_IFAR(%0));
+CP15_SETTER(cp15_contextidr_set, CP15_CONTEXTIDR(%0));
+CP15_SETTER(cp15_prrr_set, CP15_PRRR(%0));
+CP15_SETTER(cp15_nmrr_set, CP15_NMRR(%0));
+CP15_SETTER(cp15_vbar_set, CP15_VBAR(%0));
 
 /**
  * Invalidate entire unified TLB.
@@ -182,6 +214,88 @@ cp15_tlbimva(uintptr_t va)
   asm volatile ("mcr p15, 0, %0, c8, c7, 1" : : "r"(va));
 }
 
+/**
+ * Invalidate entire unified TLB on all CPUs in the Inner Shareable domain.
+ */
+static inline void
+cp15_tlbiallis(void)
+{
+  asm volatile ("mcr p15, 0, %0, c8, c3, 0" : : "r"(0));
+}
+
+/**
+ * TLB Invalidate by ASID on all CPUs in the Inner Shareable domain.
+ *
+ * @param asid The ASID.
+ */
+static inline void
+cp15_tlbiasidis(uint32_t asid)
+{
+  asm volatile ("mcr p15, 0, %0, c8, c3, 2" : : "r"(asid));
+}
+
+/**
+ * TLB Invalidate by MVA and ASID on all CPUs in the Inner Shareable domain.
+ *
+ * @param mva The virtual address in bits [31:12] and the ASID in bits [7:0].
+ */
+static inline void
+cp15_tlbimvais(uintptr_t mva)
+{
+  asm volatile ("mcr p15, 0, %0, c8, c3, 1" : : "r"(mva));
+}
+
+/**
+ * Clean data cache line by MVA to the point of coherency.
+ *
+ * @param va The virtual address.
+ */
+static inline void
+cp15_dccmvac(uintptr_t va)
+{
+  asm volatile ("mcr p15, 0, %0, c7, c10, 1" : : "r"(va) : "memory");
+}
+
+/**
+ * Invalidate data cache line by MVA to the point of coherency.
+ *
+ * @param va The virtual address.
+ */
+static inline void
+cp15_dcimvac(uintptr_t va)
+{
+  asm volatile ("mcr p15, 0, %0, c7, c6, 1" : : "r"(va) : "memory");
+}
+
+/**
+ * Clean and invalidate data cache line by MVA to the point of coherency.
+ *
+ * @param va The virtual address.
+ */
+static inline void
+cp15_dccimvac(uintptr_t va)
+{
+  asm volatile ("mcr p15, 0, %0, c7, c14, 1" : : "r"(va) : "memory");
+}
+
+/**
+ * Data Synchronization Barrier.
+ */
+static inline void
+dsb(void)
+{
+  asm volatile ("dsb" : : : "memory");
+}
+
+/**
+ * Instruction Synchronization Barrier.
+ */
+static inline void
+isb(void)
+{
+  asm volatile ("isb" : : : "memory");
+}
+
 /**
  * Get the value of the R11 (FP) register.
  *
@@ -237,7 +351,7 @@ wfi(void)
 #define L2_TABLE_SIZE       (L2_NR_ENTRIES * 4)
 
 /** The number of bytes mapped by a section */
-#define L1_SECTION_SIZE     1232896
+#define L1_SECTION_SIZE     1048576
 /** The number of bytes mapped by a small page */
 #define L2_PAGE_SM_SIZE     4096
 /** The number of bytes mapped by a large page */
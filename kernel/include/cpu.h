@@ -5,6 +5,8 @@
 #error "This is a kernel header; user programs should not #include it"
 #endif
 
+#include <mm/page.h>
+
 struct Context;
 struct Task;
 
@@ -16,6 +18,10 @@ struct Cpu {
   struct Task  *task;         ///< The currently running task   
   int             irq_save_count; ///< Depth of irq_save() nesting
   int             irq_flags;      ///< Were interupts enabled before IRQ save?
+  /** Free page blocks cached by this CPU */
+  struct PageCache page_cache[PAGE_TYPES][PAGE_CACHE_ORDER_MAX + 1];
+  /** Pages allocated (minus pages freed) on this CPU, by owner */
+  long             page_tags[PAGE_TAGS];
 };
 
 /**
@@ -0,0 +1,45 @@
+#ifndef __KERNEL_DRIVERS_DMA_H__
+#define __KERNEL_DRIVERS_DMA_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/dma.h
+ *
+ * PrimeCell DMA Controller and the generic DMA API.
+ */
+
+#include <stddef.h>
+
+#include <mm/memlayout.h>
+
+struct DMAChannel;
+
+/** Transfer directions for dma_prep_slave() */
+#define DMA_TO_DEVICE     1       ///< Memory to peripheral
+#define DMA_FROM_DEVICE   2       ///< Peripheral to memory
+
+/** Flags for dma_start() and dma_memcpy() */
+#define DMA_POLL          (1 << 0)  ///< Busy-wait instead of sleeping
+
+void               dma_init(void);
+void               dma_intr(void);
+
+struct DMAChannel *dma_channel_alloc(void);
+void               dma_channel_free(struct DMAChannel *);
+int                dma_prep_memcpy(struct DMAChannel *, physaddr_t,
+                                   physaddr_t, size_t);
+int                dma_prep_slave(struct DMAChannel *, physaddr_t, physaddr_t,
+                                  size_t, unsigned, int);
+int                dma_start(struct DMAChannel *, int);
+int                dma_wait(struct DMAChannel *);
+
+int                dma_memcpy(void *, const void *, size_t, int);
+
+void               dma_cache_clean(const void *, size_t);
+void               dma_cache_inv(void *, size_t);
+void               dma_cache_flush(void *, size_t);
+
+#endif  // !__KERNEL_DRIVERS_DMA_H__
@@ -0,0 +1,25 @@
+#ifndef __KERNEL_DRIVERS_L2CC_H__
+#define __KERNEL_DRIVERS_L2CC_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/l2cc.h
+ *
+ * L2C-310 Level 2 Cache Controller.
+ */
+
+#include <stddef.h>
+
+#include <mm/memlayout.h>
+
+void l2cc_init(void);
+void l2cc_clean_range(physaddr_t, size_t);
+void l2cc_inv_range(physaddr_t, size_t);
+void l2cc_flush_range(physaddr_t, size_t);
+void l2cc_info(void);
+void l2cc_reset_counters(void);
+
+#endif  // !__KERNEL_DRIVERS_L2CC_H__
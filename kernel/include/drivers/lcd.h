@@ -14,6 +14,7 @@
 #include <stddef.h>
 
 int  lcd_init(void);
+int  lcd_init_fb(void);
 void lcd_putc(unsigned, char, int, int);
 void lcd_copy(unsigned, unsigned, size_t);
 void lcd_fill(unsigned, size_t, int, int);
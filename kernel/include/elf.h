@@ -53,4 +53,8 @@ typedef struct {
 #define PT_LOPROC   0x70000000
 #define PT_HIPROC   0x7fffffff
 
+#define PF_X        (1 << 0)        ///< Execute
+#define PF_W        (1 << 1)        ///< Write
+#define PF_R        (1 << 2)        ///< Read
+
 #endif  // !__KERNEL_ELF_H__
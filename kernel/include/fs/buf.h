@@ -40,6 +40,7 @@ struct Buf {
 // Buffer status flags
 #define BUF_VALID   (1 << 0)  ///< Buffer has been read from the disk
 #define BUF_DIRTY   (1 << 1)  ///< Buffer needs to be written to the disk
+#define BUF_ERROR   (1 << 2)  ///< The last request to the disk failed
 
 void        buf_init(void);
 struct Buf *buf_read(unsigned, dev_t);
@@ -0,0 +1,32 @@
+#ifndef __KERNEL_MM_CMA_H__
+#define __KERNEL_MM_CMA_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/cma.h
+ *
+ * Contiguous memory reserve for large physically contiguous buffers.
+ */
+
+#include <stddef.h>
+
+struct Page;
+
+/**
+ * Size of the reserve in bytes. Must be a multiple of the largest block size
+ * of the page allocator (4 MB).
+ */
+#define CMA_SIZE      (8 * 1024 * 1024)
+
+/** The number of attempts to migrate user pages out of a requested range. */
+#define CMA_RETRIES   16
+
+void          cma_init(void);
+struct Page  *cma_alloc(size_t, int);
+void          cma_free(struct Page *, size_t);
+void          cma_info(void);
+
+#endif  // !__KERNEL_MM_CMA_H__
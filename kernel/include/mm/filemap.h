@@ -0,0 +1,25 @@
+#ifndef __KERNEL_MM_FILEMAP_H__
+#define __KERNEL_MM_FILEMAP_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/filemap.h
+ *
+ * Cache of file pages mapped into user address spaces.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+struct Inode;
+struct Page;
+
+void filemap_init(void);
+int  filemap_get_page(struct Inode *, unsigned long, struct Page **);
+void filemap_update(struct Inode *, const void *, size_t, off_t);
+void filemap_invalidate(struct Inode *);
+
+#endif  // !__KERNEL_MM_FILEMAP_H__
@@ -0,0 +1,28 @@
+#ifndef __KERNEL_MM_KMALLOC_H__
+#define __KERNEL_MM_KMALLOC_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/kmalloc.h
+ * 
+ * General-purpose kernel memory allocator.
+ */
+
+#include <stddef.h>
+
+/** Fill the allocated memory with zeros. */
+#define KMALLOC_ZERO      (1 << 0)
+
+/** Log2 of the smallest size class. */
+#define KMALLOC_SHIFT_MIN 4
+/** Log2 of the largest size class; larger requests are served by pages. */
+#define KMALLOC_SHIFT_MAX 11
+
+void  kmalloc_init(void);
+void *kmalloc(size_t, int);
+void  kfree(void *);
+
+#endif  // !__KERNEL_MM_KMALLOC_H__
@@ -5,9 +5,52 @@
 #error "This is a kernel header; user programs should not #include it"
 #endif
 
+#include <cpu.h>
 #include <list.h>
 #include <sync.h>
 
+/** The maximum number of objects in a magazine. */
+#define KOBJECT_MAG_MAX   32
+
+#ifdef KOBJECT_DEBUG
+
+// In debug mode, each object is followed by a red zone word that holds one of
+// the two values below depending on whether the object is allocated or not.
+// Overruns and double frees are detected by checking this word. Free objects
+// from pools without a constructor are also filled with a poison byte, so
+// writes after free can be detected on the next allocation.
+
+/** Size of the red zone placed after each object. */
+#define KOBJECT_REDZONE_SIZE      sizeof(uint32_t)
+/** Red zone value for allocated objects. */
+#define KOBJECT_REDZONE_ACTIVE    0xD84156C5U
+/** Red zone value for free objects. */
+#define KOBJECT_REDZONE_INACTIVE  0x09F91102U
+/** Poison byte for free objects. */
+#define KOBJECT_POISON_FREE       0x6B
+
+#endif  // KOBJECT_DEBUG
+
+/**
+ * Magazine: a stack of free objects cached in front of the slab layer.
+ */
+struct KObjectMagazine {
+  struct ListLink   link;             ///< Link into the depot lists
+  unsigned          rounds;           ///< The number of objects
+  void             *objs[KOBJECT_MAG_MAX];  ///< Cached objects
+};
+
+/**
+ * Per-CPU magazine cache.
+ */
+struct KObjectCpuCache {
+  struct KObjectMagazine *loaded;     ///< Magazine to allocate from first
+  struct KObjectMagazine *previous;   ///< Previously loaded magazine
+  unsigned long           hits;       ///< Requests served from magazines
+  unsigned long           allocs;     ///< Allocation requests on this CPU
+  unsigned long           frees;      ///< Free requests on this CPU
+};
+
 /**
  * Object pool descriptor.
  */
@@ -18,16 +61,32 @@ struct KObjectPool {
   struct SpinLock   lock;             ///< Spinlock protecting the pool
 
   int               flags;            ///< Flags
+  int               page_tag;         ///< Owner tag for the slab pages
   size_t            obj_size;         ///< Size of each object
+  size_t            node_offset;      ///< Offset of the free list link
   unsigned          obj_num;          ///< The number of objects per slab
   unsigned          page_order;       ///< log2 of the slab size in pages
+#ifdef KOBJECT_DEBUG
+  size_t            redzone_offset;   ///< Offset of the red zone (0 = none)
+#endif
 
   size_t            color_offset;     ///< The number of different color lines
   size_t            color_align;      ///< Object alignment in the slab
   size_t            color_next;       ///< The next color offset to use
 
+  int             (*ctor)(void *);    ///< Object constructor
+  void            (*dtor)(void *);    ///< Object destructor
+
   const char       *name;             ///< Human-readable name for debugging
   struct ListLink   link;             ///< Link into the pool list
+
+  struct KObjectCpuCache cpu_caches[NCPU];  ///< Per-CPU magazines
+  struct ListLink   mags_full;        ///< Depot of full magazines
+  struct ListLink   mags_empty;       ///< Depot of empty magazines
+  unsigned          mag_size;         ///< Objects per magazine (0 = disabled)
+  unsigned long     mag_refills;      ///< Magazines exchanged with the depot
+  unsigned long     mag_misses;       ///< Requests passed to the slab layer
+  unsigned long     alloc_fails;      ///< Allocation requests that failed
 };
 
 enum {
@@ -43,21 +102,24 @@ struct KObjectNode {
  */
 struct KObjectSlab {
   struct ListLink     link;           ///< Link into the containing slab list
-  void               *buf;            ///< Starting address of 
+  struct KObjectPool *pool;           ///< The pool this slab belongs to
+  void               *buf;            ///< Starting address of the slab
   struct KObjectNode *free;           ///< Pointer to the list of free objects
   unsigned            in_use;         ///< The number of objects in use
 };
 
-struct KObjectPool *kobject_pool_create(const char *, size_t, size_t);
+struct KObjectPool *kobject_pool_create(const char *, size_t, size_t,
+                                        int (*)(void *), void (*)(void *));
 int                 kobject_pool_destroy(struct KObjectPool *);
+int                 kobject_pool_set_magazine(struct KObjectPool *, unsigned);
 
 void               *kobject_alloc(struct KObjectPool *);
 void                kobject_free(struct KObjectPool *, void *);
+void                kobject_free_locked(struct KObjectPool *, void *);
 
 void                kobject_pool_init(void);
 void                kobject_pool_info(void);
-
-void
-kobject_dump(struct KObjectPool *pool);
+struct KObjectPool *kobject_pool_lookup(const char *);
+void                kobject_dump(struct KObjectPool *);
 
 #endif  // !__KERNEL_MM_KOBJECT_H__
@@ -11,9 +11,6 @@
 /** Log2 of PAGE_SIZE. */
 #define PAGE_SHIFT      12
 
-/** Assume that we have at least 256M of physical memory */
-#define PHYS_TOP        0x10000000
-
 /** During the boot time, we can access only up to 16MB of physical memory */
 #define PHYS_ENTRY_TOP  (16 * 1024 * 1024)
 
@@ -25,6 +22,9 @@
 
 #define VECTORS_BASE    0xFFFF0000
 
+/** Physical memory at or above this address cannot be mapped at KERNEL_BASE */
+#define PHYS_LIMIT      (VECTORS_BASE - KERNEL_BASE)
+
 #define KSTACK_SIZE     4096  ///< Size of a per-process kernel stack
 
 #define KXSTACK_SIZE    16    ///< Size of a per-process exception stack
@@ -35,6 +35,10 @@
 
 #define USTACK_TOP      KERNEL_BASE
 #define USTACK_SIZE     (PAGE_SIZE * 4)
+#define USTACK_LIMIT    (16 * 1024 * 1024)  ///< Maximum size of the user stack
+
+/** Memory mappings created by mmap() are placed below this address */
+#define UMMAP_TOP       (USTACK_TOP - USTACK_LIMIT)
 
 #define MMIO_LIMIT      VECTORS_BASE
 #define MMIO_BASE       (MMIO_LIMIT - 16 * 1024 * 1024)
@@ -42,6 +46,7 @@
 #ifndef __ASSEMBLER__
 
 #include <assert.h>
+#include <stdint.h>
 
 /** Integer type wide enough to represent a physical address. */
 typedef unsigned long   physaddr_t;
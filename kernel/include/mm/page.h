@@ -18,6 +18,7 @@
 #include <mm/memlayout.h>
 
 struct KObjectSlab;
+struct meminfo;
 
 /**
  * Physical page block info.
@@ -26,11 +27,27 @@ struct Page {
   struct ListLink     link;         ///< Linked list node
   int                 ref_count;    ///< Reference counter
   struct KObjectSlab *slab;         ///< The slab this page belongs to
+  int                 tag;          ///< Owner of the allocated block
+  unsigned            order;        ///< Order of the block (for kmalloc)
 };
 
 extern struct Page *pages;
 extern unsigned npages;
 
+/**
+ * A contiguous range of physical memory.
+ */
+struct PhysRegion {
+  physaddr_t          start;        ///< Starting physical address
+  physaddr_t          end;          ///< Ending physical address (exclusive)
+};
+
+/** The maximum number of distinct physical memory regions. */
+#define PHYS_REGIONS_MAX  4
+
+extern struct PhysRegion phys_regions[];
+extern unsigned phys_nregions;
+
 /**
  * Given a page info structure, return the starting physical address.
  * 
@@ -86,6 +103,55 @@ kva2page(void *va)
 
 /** Fill the allocated page block with zeros. */ 
 #define PAGE_ALLOC_ZERO   (1 << 0)
+/** The page block will hold user data (short-lived, freed on process exit). */
+#define PAGE_ALLOC_USER   (1 << 1)
+
+/**
+ * Owners of allocated page blocks, for memory usage statistics.
+ */
+enum {
+  PAGE_TAG_KERNEL = 0,              ///< Miscellaneous kernel data
+  PAGE_TAG_SLAB   = 1,              ///< Object pool slabs
+  PAGE_TAG_PGTAB  = 2,              ///< Translation tables
+  PAGE_TAG_USER   = 3,              ///< User process memory
+  PAGE_TAG_KSTACK = 4,              ///< Kernel stacks
+  PAGE_TAG_BUF    = 5,              ///< Buffer cache
+  PAGE_TAGS       = 6,
+};
+
+/** Account the allocated block to the given owner (PAGE_TAG_USER is implied
+ *  by PAGE_ALLOC_USER). */
+#define PAGE_ALLOC_TAG(t)     ((t) << 8)
+#define PAGE_ALLOC_TAG_GET(f) (((f) >> 8) & 0xF)
+
+/** Log2 of the number of pages in a pageblock. */
+#define PAGEBLOCK_ORDER   8
+
+/**
+ * Free blocks are grouped by the expected lifetime of their allocations, so
+ * that long-lived kernel objects do not scatter over the whole memory and
+ * break up large blocks. Each pageblock of 2^PAGEBLOCK_ORDER pages is tagged
+ * with one of these types.
+ */
+enum {
+  PAGE_TYPE_KERNEL = 0,             ///< Long-lived kernel allocations
+  PAGE_TYPE_USER   = 1,             ///< User process pages
+  PAGE_TYPE_CMA    = 2,             ///< Contiguous memory reserve (see cma.h)
+  PAGE_TYPES       = 3,
+};
+
+/** The maximum order of page blocks kept in the per-CPU caches. */
+#define PAGE_CACHE_ORDER_MAX  2
+
+/**
+ * Per-CPU cache of free page blocks of a single order.
+ */
+struct PageCache {
+  struct ListLink     blocks;       ///< List of cached free blocks
+  unsigned            count;        ///< The number of blocks in the list
+  unsigned long       hits;         ///< Requests served from the cache
+  unsigned long       misses;       ///< Requests that had to refill the cache
+};
 
 void         page_init_low(void);
 void         page_init_high(void);
@@ -95,6 +161,18 @@ struct Page *page_alloc_block(unsigned, int);
 
 void         page_free_one(struct Page *);
 void         page_free_block(struct Page *, unsigned);
+void         page_block_split(struct Page *, unsigned);
 void         page_free_region(physaddr_t, physaddr_t);
+int          page_claim_region(physaddr_t, physaddr_t);
+
+void         page_cma_reserve(physaddr_t, physaddr_t);
+void         page_cma_isolate(int);
+
+void         page_cache_flush(void);
+int          page_zero_idle(void);
+int          page_reclaim_idle(void);
+int          page_frag_index(unsigned);
+void         page_stats(struct meminfo *);
+void         page_info(void);
 
 #endif  // !__KERNEL_MM_PAGE_H__
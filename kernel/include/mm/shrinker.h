@@ -0,0 +1,50 @@
+#ifndef __KERNEL_MM_SHRINKER_H__
+#define __KERNEL_MM_SHRINKER_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/shrinker.h
+ * 
+ * Reclaiming memory from kernel caches under memory pressure.
+ */
+
+#include <list.h>
+
+/**
+ * Shrinker descriptor.
+ *
+ * Caches that keep memory which is not strictly needed register a shrinker.
+ * When the page allocator runs low on free pages, it invokes the 'shrink'
+ * callback of every registered shrinker, asking it to release up to 'nr'
+ * pages. The callback returns the number of pages actually given back to
+ * the page allocator.
+ *
+ * Shrinkers are invoked in the reverse order of registration. A cache that
+ * releases its objects to an object pool, rather than pages to the page
+ * allocator, returns 0: the pages are given back, and reported, by the object
+ * pool shrinker, which is registered earlier and therefore runs later during
+ * the same pass. Such a cache must acquire the pool lock with spin_trylock()
+ * and release its objects with kobject_free_locked(), since kobject_free() may
+ * wait for the lock or allocate a magazine.
+ *
+ * The callbacks may be invoked from the page allocator with arbitrary locks
+ * held, so they must not sleep, must not allocate memory, and must use
+ * spin_trylock() to acquire any spinlocks.
+ */
+struct Shrinker {
+  const char       *name;             ///< Name (for debugging)
+  unsigned long   (*shrink)(unsigned long nr);  ///< Reclaim callback
+  unsigned long     calls;            ///< The number of callback invocations
+  unsigned long     freed;            ///< Total number of pages reclaimed
+  struct ListLink   link;             ///< Link into the list of shrinkers
+};
+
+void          shrinker_register(struct Shrinker *);
+void          shrinker_unregister(struct Shrinker *);
+unsigned long shrinker_run(unsigned long);
+void          shrinker_info(void);
+
+#endif  // !__KERNEL_MM_SHRINKER_H__
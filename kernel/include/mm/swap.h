@@ -0,0 +1,34 @@
+#ifndef __KERNEL_MM_SWAP_H__
+#define __KERNEL_MM_SWAP_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/swap.h
+ *
+ * Swap space for anonymous user pages.
+ */
+
+struct meminfo;
+struct Page;
+
+/**
+ * Size of the swap area in bytes. The area occupies the SD card blocks right
+ * after the end of the root filesystem (see the fs.img rule in the Makefile).
+ */
+#define SWAP_SIZE     (32 * 1024 * 1024)
+
+/** The number of pages reclaimed by a single vm_swap_out() call. */
+#define SWAP_CLUSTER  16
+
+void          swap_init(void);
+unsigned long swap_alloc(void);
+void          swap_dup(unsigned long);
+void          swap_free(unsigned long);
+int           swap_read(unsigned long, struct Page *);
+int           swap_write(unsigned long, struct Page *);
+void          swap_stats(struct meminfo *);
+
+#endif  // !__KERNEL_MM_SWAP_H__
@@ -0,0 +1,37 @@
+#ifndef __KERNEL_MM_UACCESS_H__
+#define __KERNEL_MM_UACCESS_H__
+
+#ifndef __KERNEL__
+#error "This is a kernel header; user programs should not #include it"
+#endif
+
+/**
+ * @file kernel/include/mm/uaccess.h
+ *
+ * Accessing memory of the current user process.
+ *
+ * The routines access user memory through the translation table of the
+ * current process, so they must be called only while that table is active
+ * (e.g., during system calls). Missing and copy-on-write pages are handled
+ * by the page fault handler, and invalid addresses make the routines return
+ * -EFAULT instead of crashing the kernel.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/**
+ * Exception table entry. If the instruction at 'insn' causes a fault that
+ * cannot be resolved, execution resumes at 'fixup'.
+ */
+struct ExTableEntry {
+  uintptr_t insn;     ///< Address of the instruction that may fault
+  uintptr_t fixup;    ///< Address to continue execution at
+};
+
+int     copy_from_user(void *, const void *, size_t);
+int     copy_to_user(void *, const void *, size_t);
+ssize_t strncpy_from_user(char *, const char *, size_t);
+
+#endif  // !__KERNEL_MM_UACCESS_H__
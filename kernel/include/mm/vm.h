@@ -11,6 +11,8 @@
 #include <armv7.h>
 #include <elf.h>
 #include <list.h>
+#include <sync.h>
+#include <mm/memlayout.h>
 
 struct Inode;
 struct Page;
@@ -21,25 +23,43 @@ struct Page;
 #define VM_EXEC     (1 << 3)  ///< Executable
 #define VM_NOCACHE  (1 << 4)  ///< Disable caching
 #define VM_COW      (1 << 5)  ///< Copy-on-write
-
+#define VM_SHARED   (1 << 6)  ///< Shared between processes (never copied)
+#define VM_OLD      (1 << 7)  ///< Not accessed since the last clock pass
+#define VM_SWAP     (1 << 8)  ///< Swapped out (the entry holds the swap slot)
+
+/**
+ * A contiguous region of the user address space. Pages inside the region are
+ * allocated on first access. Until the first write, zero-filled private pages
+ * are mapped to a single shared zero page.
+ *
+ * If the area is backed by a file, the first file_size bytes of the area are
+ * read from the file starting at the given offset, and the rest is filled with
+ * zeros. Each page gets its private copy of the file contents on the first
+ * write (until then, the page of the file cache is mapped read-only), unless
+ * the area is VM_SHARED: then the pages of the file cache are mapped directly,
+ * and the changes are written back to the file.
+ */
 struct VMArea {
-  struct ListLink link;
-  uintptr_t       start;
-  size_t          length;
-  int             flags;
+  struct ListLink link;     ///< Link into the list of areas, sorted by address
+  uintptr_t       start;    ///< Starting virtual address (page-aligned)
+  size_t          length;   ///< Length in bytes (multiple of the page size)
+  int             flags;    ///< Protection flags for the pages
+  struct Inode   *inode;    ///< The backing file (or NULL)
+  off_t           offset;   ///< File offset corresponding to start
+  size_t          file_size;  ///< The number of bytes backed by the file
 };
 
+/**
+ * User address space.
+ */
 struct VM {
-  l1_desc_t          *trtab;
-  struct ListLink areas;
+  l1_desc_t      *trtab;    ///< Translation table
+  struct ListLink areas;    ///< List of mapped areas
+  unsigned long   asid;     ///< ASID generation and value (0 = not assigned)
+  struct Mutex    mutex;    ///< Held while changing the translation table
+  struct ListLink link;     ///< Link into the list scanned by the page clock
 };
 
-static inline int
-vm_L2_DESC_get_flags(l2_desc_t *pte)
-{
-  return *(pte + (L2_NR_ENTRIES * 2));
-}
-
 void         vm_init(void);
 void         vm_init_percpu(void);
 
@@ -50,18 +70,29 @@ struct VM   *vm_create(void);
 void         vm_destroy(struct VM *);
 struct VM   *vm_clone(struct VM *);
 
+void         vm_page_get(struct Page *);
+void         vm_page_put(struct Page *);
+
 struct Page *vm_lookup_page(l1_desc_t *, const void *, l2_desc_t **);
-int          vm_insert_page(l1_desc_t *, struct Page *, void *, unsigned);
-void         vm_remove_page(l1_desc_t *, void *);
+int          vm_insert_page(struct VM *, struct Page *, void *, unsigned);
+void         vm_remove_page(struct VM *, void *);
 
 int          vm_user_copy_out(struct VM *, void *, const void *, size_t);
 int          vm_user_copy_in(struct VM *, void *, const void *, size_t);
-int          vm_user_check_buf(struct VM *, const void *, size_t, unsigned);
-int          vm_user_check_str(struct VM *, const char *, unsigned);
 
 int          vm_user_load(struct VM *, void *, struct Inode *, size_t, off_t);
 
 int          vm_user_alloc(struct VM *, void *, size_t, int);
-void         vm_user_dealloc(struct VM *, void *, size_t);
+int          vm_user_map_file(struct VM *, void *, size_t, int,
+                              struct Inode *, off_t, size_t);
+int          vm_user_dealloc(struct VM *, void *, size_t);
+int          vm_user_sync(struct VM *, void *, size_t);
+uintptr_t    vm_user_find_free(struct VM *, size_t, uintptr_t, uintptr_t);
+int          vm_user_is_free(struct VM *, uintptr_t, uintptr_t);
+int          vm_handle_fault(struct VM *, uintptr_t, int);
+
+unsigned long vm_swap_out(unsigned long);
+
+int          vm_migrate_range(physaddr_t, physaddr_t);
 
 #endif  // !__KERNEL_MM_VM_H__
@@ -35,4 +35,19 @@ int mon_backtrace(int, char **, struct TrapFrame *);
 
 int mon_poolinfo(int, char **, struct TrapFrame *);
 
+/**
+ * Display the page allocator statistics.
+ */
+int mon_pageinfo(int, char **, struct TrapFrame *);
+
+/**
+ * Display the physical memory usage.
+ */
+int mon_meminfo(int, char **, struct TrapFrame *);
+
+/**
+ * Display the L2 cache configuration and event counters.
+ */
+int mon_l2cache(int, char **, struct TrapFrame *);
+
 #endif  // !KERNEL_MONITOR_H
@@ -6,6 +6,7 @@
 #endif
 
 #include <limits.h>
+#include <spawn.h>
 #include <sys/types.h>
 
 #include <cpu.h>
@@ -60,7 +61,11 @@ void  process_destroy(int);
 void  process_free(struct Process *);
 pid_t process_copy(void);
 pid_t process_wait(pid_t, int *, int);
+int   process_load(struct Process *, const char *, char *const[],
+                   char *const[]);
 int   process_exec(const char *, char *const[], char *const[]);
+pid_t process_spawn(const char *, char *const[], char *const[],
+                    const posix_spawn_file_actions_t *);
 void *process_grow(ptrdiff_t);
 
 #endif  // __KERNEL_PROCESS_H__
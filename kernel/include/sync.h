@@ -31,6 +31,7 @@ struct SpinLock {
 
 void spin_init(struct SpinLock *, const char *);
 void spin_lock(struct SpinLock *);
+int  spin_trylock(struct SpinLock *);
 void spin_unlock(struct SpinLock *);
 int  spin_holding(struct SpinLock *);
 
@@ -43,6 +44,7 @@ struct Mutex {
 
 void mutex_init(struct Mutex *, const char *);
 void mutex_lock(struct Mutex *);
+int  mutex_trylock(struct Mutex *);
 void mutex_unlock(struct Mutex *);
 int  mutex_holding(struct Mutex *);
 
@@ -32,5 +32,10 @@ int32_t sys_sbrk(void);
 int32_t sys_mknod(void);
 int32_t sys_uname(void);
 int32_t sys_chmod(void);
+int32_t sys_meminfo(void);
+int32_t sys_mmap(void);
+int32_t sys_munmap(void);
+int32_t sys_msync(void);
+int32_t sys_spawn(void);
 
 #endif  // !__KERNEL_SYSCALL_H__
@@ -5,6 +5,12 @@
 KERNEL_CFLAGS  := $(CFLAGS) $(INIT_CFLAGS) -Ikernel/include -D__KERNEL__
 KERNEL_LDFLAGS := $(LDFLAGS) -T kernel/kernel.ld -nostdlib
 
+# Build with `make KOBJECT_DEBUG=1` to enable red zones and poisoning in the
+# object allocator
+ifdef KOBJECT_DEBUG
+	KERNEL_CFLAGS += -DKOBJECT_DEBUG
+endif
+
 ifdef PROCESS_NAME
 	KERNEL_MAIN_CFLAGS := -DPROCESS_NAME=$(PROCESS_NAME)
 endif
@@ -15,7 +21,9 @@ KERNEL_SRCFILES :=	\
 	kernel/drivers/lcd.c \
 	kernel/drivers/uart.c \
 	kernel/drivers/console.c \
+	kernel/drivers/dma.c \
 	kernel/drivers/gic.c \
+	kernel/drivers/l2cc.c \
 	kernel/drivers/rtc.c \
 	kernel/drivers/sd.c \
 	kernel/fs/bitmap.c \
@@ -29,7 +37,13 @@ KERNEL_SRCFILES :=	\
 	kernel/fs/super.c \
 	kernel/fs/super_ops.c \
 	kernel/mm/page.c \
+	kernel/mm/cma.c \
+	kernel/mm/filemap.c \
+	kernel/mm/kmalloc.c \
 	kernel/mm/kobject.c \
+	kernel/mm/shrinker.c \
+	kernel/mm/swap.c \
+	kernel/mm/uaccess.S \
 	kernel/mm/vm.c \
 	kernel/context.S \
 	kernel/cprintf.c \
@@ -7,12 +7,18 @@
 #include <cprintf.h>
 #include <cpu.h>
 #include <drivers/console.h>
+#include <drivers/dma.h>
 // #include <drivers/eth.h>
 #include <drivers/gic.h>
+#include <drivers/l2cc.h>
+#include <drivers/lcd.h>
 #include <drivers/rtc.h>
 #include <drivers/sd.h>
 #include <fs/buf.h>
 #include <fs/file.h>
+#include <mm/cma.h>
+#include <mm/filemap.h>
+#include <mm/kmalloc.h>
 #include <mm/kobject.h>
 #include <mm/memlayout.h>
 #include <mm/page.h>
@@ -45,20 +51,26 @@ main(void)
   // Setup the memory mappings first
   page_init_low();      // Physical page allocator (lower memory)
   kobject_pool_init();  // Object allocator
+  kmalloc_init();       // General-purpose allocator
   vm_init();            // Kernel virtual memory
 
   // Now we can initialize the console and print messages
   gic_init();           // Interrupt controller
   console_init();       // Console driver
+  l2cc_init();          // L2 cache controller
 
   // Perform the rest of initialization
+  cma_init();           // Contiguous memory reserve
   page_init_high();     // Physical page allocator (higher memory)
+  lcd_init_fb();        // LCD frame buffer
   
   ptimer_init();        // Private timer
   rtc_init();           // Real-time clock
+  dma_init();           // DMA controller
   sd_init();            // MultiMedia Card Interface
   buf_init();           // Buffer cache
   file_init();          // File table
+  filemap_init();       // File page cache
   scheduler_init();     // Scheduler
   process_init();       // Process table
 
@@ -0,0 +1,225 @@
+#include <assert.h>
+#include <string.h>
+
+#include <cprintf.h>
+#include <cpu.h>
+#include <mm/memlayout.h>
+#include <mm/page.h>
+#include <mm/vm.h>
+#include <scheduler.h>
+#include <sync.h>
+#include <types.h>
+
+#include <mm/cma.h>
+
+// Buffers such as framebuffers, DMA rings and network packet pools must be
+// physically contiguous, but after running for a while the buddy allocator
+// rarely has large free blocks left. Therefore, a region at the top of the
+// physical memory is reserved for such buffers at boot time.
+//
+// The reserve is not wasted while idle: its free blocks are lent to user
+// allocations (see page_buddy_fallback()). When a buffer is requested, lending
+// is suspended, the user pages found in the chosen range are migrated
+// elsewhere (see vm_migrate_range()), and the range is taken out of the free
+// lists.
+//
+// The reserve is managed with a bitmap of pages, in which a range is marked
+// as soon as it is chosen for a request, so that concurrent requests never
+// compete for the same pages. The bitmap is protected by a spinlock rather
+// than a mutex, since the first buffers are allocated at boot time, before
+// there are any tasks.
+
+#define CMA_PAGES     (CMA_SIZE / PAGE_SIZE)
+
+static struct {
+  physaddr_t      start;          // Starting physical address
+  physaddr_t      end;            // Ending physical address
+  uint32_t        map[CMA_PAGES / 32];  // Allocated pages
+  unsigned long   used;           // The number of allocated pages
+  unsigned long   nalloc;         // The number of successful requests
+  unsigned long   nfail;          // The number of failed requests
+  struct SpinLock lock;           // Protects the bitmap and the counters
+} cma = {
+  .lock = SPIN_INITIALIZER("cma"),
+};
+
+// Check whether the i-th page of the reserve is allocated.
+static int
+cma_test(unsigned long i)
+{
+  return cma.map[i / 32] & (1U << (i % 32));
+}
+
+// Mark n pages starting from the i-th page of the reserve as allocated or as
+// free.
+static void
+cma_mark(unsigned long i, unsigned long n, int used)
+{
+  for ( ; n > 0; i++, n--) {
+    if (used)
+      cma.map[i / 32] |= (1U << (i % 32));
+    else
+      cma.map[i / 32] &= ~(1U << (i % 32));
+  }
+}
+
+// Find the first range of n free pages in the reserve. Return its index, or
+// CMA_PAGES if there is no such range. The caller must hold cma.lock.
+static unsigned long
+cma_find(unsigned long n)
+{
+  unsigned long i, len, npages;
+
+  assert(spin_holding(&cma.lock));
+
+  npages = (cma.end - cma.start) / PAGE_SIZE;
+
+  for (i = len = 0; i < npages; i++) {
+    len = cma_test(i) ? 0 : len + 1;
+    if (len == n)
+      return i + 1 - n;
+  }
+
+  return CMA_PAGES;
+}
+
+/**
+ * Set up the contiguous memory reserve at the top of the physical memory.
+ * Must be called after page_init_low() but before page_init_high().
+ */
+void
+cma_init(void)
+{
+  struct PhysRegion *region;
+  physaddr_t end;
+
+  region = &phys_regions[phys_nregions - 1];
+  end    = ROUND_DOWN(region->end, PAGE_SIZE << PAGE_ORDER_MAX);
+
+  if ((end < CMA_SIZE) ||
+      (end - CMA_SIZE < MAX(region->start, (physaddr_t) PHYS_ENTRY_TOP))) {
+    warn("not enough memory for the contiguous memory reserve");
+    return;
+  }
+
+  page_cma_reserve(end - CMA_SIZE, end);
+
+  cma.start = end - CMA_SIZE;
+  cma.end   = end;
+}
+
+/**
+ * Allocate a physically contiguous buffer from the reserve.
+ *
+ * The caller may sleep and must not hold the mutex of any address space.
+ *
+ * @param n     The size of the buffer in bytes.
+ * @param flags The set of allocation flags (only PAGE_ALLOC_ZERO is used).
+ *
+ * @return The page info structure of the first page of the buffer, or NULL if
+ *         there is no suitable range or it cannot be freed.
+ */
+struct Page *
+cma_alloc(size_t n, int flags)
+{
+  physaddr_t start, end;
+  unsigned long first, npages, tries;
+  int r;
+
+  npages = ROUND_UP(n, PAGE_SIZE) / PAGE_SIZE;
+  if ((npages == 0) || (npages > CMA_PAGES))
+    return NULL;
+
+  spin_lock(&cma.lock);
+
+  if ((cma.start == cma.end) || ((first = cma_find(npages)) == CMA_PAGES)) {
+    cma.nfail++;
+    spin_unlock(&cma.lock);
+    return NULL;
+  }
+
+  cma_mark(first, npages, 1);
+
+  spin_unlock(&cma.lock);
+
+  start = cma.start + first * PAGE_SIZE;
+  end   = start + npages * PAGE_SIZE;
+
+  // Stop lending the reserve, so that the migrated pages don't come back.
+  page_cma_isolate(1);
+
+  // The owners of some user pages in the range may be busy changing their
+  // address spaces, so give them a chance to finish.
+  for (tries = 0; ; tries++) {
+    if (((r = page_claim_region(start, end)) == 0) || (tries == CMA_RETRIES))
+      break;
+
+    if ((vm_migrate_range(start, end) == 0) || (my_task() == NULL))
+      continue;
+
+    task_yield();
+  }
+
+  page_cma_isolate(0);
+
+  spin_lock(&cma.lock);
+
+  if (r != 0) {
+    cma_mark(first, npages, 0);
+    cma.nfail++;
+    spin_unlock(&cma.lock);
+    return NULL;
+  }
+
+  cma.used += npages;
+  cma.nalloc++;
+
+  spin_unlock(&cma.lock);
+
+  if (flags & PAGE_ALLOC_ZERO)
+    memset(KADDR(start), 0, npages * PAGE_SIZE);
+
+  return pa2page(start);
+}
+
+/**
+ * Return a buffer allocated by cma_alloc() to the reserve.
+ *
+ * @param page The first page of the buffer.
+ * @param n    The size of the buffer in bytes.
+ */
+void
+cma_free(struct Page *page, size_t n)
+{
+  physaddr_t start;
+  unsigned long npages;
+
+  start  = page2pa(page);
+  npages = ROUND_UP(n, PAGE_SIZE) / PAGE_SIZE;
+
+  assert((start >= cma.start) && (start + npages * PAGE_SIZE <= cma.end));
+
+  page_free_region(start, start + npages * PAGE_SIZE);
+
+  spin_lock(&cma.lock);
+  cma_mark((start - cma.start) / PAGE_SIZE, npages, 0);
+  cma.used -= npages;
+  spin_unlock(&cma.lock);
+}
+
+/**
+ * Display the contiguous memory reserve statistics.
+ */
+void
+cma_info(void)
+{
+  if (cma.start == cma.end) {
+    cprintf("CMA: none\n");
+    return;
+  }
+
+  cprintf("CMA: [%08lx-%08lx] %lu KB, used %lu KB, allocs: %lu, "
+          "failures: %lu\n", cma.start, cma.end - 1,
+          (cma.end - cma.start) / 1024, cma.used * (PAGE_SIZE / 1024),
+          cma.nalloc, cma.nfail);
+}
@@ -0,0 +1,306 @@
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+
+#include <cprintf.h>
+#include <fs/fs.h>
+#include <hash.h>
+#include <mm/kobject.h>
+#include <mm/page.h>
+#include <mm/shrinker.h>
+#include <mm/vm.h>
+#include <sync.h>
+#include <types.h>
+
+#include <mm/filemap.h>
+
+// Pages of mapped files are kept in a cache, so that all processes mapping the
+// same part of a file share the same physical page. This covers both
+// MAP_SHARED mappings and private mappings that have not been written to yet,
+// such as the text of running programs.
+//
+// Cached pages are identified by the device and inode numbers rather than by
+// the Inode structure, so they survive the inode being evicted from the inode
+// cache. The cache holds one reference to each page, and every mapping holds
+// another one (see vm_page_get() and vm_page_put()). Pages that are no longer
+// mapped anywhere are released by the shrinker under memory pressure.
+//
+// Locking: new references to a cached page can only be obtained through the
+// cache under filemap.lock, so a page with a single reference seen while
+// holding the lock is not used by anyone else and can be freed.
+
+// Size of the hash table
+#define NBUCKET   64
+
+/**
+ * Cached file page.
+ */
+struct FilePage {
+  struct ListLink link;     ///< Link into the hash table
+  dev_t           dev;      ///< Device of the file
+  ino_t           ino;      ///< Inode number of the file
+  unsigned long   index;    ///< Page index within the file
+  struct Page    *page;     ///< The page holding the data
+};
+
+static struct {
+  struct ListLink table[NBUCKET];
+  struct SpinLock lock;
+  unsigned long   size;
+} filemap;
+
+static struct KObjectPool *filemap_pool;
+
+static unsigned long filemap_shrink(unsigned long);
+
+static struct Shrinker filemap_shrinker = {
+  .name   = "filemap",
+  .shrink = filemap_shrink,
+};
+
+/**
+ * Initialize the file page cache.
+ */
+void
+filemap_init(void)
+{
+  filemap_pool = kobject_pool_create("filemap_pool", sizeof(struct FilePage),
+                                     0, NULL, NULL);
+  if (filemap_pool == NULL)
+    panic("cannot allocate filemap_pool");
+
+  HASH_INIT(filemap.table);
+  spin_init(&filemap.lock, "filemap");
+
+  shrinker_register(&filemap_shrinker);
+}
+
+static unsigned long
+filemap_key(dev_t dev, ino_t ino, unsigned long index)
+{
+  return ((ino * 31) ^ dev) + index;
+}
+
+// Find the cached page at the given index of the file.
+static struct FilePage *
+filemap_lookup(dev_t dev, ino_t ino, unsigned long index)
+{
+  struct ListLink *l;
+  struct FilePage *fp;
+
+  assert(spin_holding(&filemap.lock));
+
+  HASH_FOREACH_ENTRY(filemap.table, l, filemap_key(dev, ino, index)) {
+    fp = LIST_CONTAINER(l, struct FilePage, link);
+    if ((fp->dev == dev) && (fp->ino == ino) && (fp->index == index))
+      return fp;
+  }
+
+  return NULL;
+}
+
+/**
+ * Get the page holding the contents of the file at the given page index,
+ * reading it from the file if it is not cached yet. The part of the page
+ * beyond the end of the file is filled with zeros.
+ *
+ * The caller gets a reference to the page and must drop it with vm_page_put().
+ *
+ * @param ip    The file.
+ * @param index The page index within the file.
+ * @param pagep Pointer to the memory location to store the page.
+ *
+ * @return 0 on success, -ENOMEM if out of memory, or a negative value if the
+ *         file cannot be read.
+ */
+int
+filemap_get_page(struct Inode *ip, unsigned long index, struct Page **pagep)
+{
+  struct FilePage *fp;
+  struct Page *page;
+  uint8_t *kva;
+  off_t off;
+  ssize_t r;
+  int locked;
+
+  // The fault may be triggered by the kernel accessing user memory while
+  // holding the inode lock already. Holding the lock also guarantees that
+  // nobody else can add the same page to the cache while it is being read.
+  if (!(locked = mutex_holding(&ip->mutex)))
+    fs_inode_lock(ip);
+
+  spin_lock(&filemap.lock);
+  if ((fp = filemap_lookup(ip->dev, ip->ino, index)) != NULL) {
+    vm_page_get(fp->page);
+    spin_unlock(&filemap.lock);
+
+    *pagep = fp->page;
+    r = 0;
+    goto out;
+  }
+  spin_unlock(&filemap.lock);
+
+  if ((fp = (struct FilePage *) kobject_alloc(filemap_pool)) == NULL) {
+    r = -ENOMEM;
+    goto out;
+  }
+
+  if ((page = page_alloc_one(PAGE_ALLOC_TAG(PAGE_TAG_BUF))) == NULL) {
+    kobject_free(filemap_pool, fp);
+    r = -ENOMEM;
+    goto out;
+  }
+
+  kva = (uint8_t *) page2kva(page);
+  off = index * PAGE_SIZE;
+
+  if ((r = fs_inode_read(ip, kva, PAGE_SIZE, &off)) < 0) {
+    page_free_one(page);
+    kobject_free(filemap_pool, fp);
+    goto out;
+  }
+
+  memset(kva + r, 0, PAGE_SIZE - r);
+
+  fp->dev   = ip->dev;
+  fp->ino   = ip->ino;
+  fp->index = index;
+  fp->page  = page;
+
+  // One reference for the cache, and one for the caller.
+  page->ref_count = 2;
+
+  spin_lock(&filemap.lock);
+  HASH_PUT(filemap.table, &fp->link, filemap_key(fp->dev, fp->ino, index));
+  filemap.size++;
+  spin_unlock(&filemap.lock);
+
+  *pagep = page;
+  r = 0;
+
+out:
+  if (!locked)
+    fs_inode_unlock(ip);
+
+  return r;
+}
+
+/**
+ * Copy the data written to a file into the cached pages, so that processes
+ * mapping the file see the changes. The caller must hold ip->mutex.
+ *
+ * @param ip  The file.
+ * @param buf The data written.
+ * @param n   The number of bytes written.
+ * @param off The file offset the data was written at.
+ */
+void
+filemap_update(struct Inode *ip, const void *buf, size_t n, off_t off)
+{
+  struct FilePage *fp;
+  const uint8_t *src;
+  uint8_t *dst;
+  size_t offset, ncopy;
+
+  src = (const uint8_t *) buf;
+
+  spin_lock(&filemap.lock);
+
+  while ((n > 0) && (filemap.size > 0)) {
+    offset = off % PAGE_SIZE;
+    ncopy  = MIN(PAGE_SIZE - offset, n);
+
+    if ((fp = filemap_lookup(ip->dev, ip->ino, off / PAGE_SIZE)) != NULL) {
+      dst = (uint8_t *) page2kva(fp->page) + offset;
+
+      // When a mapping is synced, the data comes from the cached page itself.
+      if (dst != src)
+        memmove(dst, src, ncopy);
+    }
+
+    src += ncopy;
+    off += ncopy;
+    n   -= ncopy;
+  }
+
+  spin_unlock(&filemap.lock);
+}
+
+/**
+ * Remove all pages of the file from the cache (e.g., because the file is
+ * truncated or deleted). Pages that are still mapped remain valid until they
+ * are unmapped, but are no longer shared with the new mappings.
+ *
+ * @param ip The file.
+ */
+void
+filemap_invalidate(struct Inode *ip)
+{
+  struct ListLink *bucket, *l, *next;
+  struct FilePage *fp;
+
+  spin_lock(&filemap.lock);
+
+  HASH_FOREACH(filemap.table, bucket) {
+    for (l = bucket->next; l != bucket; l = next) {
+      next = l->next;
+
+      fp = LIST_CONTAINER(l, struct FilePage, link);
+      if ((fp->dev != ip->dev) || (fp->ino != ip->ino))
+        continue;
+
+      HASH_REMOVE(&fp->link);
+      filemap.size--;
+
+      vm_page_put(fp->page);
+      kobject_free(filemap_pool, fp);
+    }
+  }
+
+  spin_unlock(&filemap.lock);
+}
+
+// Shrinker callback: release cached pages that are not mapped by any process.
+static unsigned long
+filemap_shrink(unsigned long nr)
+{
+  struct ListLink *bucket, *l, *next;
+  struct FilePage *fp;
+  unsigned long n;
+
+  if (!spin_trylock(&filemap.lock))
+    return 0;
+
+  // The allocation may have been triggered by growing the pool itself, so
+  // don't wait for the pool lock, and return the descriptors directly to the
+  // slabs (kobject_free() may need to allocate a magazine).
+  if (!spin_trylock(&filemap_pool->lock)) {
+    spin_unlock(&filemap.lock);
+    return 0;
+  }
+
+  n = 0;
+  HASH_FOREACH(filemap.table, bucket) {
+    for (l = bucket->next; (l != bucket) && (n < nr); l = next) {
+      next = l->next;
+
+      fp = LIST_CONTAINER(l, struct FilePage, link);
+      if (fp->page->ref_count != 1)
+        continue;
+
+      HASH_REMOVE(&fp->link);
+      filemap.size--;
+
+      fp->page->ref_count = 0;
+      page_free_one(fp->page);
+      kobject_free_locked(filemap_pool, fp);
+
+      n++;
+    }
+  }
+
+  spin_unlock(&filemap_pool->lock);
+  spin_unlock(&filemap.lock);
+
+  return n;
+}
@@ -0,0 +1,134 @@
+#include <assert.h>
+#include <string.h>
+
+#include <cprintf.h>
+#include <types.h>
+#include <mm/kobject.h>
+#include <mm/page.h>
+
+#include <mm/kmalloc.h>
+
+// Requests up to 2^KMALLOC_SHIFT_MAX bytes are rounded up to the next power of
+// two and served by the object pool of the corresponding size class. Larger
+// requests get a block of pages directly from the page allocator.
+
+#define KMALLOC_CLASSES   (KMALLOC_SHIFT_MAX - KMALLOC_SHIFT_MIN + 1)
+
+static struct KObjectPool *kmalloc_pools[KMALLOC_CLASSES];
+
+static const char *kmalloc_names[KMALLOC_CLASSES] = {
+  "kmalloc-16",
+  "kmalloc-32",
+  "kmalloc-64",
+  "kmalloc-128",
+  "kmalloc-256",
+  "kmalloc-512",
+  "kmalloc-1024",
+  "kmalloc-2048",
+};
+
+/**
+ * Initialize the general-purpose allocator.
+ */
+void
+kmalloc_init(void)
+{
+  unsigned i;
+
+  for (i = 0; i < KMALLOC_CLASSES; i++) {
+    kmalloc_pools[i] = kobject_pool_create(kmalloc_names[i],
+                                           1U << (i + KMALLOC_SHIFT_MIN), 0,
+                                           NULL, NULL);
+    if (kmalloc_pools[i] == NULL)
+      panic("cannot allocate %s", kmalloc_names[i]);
+  }
+}
+
+// Get the index of the smallest size class that fits 'size' bytes.
+static unsigned
+kmalloc_class(size_t size)
+{
+  unsigned i;
+
+  for (i = 0; (1U << (i + KMALLOC_SHIFT_MIN)) < size; i++)
+    ;
+
+  return i;
+}
+
+// Get the smallest page allocation order that fits 'size' bytes.
+static unsigned
+kmalloc_order(size_t size)
+{
+  unsigned order;
+
+  for (order = 0; (PAGE_SIZE << order) < size; order++)
+    ;
+
+  return order;
+}
+
+/**
+ * Allocate a block of memory.
+ *
+ * @param size  The number of bytes to allocate.
+ * @param flags Allocation flags (KMALLOC_ZERO).
+ *
+ * @return Pointer to the allocated memory, or NULL if out of memory.
+ */
+void *
+kmalloc(size_t size, int flags)
+{
+  struct Page *page;
+  unsigned order;
+  void *p;
+
+  if (size == 0)
+    return NULL;
+
+  if (size <= (1U << KMALLOC_SHIFT_MAX)) {
+    if ((p = kobject_alloc(kmalloc_pools[kmalloc_class(size)])) == NULL)
+      return NULL;
+
+    if (flags & KMALLOC_ZERO)
+      memset(p, 0, size);
+
+    return p;
+  }
+
+  if ((order = kmalloc_order(size)) > PAGE_ORDER_MAX)
+    return NULL;
+
+  page = page_alloc_block(order, (flags & KMALLOC_ZERO) ? PAGE_ALLOC_ZERO : 0);
+  if (page == NULL)
+    return NULL;
+
+  // Remember the order to be able to free the block later.
+  page->slab  = NULL;
+  page->order = order;
+
+  return page2kva(page);
+}
+
+/**
+ * Free a block of memory previously allocated with kmalloc().
+ *
+ * @param p Pointer to the memory block (may be NULL).
+ */
+void
+kfree(void *p)
+{
+  struct Page *page;
+
+  if (p == NULL)
+    return;
+
+  page = kva2page(ROUND_DOWN(p, PAGE_SIZE));
+
+  if (page->slab != NULL) {
+    kobject_free(page->slab->pool, p);
+  } else {
+    assert(p == page2kva(page));
+    page_free_block(page, page->order);
+  }
+}
@@ -5,6 +5,7 @@
 #include <cprintf.h>
 #include <types.h>
 #include <mm/page.h>
+#include <mm/shrinker.h>
 #include <sync.h>
 
 #include <mm/kobject.h>
@@ -15,6 +16,17 @@ static unsigned            kobject_pool_estimate(size_t, unsigned, int,
 static struct KObjectSlab *kobject_slab_alloc(struct KObjectPool *);
 static void                kobject_slab_destroy(struct KObjectPool *,
                                                 struct KObjectSlab *);
+static void               *kobject_slab_get(struct KObjectPool *);
+static void                kobject_slab_put(struct KObjectPool *, void *);
+static void                kobject_mag_drain(struct KObjectPool *,
+                                             struct KObjectMagazine *);
+static unsigned            kobject_mag_size_default(size_t);
+static unsigned long       kobject_shrink(unsigned long);
+#ifdef KOBJECT_DEBUG
+static void                kobject_debug_init(struct KObjectPool *, void *);
+static void                kobject_debug_alloc(struct KObjectPool *, void *);
+static void                kobject_debug_free(struct KObjectPool *, void *);
+#endif
 
 // Linked list of all object pools.
 static struct {
@@ -31,9 +43,12 @@ static struct KObjectPool pool_pool = {
   .slabs_partial = LIST_INITIALIZER(pool_pool.slabs_partial),
   .slabs_free    = LIST_INITIALIZER(pool_pool.slabs_free),
   .lock          = SPIN_INITIALIZER("pool_pool"),
+  .page_tag      = PAGE_TAG_SLAB,
   .obj_size      = sizeof(struct KObjectPool),
   .color_align   = sizeof(uintptr_t),
   .name          = "pool_pool",
+  .mags_full     = LIST_INITIALIZER(pool_pool.mags_full),
+  .mags_empty    = LIST_INITIALIZER(pool_pool.mags_empty),
 };
 
 // Pool for off-slab slab descriptors.
@@ -42,9 +57,33 @@ static struct KObjectPool slab_pool = {
   .slabs_partial = LIST_INITIALIZER(slab_pool.slabs_partial),
   .slabs_free    = LIST_INITIALIZER(slab_pool.slabs_free),
   .lock          = SPIN_INITIALIZER("slab_pool"),
+  .page_tag      = PAGE_TAG_SLAB,
   .obj_size      = sizeof(struct KObjectSlab),
   .color_align   = sizeof(uintptr_t),
   .name          = "slab_pool",
+  .mags_full     = LIST_INITIALIZER(slab_pool.mags_full),
+  .mags_empty    = LIST_INITIALIZER(slab_pool.mags_empty),
+};
+
+// Pool for magazines. Pools used by the allocator itself have magazines
+// disabled to avoid recursion.
+static struct KObjectPool mag_pool = {
+  .slabs_used    = LIST_INITIALIZER(mag_pool.slabs_used),
+  .slabs_partial = LIST_INITIALIZER(mag_pool.slabs_partial),
+  .slabs_free    = LIST_INITIALIZER(mag_pool.slabs_free),
+  .lock          = SPIN_INITIALIZER("mag_pool"),
+  .page_tag      = PAGE_TAG_SLAB,
+  .obj_size      = sizeof(struct KObjectMagazine),
+  .color_align   = sizeof(uintptr_t),
+  .name          = "mag_pool",
+  .mags_full     = LIST_INITIALIZER(mag_pool.mags_full),
+  .mags_empty    = LIST_INITIALIZER(mag_pool.mags_empty),
+};
+
+// Returns empty slabs to the page allocator under memory pressure.
+static struct Shrinker kobject_shrinker = {
+  .name   = "kobject",
+  .shrink = kobject_shrink,
 };
 
 /*
@@ -59,20 +98,34 @@ static struct KObjectPool slab_pool = {
  * Creates a pool for objects, each size obj_size, aligned on a align
  * boundary.
  * 
+ * If a constructor is given, it is applied to each object when a new slab is
+ * created, and objects are kept in the constructed state while they are in
+ * the pool: the users must return objects to the pool in that state. The
+ * destructor is applied to each object before its slab is destroyed.
+ * Constructors and destructors are called with the pool lock held, and must
+ * not allocate objects from the same pool. A constructor returns 0 on success
+ * or a negative value if the object cannot be constructed.
+ * 
  * @param name     Identifies the pool for statistics and debugging.
  * @param obj_size The size of each object in bytes.
  * @param align    The alignment of each object (or 0 if no special alignment)
  *                 is required).
+ * @param ctor     Object constructor (or NULL).
+ * @param dtor     Object destructor (or NULL).
  *
  * @return Pointer to the pool descriptor or NULL if out of memory.
  */
 struct KObjectPool *
-kobject_pool_create(const char *name, size_t obj_size, size_t align)
+kobject_pool_create(const char *name, size_t obj_size, size_t align,
+                    int (*ctor)(void *), void (*dtor)(void *))
 {
   struct KObjectPool *pool;
-  size_t wastage;
-  unsigned page_order, obj_num;
+  size_t wastage, node_offset;
+  unsigned page_order, obj_num, i;
   int flags;
+#ifdef KOBJECT_DEBUG
+  size_t redzone_offset;
+#endif
 
   if ((pool = kobject_alloc(&pool_pool)) == NULL)
     return NULL;
@@ -81,6 +134,20 @@ kobject_pool_create(const char *name, size_t obj_size, size_t align)
   align    = align ? ROUND_UP(align, sizeof(uintptr_t)) : sizeof(uintptr_t);
   obj_size = ROUND_UP(obj_size, align);
 
+#ifdef KOBJECT_DEBUG
+  // Reserve space for the red zone right after the object.
+  redzone_offset = obj_size;
+  obj_size       = ROUND_UP(obj_size + KOBJECT_REDZONE_SIZE, align);
+#endif
+
+  // The free list link would overwrite the contents of a constructed object,
+  // so place it right after the object.
+  node_offset = 0;
+  if ((ctor != NULL) || (dtor != NULL)) {
+    node_offset = obj_size;
+    obj_size    = ROUND_UP(obj_size + sizeof(struct KObjectNode), align);
+  }
+
   // For objects larger that 1/8 of a page, keep descriptors off slab.
   flags = (obj_size >= (PAGE_SIZE / 8)) ? KOBJECT_POOL_OFFSLAB : 0;
 
@@ -102,14 +169,36 @@ kobject_pool_create(const char *name, size_t obj_size, size_t align)
   list_init(&pool->slabs_free);
 
   pool->flags        = flags;
+  pool->page_tag     = PAGE_TAG_SLAB;
   pool->obj_size     = obj_size;
+  pool->node_offset  = node_offset;
+  pool->ctor         = ctor;
+  pool->dtor         = dtor;
   pool->obj_num      = obj_num;
   pool->page_order   = page_order;
+#ifdef KOBJECT_DEBUG
+  pool->redzone_offset = redzone_offset;
+#endif
 
   pool->color_align  = align;
   pool->color_offset = wastage;
   pool->color_next   = 0;
 
+  for (i = 0; i < NCPU; i++) {
+    pool->cpu_caches[i].loaded   = NULL;
+    pool->cpu_caches[i].previous = NULL;
+    pool->cpu_caches[i].hits     = 0;
+    pool->cpu_caches[i].allocs   = 0;
+    pool->cpu_caches[i].frees    = 0;
+  }
+
+  list_init(&pool->mags_full);
+  list_init(&pool->mags_empty);
+  pool->mag_size     = kobject_mag_size_default(obj_size);
+  pool->mag_refills  = 0;
+  pool->mag_misses   = 0;
+  pool->alloc_fails  = 0;
+
   spin_init(&pool->lock, name);
   pool->name         = name;
 
@@ -158,9 +247,40 @@ int
 kobject_pool_destroy(struct KObjectPool *pool)
 {
   struct KObjectSlab *slab;
+  struct KObjectCpuCache *cc;
+  struct KObjectMagazine *mag;
+  unsigned i;
   
   spin_lock(&pool->lock);
 
+  // The pool is no longer in use, so it is safe to empty the magazines of
+  // all CPUs here.
+  pool->mag_size = 0;
+
+  for (i = 0; i < NCPU; i++) {
+    cc = &pool->cpu_caches[i];
+
+    if (cc->loaded != NULL)
+      list_add_back(&pool->mags_full, &cc->loaded->link);
+    if (cc->previous != NULL)
+      list_add_back(&pool->mags_full, &cc->previous->link);
+
+    cc->loaded = cc->previous = NULL;
+  }
+
+  while (!list_empty(&pool->mags_full)) {
+    mag = LIST_CONTAINER(pool->mags_full.next, struct KObjectMagazine, link);
+    list_remove(&mag->link);
+    kobject_mag_drain(pool, mag);
+    kobject_free(&mag_pool, mag);
+  }
+
+  while (!list_empty(&pool->mags_empty)) {
+    mag = LIST_CONTAINER(pool->mags_empty.next, struct KObjectMagazine, link);
+    list_remove(&mag->link);
+    kobject_free(&mag_pool, mag);
+  }
+
   if (!list_empty(&pool->slabs_used) || !list_empty(&pool->slabs_partial)) {
     spin_unlock(&pool->lock);
     return -EBUSY;
@@ -195,13 +315,14 @@ kobject_slab_alloc(struct KObjectPool *pool)
   struct KObjectSlab *slab;
   struct Page *page;
   struct KObjectNode *curr, **prevp;
-  unsigned num;
+  unsigned num, i;
   uint8_t *buf, *p;
 
   assert(spin_holding(&pool->lock));
 
   // Allocate page block for the slab.
-  if ((page = page_alloc_block(pool->page_order, 0)) == NULL)
+  if ((page = page_alloc_block(pool->page_order,
+                               PAGE_ALLOC_TAG(pool->page_tag))) == NULL)
     return NULL;
 
   buf = (uint8_t *) page2kva(page);
@@ -218,16 +339,57 @@ kobject_slab_alloc(struct KObjectPool *pool)
   }
 
   page->ref_count++;
-  page->slab = slab;
 
+  // Let kfree() find the slab by any address inside it.
+  for (i = 0; i < (1U << pool->page_order); i++)
+    page[i].slab = slab;
+
+  slab->pool = pool;
   slab->in_use = 0;
   slab->buf = buf;
 
-  // Initialize all objects.
+  // Construct all objects.
+  if (pool->ctor != NULL) {
+    p = buf + pool->color_next;
+    for (num = 0; num < pool->obj_num; num++) {
+      if (pool->ctor(p) != 0)
+        break;
+      p += pool->obj_size;
+    }
+
+    // Destroy the already constructed objects and give up.
+    if (num < pool->obj_num) {
+      while (num-- > 0) {
+        p -= pool->obj_size;
+        if (pool->dtor != NULL)
+          pool->dtor(p);
+      }
+
+      for (i = 0; i < (1U << pool->page_order); i++)
+        page[i].slab = NULL;
+      page->ref_count--;
+      page_free_block(page, pool->page_order);
+
+      if (pool->flags & KOBJECT_POOL_OFFSLAB)
+        kobject_free(&slab_pool, slab);
+
+      return NULL;
+    }
+  }
+
+#ifdef KOBJECT_DEBUG
+  p = buf + pool->color_next;
+  for (num = 0; num < pool->obj_num; num++) {
+    kobject_debug_init(pool, p);
+    p += pool->obj_size;
+  }
+#endif
+
+  // Initialize the free list.
   p = buf + pool->color_next;
   prevp = &slab->free;
   for (num = 0; num < pool->obj_num; num++) {
-    curr = (struct KObjectNode *) p;
+    curr = (struct KObjectNode *) (p + pool->node_offset);
     curr->next = NULL;
 
     *prevp = curr;
@@ -247,14 +409,23 @@ kobject_slab_alloc(struct KObjectPool *pool)
 static void
 kobject_slab_destroy(struct KObjectPool *pool, struct KObjectSlab *slab)
 {
+  struct KObjectNode *node;
   struct Page *page;
+  unsigned i;
   
   assert(spin_holding(&pool->lock));
   assert(slab->in_use == 0);
 
+  // All objects are free, so the free list can be used to destroy them.
+  if (pool->dtor != NULL)
+    for (node = slab->free; node != NULL; node = node->next)
+      pool->dtor((uint8_t *) node - pool->node_offset);
+
   // Free the pages been used for the slab.
   page = kva2page(slab->buf);
   page->ref_count--;
+  for (i = 0; i < (1U << pool->page_order); i++)
+    page[i].slab = NULL;
   page_free_block(page, pool->page_order);
 
   // If slab descriptor was kept off page, return it to the slab pool.
@@ -268,14 +439,97 @@ kobject_slab_destroy(struct KObjectPool *pool, struct KObjectSlab *slab)
  * ----------------------------------------------------------------------------
  */
 
+// Each CPU holds up to two magazines per pool: objects are allocated from and
+// freed to the 'loaded' one, and the 'previous' one is used when 'loaded' gets
+// empty (or full), so a CPU alternating between allocations and frees near a
+// magazine boundary doesn't go to the depot every time. Only when both
+// magazines are empty (or full) the CPU takes the pool lock to exchange one of
+// them with the depot. The slab layer is used only when the depot has nothing
+// to offer.
+
+/**
+ * Allocate an object from the pool.
+ *
+ * @param pool The pool to allocate from.
+ *
+ * @return Pointer to the allocated object or NULL if out of memory.
+ */
 void *
 kobject_alloc(struct KObjectPool *pool)
+{
+  struct KObjectCpuCache *cc;
+  struct KObjectMagazine *mag;
+  void *obj;
+
+  irq_save();
+
+  cc = &pool->cpu_caches[cpu_id()];
+  cc->allocs++;
+
+  if (((cc->loaded == NULL) || (cc->loaded->rounds == 0)) &&
+      ((cc->previous != NULL) && (cc->previous->rounds > 0))) {
+    mag = cc->loaded;
+    cc->loaded = cc->previous;
+    cc->previous = mag;
+  }
+
+  if ((cc->loaded != NULL) && (cc->loaded->rounds > 0)) {
+    obj = cc->loaded->objs[--cc->loaded->rounds];
+    cc->hits++;
+
+    irq_restore();
+
+#ifdef KOBJECT_DEBUG
+    kobject_debug_alloc(pool, obj);
+#endif
+
+    return obj;
+  }
+
+  spin_lock(&pool->lock);
+
+  if (!list_empty(&pool->mags_full)) {
+    // Both magazines are empty. Return 'previous' to the depot and load a full
+    // magazine instead.
+    mag = LIST_CONTAINER(pool->mags_full.next, struct KObjectMagazine, link);
+    list_remove(&mag->link);
+
+    if (cc->previous != NULL)
+      list_add_front(&pool->mags_empty, &cc->previous->link);
+    cc->previous = cc->loaded;
+    cc->loaded   = mag;
+
+    obj = mag->objs[--mag->rounds];
+    pool->mag_refills++;
+  } else {
+    obj = kobject_slab_get(pool);
+    pool->mag_misses++;
+
+    if (obj == NULL)
+      pool->alloc_fails++;
+  }
+
+  spin_unlock(&pool->lock);
+
+  irq_restore();
+
+#ifdef KOBJECT_DEBUG
+  if (obj != NULL)
+    kobject_debug_alloc(pool, obj);
+#endif
+
+  return obj;
+}
+
+// Take an object directly from the slabs. The caller must hold the pool lock.
+static void *
+kobject_slab_get(struct KObjectPool *pool)
 {
   struct ListLink *list;
   struct KObjectSlab *slab;
   struct KObjectNode *obj;
-  
-  spin_lock(&pool->lock);
+
+  assert(spin_holding(&pool->lock));
 
   if (!list_empty(&pool->slabs_partial)) {
     list = &pool->slabs_partial;
@@ -283,10 +537,8 @@ kobject_alloc(struct KObjectPool *pool)
     list = &pool->slabs_free;
 
     if (list_empty(list)) {
-      if ((slab = kobject_slab_alloc(pool)) == NULL) {
-        spin_unlock(&pool->lock);
+      if ((slab = kobject_slab_alloc(pool)) == NULL)
         return NULL;
-      }
 
       list_add_back(list, &slab->link);
     }
@@ -305,61 +557,127 @@ kobject_alloc(struct KObjectPool *pool)
   obj = slab->free;
   slab->free = obj->next;
 
-  spin_unlock(&pool->lock);
-
-  return obj;
+  return (uint8_t *) obj - pool->node_offset;
 }
 
+/*
+ * ----------------------------------------------------------------------------
+ * Object freeing
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Return an object to the pool.
+ *
+ * @param pool The pool the object was allocated from.
+ * @param obj  Pointer to the object.
+ */
 void
-kobject_dump(struct KObjectPool *pool)
+kobject_free(struct KObjectPool *pool, void *obj)
 {
-  struct ListLink *list;
-  struct KObjectSlab *slab;
-   
+  struct KObjectCpuCache *cc;
+  struct KObjectMagazine *mag;
+  unsigned mag_size;
+
+#ifdef KOBJECT_DEBUG
+  kobject_debug_free(pool, obj);
+#endif
+
+  irq_save();
+
+  cc = &pool->cpu_caches[cpu_id()];
+  cc->frees++;
+  mag_size = pool->mag_size;
+
+  if (mag_size > 0) {
+    if (((cc->loaded == NULL) || (cc->loaded->rounds >= mag_size)) &&
+        ((cc->previous != NULL) && (cc->previous->rounds < mag_size))) {
+      mag = cc->loaded;
+      cc->loaded = cc->previous;
+      cc->previous = mag;
+    }
+
+    if ((cc->loaded != NULL) && (cc->loaded->rounds < mag_size)) {
+      cc->loaded->objs[cc->loaded->rounds++] = obj;
+      cc->hits++;
+
+      irq_restore();
+      return;
+    }
+  }
+
   spin_lock(&pool->lock);
 
-  if (!list_empty(&pool->slabs_partial)) {
-    list = &pool->slabs_partial;
-  } else {
-    list = &pool->slabs_free;
+  if (mag_size > 0) {
+    // Both magazines are full. Return 'previous' to the depot and load an
+    // empty magazine instead.
+    if (!list_empty(&pool->mags_empty)) {
+      mag = LIST_CONTAINER(pool->mags_empty.next, struct KObjectMagazine, link);
+      list_remove(&mag->link);
+    } else if ((mag = kobject_alloc(&mag_pool)) != NULL) {
+      mag->rounds = 0;
+    }
 
-    if (list_empty(list)) {
-      if ((slab = kobject_slab_alloc(pool)) == NULL) {
-        spin_unlock(&pool->lock);
-        return;
-      }
+    if (mag != NULL) {
+      if (cc->previous != NULL)
+        list_add_front(&pool->mags_full, &cc->previous->link);
+      cc->previous = cc->loaded;
+      cc->loaded   = mag;
 
-      list_add_back(list, &slab->link);
+      mag->objs[mag->rounds++] = obj;
+      pool->mag_refills++;
+
+      spin_unlock(&pool->lock);
+      irq_restore();
+      return;
     }
   }
 
-  slab = LIST_CONTAINER(list->next, struct KObjectSlab, link);
-
-  assert(slab->in_use < pool->obj_num);
-  assert(slab->free != NULL);
+  kobject_slab_put(pool, obj);
+  pool->mag_misses++;
 
   spin_unlock(&pool->lock);
+
+  irq_restore();
 }
 
-/*
- * ----------------------------------------------------------------------------
- * Object freeing
- * ----------------------------------------------------------------------------
+/**
+ * Return an object directly to its slab, bypassing the magazines.
+ *
+ * Unlike kobject_free(), this function never waits for the pool lock and never
+ * allocates a magazine, so it can be used by shrinker callbacks. Objects freed
+ * this way also let whole slabs become free sooner.
+ *
+ * @param pool The pool the object was allocated from. The caller must hold
+ *             the pool lock (acquired with spin_trylock() in reclaim context).
+ * @param obj  Pointer to the object.
  */
-
 void
-kobject_free(struct KObjectPool *pool, void *obj)
+kobject_free_locked(struct KObjectPool *pool, void *obj)
+{
+  assert(spin_holding(&pool->lock));
+
+#ifdef KOBJECT_DEBUG
+  kobject_debug_free(pool, obj);
+#endif
+
+  kobject_slab_put(pool, obj);
+}
+
+// Return an object directly to its slab. The caller must hold the pool lock.
+static void
+kobject_slab_put(struct KObjectPool *pool, void *obj)
 {
   struct Page *slab_page;
   struct KObjectSlab *slab;
   struct KObjectNode *node;
 
+  assert(spin_holding(&pool->lock));
+
   slab_page = kva2page(ROUND_DOWN(obj, PAGE_SIZE << pool->page_order));
   slab = slab_page->slab;
 
-  spin_lock(&pool->lock);
-
-  node = (struct KObjectNode *) obj;
+  node = (struct KObjectNode *) ((uint8_t *) obj + pool->node_offset);
   node->next = slab->free;
   slab->free = node;
 
@@ -370,8 +688,236 @@ kobject_free(struct KObjectPool *pool, void *obj)
     list_remove(&slab->link);
     list_add_front(&pool->slabs_free, &slab->link);
   }
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Magazines
+ * ----------------------------------------------------------------------------
+ */
+
+// Return all objects from the magazine to the slabs. The caller must hold the
+// pool lock.
+static void
+kobject_mag_drain(struct KObjectPool *pool, struct KObjectMagazine *mag)
+{
+  assert(spin_holding(&pool->lock));
 
+  while (mag->rounds > 0)
+    kobject_slab_put(pool, mag->objs[--mag->rounds]);
+}
+
+// Choose the default magazine size for the given object size. Caching many
+// large objects per CPU would waste too much memory.
+static unsigned
+kobject_mag_size_default(size_t obj_size)
+{
+  if (obj_size <= 256)
+    return KOBJECT_MAG_MAX / 2;
+  if (obj_size <= 1024)
+    return KOBJECT_MAG_MAX / 4;
+  return KOBJECT_MAG_MAX / 8;
+}
+
+/**
+ * Change the number of objects cached in each magazine of the pool.
+ *
+ * Magazines that already hold more objects than the new size are simply
+ * treated as full.
+ *
+ * @param pool The pool descriptor.
+ * @param size The new magazine size, or 0 to disable magazines.
+ *
+ * @return 0 on success, -EINVAL if the size is invalid.
+ */
+int
+kobject_pool_set_magazine(struct KObjectPool *pool, unsigned size)
+{
+  if ((size > KOBJECT_MAG_MAX) || (pool == &mag_pool))
+    return -EINVAL;
+
+  spin_lock(&pool->lock);
+  pool->mag_size = size;
   spin_unlock(&pool->lock);
+
+  return 0;
+}
+
+#ifdef KOBJECT_DEBUG
+
+/*
+ * ----------------------------------------------------------------------------
+ * Debugging
+ * ----------------------------------------------------------------------------
+ */
+
+// Pools created statically for the allocator itself have no red zones
+// (redzone_offset is 0). Only pools that keep no state in free objects (i.e.
+// have neither a constructor nor a destructor, so the free list link is at
+// offset 0) are poisoned.
+
+static uint32_t *
+kobject_redzone(struct KObjectPool *pool, void *obj)
+{
+  return (uint32_t *) ((uint8_t *) obj + pool->redzone_offset);
+}
+
+// Mark an object of a newly created slab as free.
+static void
+kobject_debug_init(struct KObjectPool *pool, void *obj)
+{
+  if (pool->redzone_offset == 0)
+    return;
+
+  *kobject_redzone(pool, obj) = KOBJECT_REDZONE_INACTIVE;
+
+  if (pool->node_offset == 0)
+    memset(obj, KOBJECT_POISON_FREE, pool->redzone_offset);
+}
+
+// Check an object that is about to be returned to the caller of
+// kobject_alloc() and mark it as allocated.
+static void
+kobject_debug_alloc(struct KObjectPool *pool, void *obj)
+{
+  uint32_t *redzone;
+  uint8_t *p;
+  size_t i;
+
+  if (pool->redzone_offset == 0)
+    return;
+
+  redzone = kobject_redzone(pool, obj);
+  if (*redzone != KOBJECT_REDZONE_INACTIVE)
+    panic("%s: red zone of free object %p overwritten (%08x)",
+          pool->name, obj, *redzone);
+
+  // The first word may hold the free list link.
+  if (pool->node_offset == 0) {
+    p = (uint8_t *) obj;
+    for (i = sizeof(struct KObjectNode); i < pool->redzone_offset; i++)
+      if (p[i] != KOBJECT_POISON_FREE)
+        panic("%s: object %p modified after free (offset %u)",
+              pool->name, obj, i);
+  }
+
+  *redzone = KOBJECT_REDZONE_ACTIVE;
+}
+
+// Check an object passed to kobject_free() and mark it as free.
+static void
+kobject_debug_free(struct KObjectPool *pool, void *obj)
+{
+  struct Page *slab_page;
+  uint32_t *redzone;
+
+  slab_page = kva2page(ROUND_DOWN(obj, PAGE_SIZE << pool->page_order));
+  if ((slab_page->slab == NULL) || (slab_page->slab->pool != pool))
+    panic("%s: object %p does not belong to the pool", pool->name, obj);
+
+  if (pool->redzone_offset == 0)
+    return;
+
+  redzone = kobject_redzone(pool, obj);
+  if (*redzone == KOBJECT_REDZONE_INACTIVE)
+    panic("%s: double free of object %p", pool->name, obj);
+  if (*redzone != KOBJECT_REDZONE_ACTIVE)
+    panic("%s: red zone of object %p overwritten (%08x)",
+          pool->name, obj, *redzone);
+
+  *redzone = KOBJECT_REDZONE_INACTIVE;
+
+  if (pool->node_offset == 0)
+    memset(obj, KOBJECT_POISON_FREE, pool->redzone_offset);
+}
+
+#endif  // KOBJECT_DEBUG
+
+/*
+ * ----------------------------------------------------------------------------
+ * Reclaiming memory
+ * ----------------------------------------------------------------------------
+ */
+
+// Return the objects cached in the current CPU's magazines and in the depot to
+// the slabs, and then free all empty slabs. The caller must hold the pool lock.
+static unsigned long
+kobject_pool_shrink(struct KObjectPool *pool)
+{
+  struct KObjectCpuCache *cc;
+  struct KObjectMagazine *mag;
+  struct KObjectSlab *slab;
+  unsigned long freed;
+
+  assert(spin_holding(&pool->lock));
+
+  // Magazines of other CPUs cannot be touched safely from here.
+  cc = &pool->cpu_caches[cpu_id()];
+  if (cc->loaded != NULL)
+    kobject_mag_drain(pool, cc->loaded);
+  if (cc->previous != NULL)
+    kobject_mag_drain(pool, cc->previous);
+
+  while (!list_empty(&pool->mags_full)) {
+    mag = LIST_CONTAINER(pool->mags_full.next, struct KObjectMagazine, link);
+    list_remove(&mag->link);
+    kobject_mag_drain(pool, mag);
+    kobject_free(&mag_pool, mag);
+  }
+
+  while (!list_empty(&pool->mags_empty)) {
+    mag = LIST_CONTAINER(pool->mags_empty.next, struct KObjectMagazine, link);
+    list_remove(&mag->link);
+    kobject_free(&mag_pool, mag);
+  }
+
+  freed = 0;
+  while (!list_empty(&pool->slabs_free)) {
+    slab = LIST_CONTAINER(pool->slabs_free.next, struct KObjectSlab, link);
+    list_remove(&slab->link);
+    kobject_slab_destroy(pool, slab);
+
+    freed += (1UL << pool->page_order);
+  }
+
+  return freed;
+}
+
+// Shrinker callback for all object pools.
+static unsigned long
+kobject_shrink(unsigned long nr)
+{
+  struct ListLink *link;
+  struct KObjectPool *pool;
+  unsigned long freed;
+
+  // Releasing magazines and off-slab descriptors requires these two locks, so
+  // give up if the allocation has been triggered while holding any of them.
+  if (spin_holding(&mag_pool.lock) || spin_holding(&slab_pool.lock))
+    return 0;
+
+  if (!spin_trylock(&pool_list.lock))
+    return 0;
+
+  freed = 0;
+  LIST_FOREACH(&pool_list.head, link) {
+    if (freed >= nr)
+      break;
+
+    pool = LIST_CONTAINER(link, struct KObjectPool, link);
+
+    // The pool may be in the middle of an allocation on this CPU.
+    if (!spin_trylock(&pool->lock))
+      continue;
+
+    freed += kobject_pool_shrink(pool);
+
+    spin_unlock(&pool->lock);
+  }
+
+  spin_unlock(&pool_list.lock);
+
+  return freed;
 }
 
 /*
@@ -394,16 +940,230 @@ kobject_pool_init(void)
                                             slab_pool.flags,
                                             &slab_pool.color_offset);
   list_add_back(&pool_list.head, &slab_pool.link);
+
+  mag_pool.obj_num = kobject_pool_estimate(mag_pool.obj_size,
+                                           mag_pool.page_order,
+                                           mag_pool.flags,
+                                           &mag_pool.color_offset);
+  list_add_back(&pool_list.head, &mag_pool.link);
+
+  shrinker_register(&kobject_shrinker);
 }
 
+/*
+ * ----------------------------------------------------------------------------
+ * Statistics
+ * ----------------------------------------------------------------------------
+ */
+
+// Pool statistics.
+struct KObjectPoolStats {
+  unsigned long slabs_used;         // Slabs with all objects in use
+  unsigned long slabs_partial;      // Slabs with some objects in use
+  unsigned long slabs_free;         // Slabs with no objects in use
+  unsigned long objs_total;         // Total number of objects in all slabs
+  unsigned long objs_in_use;        // Objects allocated by the pool users
+  unsigned long objs_cached;        // Free objects held in magazines
+  unsigned long allocs;             // Allocation requests
+  unsigned long frees;              // Free requests
+  unsigned long hits;               // Requests served from magazines
+  size_t        mem_total;          // Memory used by slabs and descriptors
+  size_t        mem_wasted;         // Slab space that cannot hold objects
+};
+
+// Count objects held in the magazine.
+static unsigned long
+kobject_mag_rounds(struct KObjectMagazine *mag)
+{
+  return mag != NULL ? mag->rounds : 0;
+}
+
+// Collect statistics for the pool. The caller must hold the pool lock.
+//
+// Magazines loaded by other CPUs and the per-CPU counters are read without
+// synchronization, so the results are approximate on a busy system.
+static void
+kobject_pool_stats(struct KObjectPool *pool, struct KObjectPoolStats *stats)
+{
+  struct ListLink *link;
+  struct KObjectSlab *slab;
+  struct KObjectCpuCache *cc;
+  unsigned long objs_slab, nslabs;
+  unsigned i;
+
+  assert(spin_holding(&pool->lock));
+
+  memset(stats, 0, sizeof(*stats));
+
+  objs_slab = 0;
+
+  LIST_FOREACH(&pool->slabs_used, link) {
+    stats->slabs_used++;
+    objs_slab += pool->obj_num;
+  }
+
+  LIST_FOREACH(&pool->slabs_partial, link) {
+    slab = LIST_CONTAINER(link, struct KObjectSlab, link);
+    stats->slabs_partial++;
+    objs_slab += slab->in_use;
+  }
+
+  LIST_FOREACH(&pool->slabs_free, link)
+    stats->slabs_free++;
+
+  LIST_FOREACH(&pool->mags_full, link)
+    stats->objs_cached += LIST_CONTAINER(link, struct KObjectMagazine,
+                                         link)->rounds;
+
+  for (i = 0; i < NCPU; i++) {
+    cc = &pool->cpu_caches[i];
+
+    stats->objs_cached += kobject_mag_rounds(cc->loaded);
+    stats->objs_cached += kobject_mag_rounds(cc->previous);
+
+    stats->allocs += cc->allocs;
+    stats->frees  += cc->frees;
+    stats->hits   += cc->hits;
+  }
+
+  nslabs = stats->slabs_used + stats->slabs_partial + stats->slabs_free;
+
+  stats->objs_total  = nslabs * pool->obj_num;
+  stats->objs_in_use = objs_slab - MIN(objs_slab, stats->objs_cached);
+
+  stats->mem_total = nslabs * (PAGE_SIZE << pool->page_order);
+  if (pool->flags & KOBJECT_POOL_OFFSLAB)
+    stats->mem_total += nslabs * sizeof(struct KObjectSlab);
+
+  // Space left over after the objects is used for coloring, but can never
+  // hold an object.
+  stats->mem_wasted = nslabs * pool->color_offset;
+}
+
+/**
+ * Display the summary for all object pools.
+ */
 void
 kobject_pool_info(void)
 {
   struct ListLink *link;
   struct KObjectPool *pool;
+  struct KObjectPoolStats stats;
+  unsigned long requests;
+
+  cprintf("%-16s %6s %6s %6s %5s %7s %10s %6s %3s %4s\n",
+          "name", "size", "inuse", "objs", "slabs", "KB", "allocs", "fails",
+          "mag", "hit%");
+
+  spin_lock(&pool_list.lock);
+
+  LIST_FOREACH(&pool_list.head, link) {
+    pool = LIST_CONTAINER(link, struct KObjectPool, link);
+
+    spin_lock(&pool->lock);
+    kobject_pool_stats(pool, &stats);
+
+    requests = stats.allocs + stats.frees;
+
+    cprintf("%-16s %6u %6lu %6lu %5lu %7u %10lu %6lu %3u %4lu\n",
+            pool->name, pool->obj_size, stats.objs_in_use, stats.objs_total,
+            stats.slabs_used + stats.slabs_partial + stats.slabs_free,
+            stats.mem_total / 1024, stats.allocs, pool->alloc_fails,
+            pool->mag_size, requests ? stats.hits * 100 / requests : 0);
+
+    spin_unlock(&pool->lock);
+  }
+
+  spin_unlock(&pool_list.lock);
+}
+
+/**
+ * Find an object pool by name.
+ *
+ * @param name The name of the pool.
+ *
+ * @return Pointer to the pool descriptor or NULL if not found.
+ */
+struct KObjectPool *
+kobject_pool_lookup(const char *name)
+{
+  struct ListLink *link;
+  struct KObjectPool *pool;
+
+  spin_lock(&pool_list.lock);
 
   LIST_FOREACH(&pool_list.head, link) {
     pool = LIST_CONTAINER(link, struct KObjectPool, link);
-    cprintf("%-20s %6d\n", pool->name, pool->obj_size);
+
+    if (strcmp(pool->name, name) == 0) {
+      spin_unlock(&pool_list.lock);
+      return pool;
+    }
   }
+
+  spin_unlock(&pool_list.lock);
+
+  return NULL;
+}
+
+/**
+ * Display detailed information about the pool and each of its slabs.
+ *
+ * Nothing is allocated, so this function is safe to use to inspect a pool
+ * that has run out of memory.
+ *
+ * @param pool The pool descriptor.
+ */
+void
+kobject_dump(struct KObjectPool *pool)
+{
+  static const struct {
+    const char *name;
+    size_t      offset;
+  } lists[] = {
+    { "used",    offsetof(struct KObjectPool, slabs_used) },
+    { "partial", offsetof(struct KObjectPool, slabs_partial) },
+    { "free",    offsetof(struct KObjectPool, slabs_free) },
+  };
+
+  struct KObjectPoolStats stats;
+  struct ListLink *head, *link;
+  struct KObjectSlab *slab;
+  unsigned i;
+
+  spin_lock(&pool->lock);
+
+  kobject_pool_stats(pool, &stats);
+
+  cprintf("pool %s:\n", pool->name);
+  cprintf("  object size %u, node offset %u, %u objects per %u-page slab%s\n",
+          pool->obj_size, pool->node_offset, pool->obj_num,
+          1U << pool->page_order,
+          (pool->flags & KOBJECT_POOL_OFFSLAB) ? " (off-slab)" : "");
+#ifdef KOBJECT_DEBUG
+  cprintf("  red zone offset %u\n", pool->redzone_offset);
+#endif
+  cprintf("  slabs:   %lu used, %lu partial, %lu free\n",
+          stats.slabs_used, stats.slabs_partial, stats.slabs_free);
+  cprintf("  objects: %lu total, %lu in use, %lu in magazines\n",
+          stats.objs_total, stats.objs_in_use, stats.objs_cached);
+  cprintf("  calls:   %lu allocs, %lu frees, %lu failures\n",
+          stats.allocs, stats.frees, pool->alloc_fails);
+  cprintf("  mags:    size %u, %lu hits, %lu refills, %lu misses\n",
+          pool->mag_size, stats.hits, pool->mag_refills, pool->mag_misses);
+  cprintf("  memory:  %u bytes, %u wasted (color %u, align %u)\n",
+          stats.mem_total, stats.mem_wasted, pool->color_offset,
+          pool->color_align);
+
+  for (i = 0; i < ARRAY_SIZE(lists); i++) {
+    head = (struct ListLink *) ((uint8_t *) pool + lists[i].offset);
+
+    LIST_FOREACH(head, link) {
+      slab = LIST_CONTAINER(link, struct KObjectSlab, link);
+      cprintf("  [%p] %-7s %u/%u in use\n",
+              slab->buf, lists[i].name, slab->in_use, pool->obj_num);
+    }
+  }
+
+  spin_unlock(&pool->lock);
 }
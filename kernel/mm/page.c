@@ -1,10 +1,19 @@
+#include <errno.h>
 #include <string.h>
 
+#include <armv7.h>
 #include <cprintf.h>
+#include <cpu.h>
 #include <sync.h>
 #include <types.h>
 
 #include <mm/page.h>
+#include <mm/shrinker.h>
+#include <sys/meminfo.h>
+
+#if __MEMINFO_ORDERS != PAGE_ORDER_MAX + 1
+#error "__MEMINFO_ORDERS must be equal to PAGE_ORDER_MAX + 1"
+#endif
 
 /** The kernel uses this array to keep track of physical pages. */
 struct Page *pages;
@@ -12,6 +21,33 @@ struct Page *pages;
 /** The total number of physical pages in memory. */
 unsigned npages;
 
+/** Physical memory regions detected at boot time, sorted by address. */
+struct PhysRegion phys_regions[PHYS_REGIONS_MAX];
+
+/** The number of entries in 'phys_regions'. */
+unsigned phys_nregions;
+
+// The number of usable pages of physical memory.
+static unsigned long pages_total;
+
+// The number of pages in the buddy free lists.
+static unsigned long pages_free;
+
+// When the number of free pages drops below 'pages_low', idle CPUs invoke the
+// shrinkers until it reaches 'pages_high'.
+static unsigned long pages_low;
+static unsigned long pages_high;
+
+// Set when the number of free pages drops below 'pages_low', and cleared once
+// it reaches 'pages_high' or the shrinkers have nothing more to give back.
+static int pages_reclaiming;
+
+/** The minimum value for 'pages_low'. */
+#define PAGES_LOW_MIN           64
+
+// Amount of RAM that cannot be used because it is outside the direct mapping.
+static size_t phys_ignored;
+
 // Page allocator implements the binary buddy algorithm.
 //
 // All physical memory is represented as a collection of blocks where each block
@@ -27,18 +63,92 @@ unsigned npages;
 // deallocated block is free, in which case two blocks are merged to form a
 // higher order block and placed on the higher free list.
 //
+// To limit fragmentation, each order has a separate free list for every
+// pageblock type (see PAGE_TYPE_*). A free block is always kept on the list
+// matching the type of the pageblock it belongs to. When there are no blocks
+// of the requested type, a block of the other type is taken, and for kernel
+// allocations its whole pageblock is retagged, so that further kernel requests
+// are satisfied from the same pageblock instead of polluting another one.
+//
+// Pageblocks of the contiguous memory reserve (see kernel/mm/cma.c) have a
+// type of their own. While the reserve is idle, its free blocks are lent to
+// user allocations only, since user pages can be migrated elsewhere when the
+// reserve is needed. Kernel allocations never get them.
+//
 static struct {
-  struct ListLink link;
+  struct ListLink link[PAGE_TYPES];
   uint32_t       *bitmap;
+  unsigned        count;
 } free_pages[PAGE_ORDER_MAX + 1];
 
+// Type of each pageblock.
+static uint8_t *pageblock_types;
+static unsigned npageblocks;
+
+// The number of times a block has been taken from the other type's free lists.
+static unsigned long pageblock_fallbacks;
+
+// While non-zero, no blocks of the contiguous memory reserve are lent to user
+// allocations.
+static unsigned page_cma_isolated;
+
 static int pages_inited = 0;
 static struct SpinLock pages_lock;
 
-static void             page_mark_free(struct Page *, unsigned);
-static void             page_mark_used(struct Page *, unsigned);
-static int              page_is_free(struct Page *, unsigned);
+// To reduce contention on 'pages_lock', each CPU keeps a small cache of free
+// blocks for every order up to PAGE_CACHE_ORDER_MAX. Blocks in these caches
+// are marked as used in the buddy bitmaps, so they never get merged. An empty
+// cache is refilled, and an overfull one is drained, in batches of
+// PAGE_CACHE_BATCH pages, so that the global lock is taken once per batch
+// rather than once per request.
+
+/** The number of pages moved between a per-CPU cache and the free lists. */
+#define PAGE_CACHE_BATCH        16U
+/** The number of blocks of the given order moved at a time. */
+#define PAGE_CACHE_BLOCKS(o)    MAX(PAGE_CACHE_BATCH >> (o), 1U)
+/** Drain the cache when it holds more than this number of blocks. */
+#define PAGE_CACHE_HIGH(o)      (PAGE_CACHE_BLOCKS(o) * 4)
+
+// A CPU can only touch its own cache, so when an allocation fails, the other
+// CPUs are asked to drain theirs the next time they use the cache or go idle.
+// Protected by 'pages_lock'.
+static unsigned page_cache_drain_mask;
+
+// Idle CPUs fill free pages with zeros in advance and put them into a separate
+// pool, so most order-0 PAGE_ALLOC_ZERO requests don't have to call memset.
+static struct {
+  struct ListLink pages;          // List of pre-zeroed pages
+  unsigned        count;          // The number of pages in the list
+  unsigned long   hits;           // Requests served from the pool
+  unsigned long   misses;         // Requests that found the pool empty
+  unsigned long   zeroed;         // Pages zeroed by idle CPUs
+  struct SpinLock lock;           // Protects the pool
+} zero_pool;
+
+/** The maximum number of pre-zeroed pages. */
+#define ZERO_POOL_MAX           256
+
+static struct Page *page_buddy_alloc(unsigned, int);
+static struct Page *page_buddy_fallback(unsigned, int);
+static void         page_buddy_free(struct Page *, unsigned);
+static void         page_buddy_free_range(unsigned, unsigned);
+static struct Page *page_cache_alloc(unsigned, int);
+static void         page_cache_free(struct Page *, unsigned);
+static void         page_cache_drain(struct PageCache *, unsigned, unsigned);
+static void         page_cache_drain_others(void);
+static void         page_cache_check_drain(void);
+static struct Page *page_zero_get(void);
+static void         page_zero_flush(void);
+static void         page_tag_set(struct Page *, unsigned, int);
+
+static void         page_mark_free(struct Page *, unsigned);
+static void         page_mark_used(struct Page *, unsigned);
+static int          page_is_free(struct Page *, unsigned);
 static struct Page *page_split(struct Page *, unsigned, unsigned);
+static int          pageblock_type(struct Page *);
+static void         pageblock_claim(struct Page *, unsigned, int);
+
+static void         page_detect_memory(void);
 
 void        *boot_alloc(size_t);
 
@@ -62,22 +172,42 @@ void        *boot_alloc(size_t);
 void
 page_init_low(void)
 {
-  unsigned i;
+  unsigned i, j, k;
   size_t bitmap_len;
 
   spin_init(&pages_lock, "pages_lock");
 
-  // TODO: detect the actual amount of physical memory!
-  npages = PHYS_TOP / PAGE_SIZE;
+  spin_init(&zero_pool.lock, "zero_pool");
+  list_init(&zero_pool.pages);
+
+  // Initialize the per-CPU page caches.
+  for (i = 0; i < NCPU; i++)
+    for (j = 0; j < PAGE_TYPES; j++)
+      for (k = 0; k <= PAGE_CACHE_ORDER_MAX; k++)
+        list_init(&cpus[i].page_cache[j][k].blocks);
+
+  page_detect_memory();
+
+  // The page metadata covers everything up to the end of the last region.
+  // Pages in the holes between regions are never placed on the free lists.
+  npages = phys_regions[phys_nregions - 1].end / PAGE_SIZE;
 
   // Allocate the 'pages' array.
   pages = (struct Page *) boot_alloc(npages * sizeof(struct Page));
 
+  // Initially, all pageblocks are available for user pages. Kernel allocations
+  // claim pageblocks as needed.
+  npageblocks = ROUND_UP(npages, 1U << PAGEBLOCK_ORDER) >> PAGEBLOCK_ORDER;
+  pageblock_types = (uint8_t *) boot_alloc(npageblocks);
+  for (i = 0; i < npageblocks; i++)
+    pageblock_types[i] = PAGE_TYPE_USER;
+
   // Initialize the free page lists.
   for (i = 0; i <= PAGE_ORDER_MAX; i++) {
-    list_init(&free_pages[i].link);
+    for (j = 0; j < PAGE_TYPES; j++)
+      list_init(&free_pages[i].link[j]);
 
-    bitmap_len = ROUND_UP(npages / (1U << i), 8);
+    bitmap_len = ROUND_UP(npages / (1U << i), 32) / 8;
     free_pages[i].bitmap = (uint32_t *) boot_alloc(bitmap_len);
   }
 
@@ -94,7 +224,177 @@ page_init_low(void)
 void
 page_init_high(void)
 {
-  page_free_region(PHYS_ENTRY_TOP, PHYS_TOP);
+  physaddr_t start;
+  size_t total;
+  unsigned i;
+
+  total = 0;
+  for (i = 0; i < phys_nregions; i++) {
+    start = MAX(phys_regions[i].start, (physaddr_t) PHYS_ENTRY_TOP);
+    if (start < phys_regions[i].end)
+      page_free_region(start, phys_regions[i].end);
+
+    total += phys_regions[i].end - phys_regions[i].start;
+    pages_total += (phys_regions[i].end - phys_regions[i].start) / PAGE_SIZE;
+
+    cprintf("Memory: [%08lx-%08lx] %u MB\n",
+            phys_regions[i].start, phys_regions[i].end - 1,
+            (phys_regions[i].end - phys_regions[i].start) >> 20);
+  }
+
+  if (phys_ignored != 0)
+    warn("%u MB of physical memory above %08lx cannot be mapped at "
+         "KERNEL_BASE and will not be used", phys_ignored >> 20,
+         (physaddr_t) PHYS_LIMIT);
+
+  cprintf("Memory: %u MB available\n", total >> 20);
+
+  // Keep about 1.5% of memory free.
+  pages_low  = MAX(pages_total / 64, (unsigned long) PAGES_LOW_MIN);
+  pages_high = pages_low * 2;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Physical memory detection
+ * ----------------------------------------------------------------------------
+ * 
+ * The amount of RAM depends on the board configuration (e.g., the QEMU "-m"
+ * option), and the kernel is loaded as an ELF image without any boot-time
+ * information (no ATAGs or device tree), so page_init_low() probes every
+ * address range that may contain RAM in 1MB steps: a test pattern is written
+ * through a temporary uncached mapping in 'entry_trtab' and then read back.
+ *
+ * Accessing an address that is not backed by anything causes an external
+ * abort. The normal exception vectors are not mapped yet at this point, so
+ * VBAR temporarily points to 'phys_probe_vectors' (see trapentry.S), whose
+ * data abort handler sets 'phys_probe_aborted' and skips the faulting
+ * instruction.
+ *
+ */
+
+// Physical address ranges that may be populated with RAM on the RealView
+// Platform Baseboard for Cortex-A9.
+static const struct PhysRegion phys_windows[] = {
+  { 0x00000000, 0x10000000 },     // First 256MB of DRAM (aliased)
+  { 0x20000000, 0x40000000 },     // Additional DRAM (-m 1024 in QEMU)
+  { 0x80000000, 0x90000000 },     // Upper half of DRAM at 0x70000000
+};
+
+// Temporary virtual address used to access the memory being probed.
+#define PHYS_PROBE_VA     (KERNEL_BASE + PHYS_ENTRY_TOP)
+
+// Test patterns.
+#define PHYS_PROBE_PAT1   0x55AA55AA
+#define PHYS_PROBE_PAT2   0xAA55AA55
+
+// Set by the data abort handler in 'phys_probe_vectors'.
+volatile int phys_probe_aborted;
+
+// Check whether the 1MB section at physical address 'pa' is backed by RAM.
+static int
+page_probe_section(physaddr_t pa)
+{
+  extern l1_desc_t entry_trtab[];
+
+  volatile uint32_t *p = (volatile uint32_t *) PHYS_PROBE_VA;
+  uint32_t saved;
+  int present;
+
+  // Strongly-ordered mapping (C = B = 0), so no cache maintenance is needed.
+  entry_trtab[L1_IDX(PHYS_PROBE_VA)] =
+    pa | L1_DESC_TYPE_SECT | L1_DESC_SECT_AP(AP_PRIV_RW);
+  dsb();
+  cp15_tlbimva(PHYS_PROBE_VA);
+  dsb();
+  isb();
+
+  phys_probe_aborted = 0;
+
+  // Read first, so that nothing is ever written to an address that does not
+  // respond (write aborts may be imprecise on real hardware).
+  saved = *p;
+
+  if (phys_probe_aborted) {
+    present = 0;
+  } else {
+    *p = PHYS_PROBE_PAT1;
+    present = (*p == PHYS_PROBE_PAT1);
+    *p = PHYS_PROBE_PAT2;
+    present = present && (*p == PHYS_PROBE_PAT2);
+
+    *p = saved;
+
+    present = present && !phys_probe_aborted;
+  }
+
+  entry_trtab[L1_IDX(PHYS_PROBE_VA)] = 0;
+  dsb();
+  cp15_tlbimva(PHYS_PROBE_VA);
+  dsb();
+  isb();
+
+  return present;
+}
+
+// Fill in the 'phys_regions' array.
+static void
+page_detect_memory(void)
+{
+  extern uint8_t phys_probe_vectors[];
+
+  physaddr_t start, end, limit;
+  uint32_t sctlr;
+  unsigned i;
+
+  phys_nregions = 0;
+  phys_ignored  = 0;
+
+  // Catch the aborts caused by probing addresses not backed by anything.
+  sctlr = cp15_sctlr_get();
+  cp15_vbar_set((uint32_t) phys_probe_vectors);
+  cp15_sctlr_set(sctlr & ~CP15_SCTLR_V);
+  isb();
+
+  for (i = 0; i < ARRAY_SIZE(phys_windows); i++) {
+    start = phys_windows[i].start;
+    limit = phys_windows[i].end;
+
+    // Each window is populated from its beginning.
+    for (end = start; end < limit; end += L1_SECTION_SIZE)
+      if (!page_probe_section(end))
+        break;
+
+    if (end == start)
+      continue;
+
+    // Memory beyond PHYS_LIMIT is not accessible via KADDR().
+    if (end > PHYS_LIMIT) {
+      limit = ROUND_DOWN(PHYS_LIMIT, L1_SECTION_SIZE);
+      phys_ignored += end - MAX(start, limit);
+      if (start >= limit)
+        continue;
+      end = limit;
+    }
+
+    if (phys_nregions == PHYS_REGIONS_MAX)
+      panic("too many memory regions");
+
+    phys_regions[phys_nregions].start = start;
+    phys_regions[phys_nregions].end   = end;
+    phys_nregions++;
+  }
+
+  // Back to the high vectors.
+  cp15_sctlr_set(sctlr);
+  isb();
+
+  // The kernel itself is loaded into the first region and expects the pages
+  // mapped by 'entry_trtab' to be there.
+  if ((phys_nregions == 0) || (phys_regions[0].start != 0) ||
+      (phys_regions[0].end < PHYS_ENTRY_TOP))
+    panic("at least %u MB of memory at address 0 required",
+          PHYS_ENTRY_TOP >> 20);
 }
 
 /*
@@ -171,38 +471,172 @@ page_alloc_one(int flags)
  */
 struct Page *
 page_alloc_block(unsigned order, int flags)
+{
+  struct Page *page;
+  int type, tag;
+
+  if (flags & PAGE_ALLOC_USER) {
+    type = PAGE_TYPE_USER;
+    tag  = PAGE_TAG_USER;
+  } else {
+    type = PAGE_TYPE_KERNEL;
+    tag  = PAGE_ALLOC_TAG_GET(flags);
+  }
+
+  assert(tag < PAGE_TAGS);
+
+  // Pre-zeroed pages are taken from user pageblocks.
+  if ((order == 0) && (flags & PAGE_ALLOC_ZERO) && (type == PAGE_TYPE_USER)) {
+    if ((page = page_zero_get()) != NULL) {
+      page_tag_set(page, order, tag);
+      return page;
+    }
+  }
+
+  if (order <= PAGE_CACHE_ORDER_MAX) {
+    page = page_cache_alloc(order, type);
+  } else {
+    spin_lock(&pages_lock);
+    page = page_buddy_alloc(order, type);
+    spin_unlock(&pages_lock);
+  }
+
+  // Free blocks sitting in the current CPU's cache and in the pre-zeroed pool
+  // may prevent the buddy allocator from merging them into a block large
+  // enough. Give them back and try once again. The other CPUs drain their
+  // caches asynchronously, so their blocks only help subsequent requests.
+  if (page == NULL) {
+    page_cache_flush();
+    page_cache_drain_others();
+    page_zero_flush();
+
+    spin_lock(&pages_lock);
+    page = page_buddy_alloc(order, type);
+    spin_unlock(&pages_lock);
+  }
+
+  // Still nothing. Ask the kernel caches to give some memory back.
+  if (page == NULL) {
+    if (shrinker_run(1U << order) == 0)
+      return NULL;
+
+    spin_lock(&pages_lock);
+    page = page_buddy_alloc(order, type);
+    spin_unlock(&pages_lock);
+
+    if (page == NULL)
+      return NULL;
+  }
+
+  assert(page->ref_count == 0);
+
+  if (flags & PAGE_ALLOC_ZERO) {
+    memset(page2kva(page), 0, PAGE_SIZE << order);
+  }
+
+  page_tag_set(page, order, tag);
+
+  return page;
+}
+
+// Remember the owner of an allocated block and update the usage counters.
+static void
+page_tag_set(struct Page *page, unsigned order, int tag)
+{
+  page->tag = tag;
+
+  irq_save();
+  my_cpu()->page_tags[tag] += (1L << order);
+  irq_restore();
+}
+
+// Allocate a block of '2^order' pages of the given type from the buddy free
+// lists. The caller must hold 'pages_lock'.
+static struct Page *
+page_buddy_alloc(unsigned order, int type)
 {
   struct ListLink *link;
   struct Page *page;
   unsigned curr_order;
 
-  spin_lock(&pages_lock);
+  assert(spin_holding(&pages_lock));
 
   for (curr_order = order; curr_order <= PAGE_ORDER_MAX; curr_order++) {
-    if (list_empty(&free_pages[curr_order].link))
+    if (list_empty(&free_pages[curr_order].link[type]))
       continue;
 
     // If there is a free page block at cur_order, allocate it.
-    link = free_pages[curr_order].link.next;
+    link = free_pages[curr_order].link[type].next;
     page = LIST_CONTAINER(link, struct Page, link);
     page_mark_used(page, curr_order);
 
     page = page_split(page, curr_order, order);
 
-    assert(page->ref_count == 0);
     assert(!page_is_free(page, order));
 
-    spin_unlock(&pages_lock);
+    return page;
+  }
 
-    if (flags & PAGE_ALLOC_ZERO) {
-      memset(page2kva(page), 0, PAGE_SIZE << order);
+  return page_buddy_fallback(order, type);
+}
+
+// Allocate a block of '2^order' pages from the free lists of the other type.
+// The caller must hold 'pages_lock'.
+static struct Page *
+page_buddy_fallback(unsigned order, int type)
+{
+  struct ListLink *link;
+  struct Page *page;
+  unsigned curr_order;
+  int other;
+
+  assert(spin_holding(&pages_lock));
+
+  // User pages borrow from the contiguous memory reserve first. Take the
+  // smallest suitable block, so that as few pages as possible have to be
+  // migrated when the reserve is claimed back.
+  if ((type == PAGE_TYPE_USER) && (page_cma_isolated == 0)) {
+    for (curr_order = order; curr_order <= PAGE_ORDER_MAX; curr_order++) {
+      if (list_empty(&free_pages[curr_order].link[PAGE_TYPE_CMA]))
+        continue;
+
+      link = free_pages[curr_order].link[PAGE_TYPE_CMA].next;
+      page = LIST_CONTAINER(link, struct Page, link);
+      page_mark_used(page, curr_order);
+
+      return page_split(page, curr_order, order);
     }
+  }
+
+  other = (type == PAGE_TYPE_KERNEL) ? PAGE_TYPE_USER : PAGE_TYPE_KERNEL;
+
+  // Take the largest available block, so that the other type's pageblocks are
+  // claimed as a whole rather than split into many small pieces.
+  for (curr_order = PAGE_ORDER_MAX + 1; curr_order-- > order; ) {
+    if (list_empty(&free_pages[curr_order].link[other]))
+      continue;
+
+    link = free_pages[curr_order].link[other].next;
+    page = LIST_CONTAINER(link, struct Page, link);
+
+    // Kernel allocations tend to stay, so move the entire pageblock over to
+    // keep the following ones together. Do the same when the block is a large
+    // part of its pageblock anyway. Otherwise, user pages borrow the block
+    // without changing the pageblock type, since they are freed soon.
+    if ((type == PAGE_TYPE_KERNEL) || (curr_order >= PAGEBLOCK_ORDER / 2))
+      pageblock_claim(page, curr_order, type);
+
+    pageblock_fallbacks++;
+
+    page_mark_used(page, curr_order);
+
+    page = page_split(page, curr_order, order);
+
+    assert(!page_is_free(page, order));
 
     return page;
   }
 
-  spin_unlock(&pages_lock);
-
   return NULL;
 }
 
@@ -256,20 +690,62 @@ page_free_one(struct Page *page)
  */
 void
 page_free_block(struct Page *page, unsigned order)
+{
+  if (page->ref_count != 0)
+    panic("ref_count is not zero");
+
+  assert((page - pages) % (1U << order) == 0);
+
+  irq_save();
+  my_cpu()->page_tags[page->tag] -= (1L << order);
+  irq_restore();
+
+  // Blocks of the contiguous memory reserve go straight back to the free
+  // lists, so that they can be claimed at any time.
+  if ((order <= PAGE_CACHE_ORDER_MAX) &&
+      (pageblock_type(page) != PAGE_TYPE_CMA)) {
+    page_cache_free(page, order);
+  } else {
+    spin_lock(&pages_lock);
+    page_buddy_free(page, order);
+    spin_unlock(&pages_lock);
+  }
+}
+
+/**
+ * Split an allocated block into individual pages.
+ *
+ * After this call, each of the 2^order pages of the block can be freed
+ * separately with page_free_one().
+ *
+ * @param page  The first page of the block.
+ * @param order The order of the block.
+ */
+void
+page_block_split(struct Page *page, unsigned order)
+{
+  unsigned i;
+
+  assert((page - pages) % (1U << order) == 0);
+
+  // The owner tag is stored in the first page only.
+  for (i = 1; i < (1U << order); i++)
+    page[i].tag = page->tag;
+}
+
+// Return a block of 2^order pages to the buddy free lists, merging it with its
+// buddies. The caller must hold 'pages_lock'.
+static void
+page_buddy_free(struct Page *page, unsigned order)
 {
   struct Page *buddy;
   unsigned curr_order, pgnum, mask;
 
-  if (page->ref_count != 0)
-    panic("ref_count is not zero");
+  assert(spin_holding(&pages_lock));
 
   pgnum = page - pages;
   mask = (1U << order);
 
-  assert(pgnum % mask == 0);
-
-  spin_lock(&pages_lock);
-
   for (curr_order = order; curr_order < PAGE_ORDER_MAX; curr_order++) {
     buddy = &pages[pgnum ^ mask];
 
@@ -283,8 +759,6 @@ page_free_block(struct Page *page, unsigned order)
   }
 
   page_mark_free(&pages[pgnum], curr_order);
-  
-  spin_unlock(&pages_lock);
 }
 
 /**
@@ -314,12 +788,592 @@ page_free_region(physaddr_t start, physaddr_t end)
       block_order--;
     }
 
-    page_free_block(&pages[curr_pfn], block_order);
+    spin_lock(&pages_lock);
+    page_buddy_free(&pages[curr_pfn], block_order);
+    spin_unlock(&pages_lock);
 
     curr_pfn += block_size;
   }
 }
 
+// Return the pages [curr_pfn, last_pfn) to the buddy free lists in blocks as
+// large as possible. The caller must hold 'pages_lock'.
+static void
+page_buddy_free_range(unsigned curr_pfn, unsigned last_pfn)
+{
+  unsigned block_order;
+
+  assert(spin_holding(&pages_lock));
+
+  while (curr_pfn < last_pfn) {
+    for (block_order = PAGE_ORDER_MAX; block_order > 0; block_order--)
+      if (!(curr_pfn & ((1U << block_order) - 1)) &&
+          (curr_pfn + (1U << block_order) <= last_pfn))
+        break;
+
+    page_buddy_free(&pages[curr_pfn], block_order);
+
+    curr_pfn += (1U << block_order);
+  }
+}
+
+/**
+ * Take the specified physical memory range out of the buddy free lists.
+ *
+ * The pages are returned with zero reference counts and can be freed later
+ * with page_free_region(). No pages are taken unless the whole range is free.
+ * Blocks held in the per-CPU caches and in the pre-zeroed pool do not count
+ * as free.
+ *
+ * @param start The starting physical address (page-aligned).
+ * @param end   The ending physical address (page-aligned).
+ *
+ * @return 0 on success, -EBUSY if any page in the range is in use.
+ */
+int
+page_claim_region(physaddr_t start, physaddr_t end)
+{
+  unsigned curr_pfn, first_pfn, last_pfn, block_pfn, pfn;
+  int order;
+
+  first_pfn = start / PAGE_SIZE;
+  last_pfn  = end / PAGE_SIZE;
+
+  assert((start % PAGE_SIZE == 0) && (end % PAGE_SIZE == 0));
+  assert((first_pfn < last_pfn) && (last_pfn <= npages));
+
+  spin_lock(&pages_lock);
+
+  // Every page of the range must belong to a free block.
+  for (curr_pfn = first_pfn; curr_pfn < last_pfn; ) {
+    for (order = 0; order <= PAGE_ORDER_MAX; order++) {
+      block_pfn = ROUND_DOWN(curr_pfn, 1U << order);
+      if (page_is_free(&pages[block_pfn], order))
+        break;
+    }
+
+    if (order > PAGE_ORDER_MAX) {
+      spin_unlock(&pages_lock);
+      return -EBUSY;
+    }
+
+    curr_pfn = block_pfn + (1U << order);
+  }
+
+  // Take the blocks and give back the parts sticking out of the range.
+  for (curr_pfn = first_pfn; curr_pfn < last_pfn; ) {
+    for (order = 0; order <= PAGE_ORDER_MAX; order++) {
+      block_pfn = ROUND_DOWN(curr_pfn, 1U << order);
+      if (page_is_free(&pages[block_pfn], order))
+        break;
+    }
+
+    page_mark_used(&pages[block_pfn], order);
+
+    curr_pfn = block_pfn + (1U << order);
+
+    page_buddy_free_range(block_pfn, first_pfn);
+    if (curr_pfn > last_pfn) {
+      page_buddy_free_range(last_pfn, curr_pfn);
+      curr_pfn = last_pfn;
+    }
+  }
+
+  spin_unlock(&pages_lock);
+
+  for (pfn = first_pfn; pfn < last_pfn; pfn++) {
+    assert(pages[pfn].ref_count == 0);
+    pages[pfn].tag = PAGE_TAG_KERNEL;
+  }
+
+  return 0;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Contiguous memory reserve
+ * ----------------------------------------------------------------------------
+ */
+
+/**
+ * Mark the physical memory range as the contiguous memory reserve. Must be
+ * called before page_init_high() places the range on the free lists.
+ *
+ * @param start The starting physical address (aligned to the largest block).
+ * @param end   The ending physical address (aligned to the largest block).
+ */
+void
+page_cma_reserve(physaddr_t start, physaddr_t end)
+{
+  unsigned block;
+
+  // Blocks of the largest order never cross the boundaries of the reserve, so
+  // they are never merged with blocks of other types.
+  assert(start % (PAGE_SIZE << PAGE_ORDER_MAX) == 0);
+  assert(end % (PAGE_SIZE << PAGE_ORDER_MAX) == 0);
+  assert((start >= PHYS_ENTRY_TOP) && (end / PAGE_SIZE <= npages));
+
+  for (block = (start / PAGE_SIZE) >> PAGEBLOCK_ORDER;
+       block < ((end / PAGE_SIZE) >> PAGEBLOCK_ORDER);
+       block++)
+    pageblock_types[block] = PAGE_TYPE_CMA;
+}
+
+/**
+ * Stop or resume lending the contiguous memory reserve to user allocations.
+ * Calls may be nested.
+ *
+ * @param isolate Non-zero to stop lending, zero to resume.
+ */
+void
+page_cma_isolate(int isolate)
+{
+  spin_lock(&pages_lock);
+  if (isolate) {
+    page_cma_isolated++;
+  } else {
+    assert(page_cma_isolated > 0);
+    page_cma_isolated--;
+  }
+  spin_unlock(&pages_lock);
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Per-CPU page caches
+ * ----------------------------------------------------------------------------
+ */
+
+// Allocate a block of 2^order pages from the current CPU's cache, refilling it
+// from the buddy free lists if necessary.
+static struct Page *
+page_cache_alloc(unsigned order, int type)
+{
+  struct PageCache *cache;
+  struct Page *page;
+  unsigned i;
+
+  irq_save();
+
+  page_cache_check_drain();
+
+  cache = &my_cpu()->page_cache[type][order];
+
+  if (list_empty(&cache->blocks)) {
+    cache->misses++;
+
+    spin_lock(&pages_lock);
+    for (i = 0; i < PAGE_CACHE_BLOCKS(order); i++) {
+      if ((page = page_buddy_alloc(order, type)) == NULL)
+        break;
+
+      // Blocks borrowed from the contiguous memory reserve are never cached.
+      if (pageblock_type(page) == PAGE_TYPE_CMA) {
+        if (list_empty(&cache->blocks)) {
+          spin_unlock(&pages_lock);
+          irq_restore();
+          return page;
+        }
+
+        page_buddy_free(page, order);
+        break;
+      }
+
+      list_add_back(&cache->blocks, &page->link);
+      cache->count++;
+    }
+    spin_unlock(&pages_lock);
+  } else {
+    cache->hits++;
+  }
+
+  page = NULL;
+  if (!list_empty(&cache->blocks)) {
+    page = LIST_CONTAINER(cache->blocks.next, struct Page, link);
+    list_remove(&page->link);
+    cache->count--;
+  }
+
+  irq_restore();
+
+  return page;
+}
+
+// Put a block of 2^order pages into the current CPU's cache, draining the
+// cache if it grows too large.
+static void
+page_cache_free(struct Page *page, unsigned order)
+{
+  struct PageCache *cache;
+
+  irq_save();
+
+  page_cache_check_drain();
+
+  // Blocks may be borrowed by the other type, so the pageblock type at the time
+  // of freeing is what matters here.
+  cache = &my_cpu()->page_cache[pageblock_type(page)][order];
+
+  // Recently freed blocks are likely to be still in the CPU cache, so put them
+  // at the front of the list to be reused first.
+  list_add_front(&cache->blocks, &page->link);
+  cache->count++;
+
+  if (cache->count > PAGE_CACHE_HIGH(order))
+    page_cache_drain(cache, order, PAGE_CACHE_BLOCKS(order));
+
+  irq_restore();
+}
+
+// Return up to 'n' blocks from the back of the cache to the buddy free lists.
+static void
+page_cache_drain(struct PageCache *cache, unsigned order, unsigned n)
+{
+  struct Page *page;
+
+  spin_lock(&pages_lock);
+
+  while ((n-- > 0) && !list_empty(&cache->blocks)) {
+    page = LIST_CONTAINER(cache->blocks.prev, struct Page, link);
+    list_remove(&page->link);
+    cache->count--;
+
+    page_buddy_free(page, order);
+  }
+
+  spin_unlock(&pages_lock);
+}
+
+/**
+ * Return all blocks cached by the current CPU to the buddy free lists.
+ */
+void
+page_cache_flush(void)
+{
+  struct PageCache *cache;
+  unsigned order;
+  int type;
+
+  irq_save();
+
+  spin_lock(&pages_lock);
+  page_cache_drain_mask &= ~(1U << cpu_id());
+  spin_unlock(&pages_lock);
+
+  for (type = 0; type < PAGE_TYPES; type++) {
+    for (order = 0; order <= PAGE_CACHE_ORDER_MAX; order++) {
+      cache = &my_cpu()->page_cache[type][order];
+      page_cache_drain(cache, order, cache->count);
+    }
+  }
+
+  irq_restore();
+}
+
+// Ask all other CPUs to return their cached blocks to the buddy free lists.
+static void
+page_cache_drain_others(void)
+{
+  spin_lock(&pages_lock);
+  page_cache_drain_mask |= ((1U << NCPU) - 1) & ~(1U << cpu_id());
+  spin_unlock(&pages_lock);
+}
+
+// Drain the current CPU's cache if another CPU has asked for it.
+static void
+page_cache_check_drain(void)
+{
+  irq_save();
+
+  // Reading the mask without the lock is fine: a request that is missed now
+  // is noticed during the next call.
+  if (page_cache_drain_mask & (1U << cpu_id()))
+    page_cache_flush();
+
+  irq_restore();
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Pre-zeroed pages
+ * ----------------------------------------------------------------------------
+ */
+
+// Take a page from the pre-zeroed pool.
+static struct Page *
+page_zero_get(void)
+{
+  struct Page *page;
+
+  spin_lock(&zero_pool.lock);
+
+  if (list_empty(&zero_pool.pages)) {
+    zero_pool.misses++;
+    spin_unlock(&zero_pool.lock);
+    return NULL;
+  }
+
+  page = LIST_CONTAINER(zero_pool.pages.next, struct Page, link);
+  list_remove(&page->link);
+  zero_pool.count--;
+  zero_pool.hits++;
+
+  spin_unlock(&zero_pool.lock);
+
+  return page;
+}
+
+// Return all pre-zeroed pages to the buddy free lists.
+static void
+page_zero_flush(void)
+{
+  struct Page *page;
+
+  spin_lock(&zero_pool.lock);
+  spin_lock(&pages_lock);
+
+  while (!list_empty(&zero_pool.pages)) {
+    page = LIST_CONTAINER(zero_pool.pages.next, struct Page, link);
+    list_remove(&page->link);
+    zero_pool.count--;
+
+    page_buddy_free(page, 0);
+  }
+
+  spin_unlock(&pages_lock);
+  spin_unlock(&zero_pool.lock);
+}
+
+/**
+ * Zero a single free page and put it into the pre-zeroed pool. Called by the
+ * scheduler loop when there are no tasks to run.
+ *
+ * @return 1 if a page has been zeroed, 0 if there is nothing to do.
+ */
+int
+page_zero_idle(void)
+{
+  struct Page *page;
+
+  // Don't take free pages when memory is low.
+  if ((zero_pool.count >= ZERO_POOL_MAX) || (pages_free < pages_high))
+    return 0;
+
+  spin_lock(&pages_lock);
+  // Pages of the contiguous memory reserve must stay on the free lists, to be
+  // claimed at any time.
+  if (((page = page_buddy_alloc(0, PAGE_TYPE_USER)) != NULL) &&
+      (pageblock_type(page) == PAGE_TYPE_CMA)) {
+    page_buddy_free(page, 0);
+    page = NULL;
+  }
+  spin_unlock(&pages_lock);
+
+  if (page == NULL)
+    return 0;
+
+  // The page is not visible to anyone else, so it can be zeroed with
+  // interrupts enabled and without holding any locks.
+  memset(page2kva(page), 0, PAGE_SIZE);
+
+  spin_lock(&zero_pool.lock);
+  list_add_back(&zero_pool.pages, &page->link);
+  zero_pool.count++;
+  zero_pool.zeroed++;
+  spin_unlock(&zero_pool.lock);
+
+  return 1;
+}
+
+/**
+ * Compute the fragmentation index for the given order.
+ *
+ * The index shows whether a failure to allocate a block of the given order
+ * would be caused by lack of memory (values close to 0) or by external
+ * fragmentation (values close to 1000). If a block of the requested order is
+ * available, -1000 is returned. Blocks held in the per-CPU caches and in the
+ * pre-zeroed pool are not taken into account.
+ *
+ * @param order The allocation order.
+ *
+ * @return The fragmentation index.
+ */
+int
+page_frag_index(unsigned order)
+{
+  unsigned long free_pages_total, free_blocks_total, free_blocks_suitable;
+  unsigned o;
+
+  assert(order <= PAGE_ORDER_MAX);
+
+  free_pages_total = free_blocks_total = free_blocks_suitable = 0;
+
+  spin_lock(&pages_lock);
+
+  for (o = 0; o <= PAGE_ORDER_MAX; o++) {
+    free_blocks_total += free_pages[o].count;
+    free_pages_total  += free_pages[o].count << o;
+    if (o >= order)
+      free_blocks_suitable += free_pages[o].count;
+  }
+
+  spin_unlock(&pages_lock);
+
+  if (free_blocks_total == 0)
+    return 0;
+  if (free_blocks_suitable != 0)
+    return -1000;
+
+  return 1000 - (1000 + free_pages_total * 1000 / (1UL << order)) /
+                free_blocks_total;
+}
+
+/**
+ * Collect physical memory usage statistics.
+ *
+ * The counters are read without stopping other CPUs, so the result is only
+ * a snapshot and may be slightly inconsistent.
+ *
+ * @param info Pointer to the structure to store the statistics.
+ */
+void
+page_stats(struct meminfo *info)
+{
+  long tags[PAGE_TAGS];
+  unsigned i, order;
+  int type, tag;
+
+  memset(info, 0, sizeof(*info));
+
+  info->page_size = PAGE_SIZE;
+  info->total     = pages_total;
+
+  spin_lock(&pages_lock);
+  for (order = 0; order <= PAGE_ORDER_MAX; order++) {
+    info->free_blocks[order] = free_pages[order].count;
+    info->free += free_pages[order].count << order;
+  }
+  spin_unlock(&pages_lock);
+
+  for (order = 0; order <= PAGE_ORDER_MAX; order++)
+    info->frag_index[order] = page_frag_index(order);
+
+  // Blocks in the per-CPU caches and in the pre-zeroed pool are free as well.
+  info->cached = zero_pool.count;
+  for (i = 0; i < NCPU; i++)
+    for (type = 0; type < PAGE_TYPES; type++)
+      for (order = 0; order <= PAGE_CACHE_ORDER_MAX; order++)
+        info->cached += cpus[i].page_cache[type][order].count << order;
+  info->free += info->cached;
+
+  info->used = info->total - info->free;
+
+  // Pages may be freed by a CPU other than the one allocated them, so only the
+  // sums are meaningful.
+  for (tag = 0; tag < PAGE_TAGS; tag++)
+    tags[tag] = 0;
+  for (i = 0; i < NCPU; i++)
+    for (tag = 0; tag < PAGE_TAGS; tag++)
+      tags[tag] += cpus[i].page_tags[tag];
+
+  info->slab   = tags[PAGE_TAG_SLAB];
+  info->pgtab  = tags[PAGE_TAG_PGTAB];
+  info->user   = tags[PAGE_TAG_USER];
+  info->kstack = tags[PAGE_TAG_KSTACK];
+  info->buf    = tags[PAGE_TAG_BUF];
+
+  // Everything that is not accounted otherwise, including the kernel image and
+  // the page allocator metadata.
+  info->kernel = info->used - info->slab - info->pgtab - info->user -
+                 info->kstack - info->buf;
+}
+
+/**
+ * Reclaim memory once the number of free pages drops below the low watermark,
+ * and keep reclaiming until it reaches the high watermark. Called by the
+ * scheduler loop when there are no tasks to run.
+ *
+ * @return 1 if any memory has been reclaimed, 0 otherwise.
+ */
+int
+page_reclaim_idle(void)
+{
+  unsigned long free;
+
+  page_cache_check_drain();
+
+  if (!pages_reclaiming && (pages_free >= pages_low))
+    return 0;
+
+  pages_reclaiming = 1;
+
+  // Free blocks sitting in this CPU's cache and in the pre-zeroed pool don't
+  // count as free, so return them first.
+  page_cache_flush();
+  page_zero_flush();
+
+  if ((free = pages_free) >= pages_high) {
+    pages_reclaiming = 0;
+    return 1;
+  }
+
+  if (shrinker_run(pages_high - free) > 0)
+    return 1;
+
+  // Nothing more to reclaim until memory runs low again.
+  pages_reclaiming = 0;
+  return 0;
+}
+
+/**
+ * Display the page allocator statistics.
+ */
+void
+page_info(void)
+{
+  struct PageCache *cache;
+  unsigned i, order, nblocks[PAGE_TYPES];
+  int type;
+
+  cprintf("Pre-zeroed pages: %u, hits: %lu, misses: %lu, zeroed: %lu\n",
+          zero_pool.count, zero_pool.hits, zero_pool.misses,
+          zero_pool.zeroed);
+
+  cprintf("CPU type order  cached        hits      misses\n");
+
+  for (i = 0; i < NCPU; i++) {
+    // Blocks of the contiguous memory reserve are never cached.
+    for (type = 0; type < PAGE_TYPE_CMA; type++) {
+      for (order = 0; order <= PAGE_CACHE_ORDER_MAX; order++) {
+        cache = &cpus[i].page_cache[type][order];
+        cprintf("%3u %4s %5u %7u %11lu %11lu\n",
+                i, type == PAGE_TYPE_USER ? "user" : "kern", order,
+                cache->count, cache->hits, cache->misses);
+      }
+    }
+  }
+
+  for (type = 0; type < PAGE_TYPES; type++)
+    nblocks[type] = 0;
+  for (i = 0; i < npageblocks; i++)
+    nblocks[pageblock_types[i]]++;
+
+  cprintf("Pageblocks: kernel %u, user %u, cma %u, fallbacks: %lu\n",
+          nblocks[PAGE_TYPE_KERNEL], nblocks[PAGE_TYPE_USER],
+          nblocks[PAGE_TYPE_CMA], pageblock_fallbacks);
+
+  cprintf("order    free  frag\n");
+
+  for (order = 0; order <= PAGE_ORDER_MAX; order++)
+    cprintf("%5u %7u %5d\n", order, free_pages[order].count,
+            page_frag_index(order));
+
+  cprintf("Free pages: %lu, watermarks: low %lu, high %lu\n",
+          pages_free, pages_low, pages_high);
+
+  shrinker_info();
+}
+
 /*
  * ----------------------------------------------------------------------------
  * Free list manipulation
@@ -348,7 +1402,9 @@ page_mark_free(struct Page *p, unsigned order)
   assert((pageno % (1U << order)) == 0);
   assert(!page_is_free(p, order));
 
-  list_add_front(&free_pages[order].link, &p->link);
+  list_add_front(&free_pages[order].link[pageblock_type(p)], &p->link);
+  free_pages[order].count++;
+  pages_free += (1U << order);
 
   blockno = pageno / (1 << order);
   free_pages[order].bitmap[blockno / 32] |= (1U << (blockno % 32));
@@ -367,7 +1423,57 @@ page_mark_used(struct Page *p, unsigned order)
   assert(page_is_free(p, order));
 
   list_remove(&p->link);
+  free_pages[order].count--;
+  pages_free -= (1U << order);
 
   blockno = pageno / (1U << order);
   free_pages[order].bitmap[blockno / 32] &= ~(1U << (blockno % 32));
 }
+
+/*
+ * ----------------------------------------------------------------------------
+ * Pageblocks
+ * ----------------------------------------------------------------------------
+ */
+
+// Get the type of the pageblock containing 'p'.
+static int
+pageblock_type(struct Page *p)
+{
+  return pageblock_types[(p - pages) >> PAGEBLOCK_ORDER];
+}
+
+// Change the type of the pageblock(s) containing the free block 'p' of the
+// given order and move all free blocks inside them to the new type's lists.
+// The caller must hold 'pages_lock'.
+static void
+pageblock_claim(struct Page *p, unsigned order, int type)
+{
+  unsigned pfn, end, block;
+  int o;
+
+  assert(spin_holding(&pages_lock));
+
+  pfn = ROUND_DOWN((unsigned) (p - pages), 1U << PAGEBLOCK_ORDER);
+  end = pfn + (1U << MAX(order, (unsigned) PAGEBLOCK_ORDER));
+
+  for (block = pfn >> PAGEBLOCK_ORDER; block < (end >> PAGEBLOCK_ORDER); block++)
+    pageblock_types[block] = type;
+
+  while (pfn < end) {
+    for (o = PAGE_ORDER_MAX; o >= 0; o--) {
+      if ((pfn % (1U << o) == 0) && page_is_free(&pages[pfn], o))
+        break;
+    }
+
+    if (o < 0) {
+      pfn++;
+      continue;
+    }
+
+    list_remove(&pages[pfn].link);
+    list_add_front(&free_pages[o].link[type], &pages[pfn].link);
+
+    pfn += (1U << o);
+  }
+}
@@ -0,0 +1,114 @@
+#include <cprintf.h>
+#include <sync.h>
+
+#include <mm/shrinker.h>
+
+// List of all registered shrinkers.
+//
+// Shrinkers registered later are invoked first. Higher-level caches (such as
+// the buffer cache) are created after, and built on top of, the lower-level
+// ones (the object pools), so the memory released by the former can be
+// returned to the page allocator by the latter during the same pass.
+static struct {
+  struct ListLink head;
+  struct SpinLock lock;
+  unsigned long   runs;
+} shrinkers = {
+  LIST_INITIALIZER(shrinkers.head),
+  SPIN_INITIALIZER("shrinkers"),
+  0,
+};
+
+/**
+ * Register a shrinker.
+ *
+ * @param shrinker Pointer to the shrinker descriptor.
+ */
+void
+shrinker_register(struct Shrinker *shrinker)
+{
+  shrinker->calls = 0;
+  shrinker->freed = 0;
+
+  spin_lock(&shrinkers.lock);
+  list_add_front(&shrinkers.head, &shrinker->link);
+  spin_unlock(&shrinkers.lock);
+}
+
+/**
+ * Unregister a shrinker.
+ *
+ * @param shrinker Pointer to the shrinker descriptor.
+ */
+void
+shrinker_unregister(struct Shrinker *shrinker)
+{
+  spin_lock(&shrinkers.lock);
+  list_remove(&shrinker->link);
+  spin_unlock(&shrinkers.lock);
+}
+
+/**
+ * Ask the registered shrinkers to release memory.
+ *
+ * If another CPU is already running the shrinkers (or this function is
+ * re-entered because a shrinker callback has triggered an allocation), return
+ * immediately.
+ *
+ * @param nr The number of pages to reclaim.
+ *
+ * @return The number of pages reclaimed.
+ */
+unsigned long
+shrinker_run(unsigned long nr)
+{
+  struct ListLink *link;
+  struct Shrinker *shrinker;
+  unsigned long freed, total;
+
+  if (!spin_trylock(&shrinkers.lock))
+    return 0;
+
+  shrinkers.runs++;
+
+  total = 0;
+  LIST_FOREACH(&shrinkers.head, link) {
+    if (total >= nr)
+      break;
+
+    shrinker = LIST_CONTAINER(link, struct Shrinker, link);
+
+    freed = shrinker->shrink(nr - total);
+
+    shrinker->calls++;
+    shrinker->freed += freed;
+    total += freed;
+  }
+
+  spin_unlock(&shrinkers.lock);
+
+  return total;
+}
+
+/**
+ * Display the shrinker statistics.
+ */
+void
+shrinker_info(void)
+{
+  struct ListLink *link;
+  struct Shrinker *shrinker;
+
+  spin_lock(&shrinkers.lock);
+
+  cprintf("Shrinker runs: %lu\n", shrinkers.runs);
+  cprintf("%-20s %10s %10s\n", "name", "calls", "freed");
+
+  LIST_FOREACH(&shrinkers.head, link) {
+    shrinker = LIST_CONTAINER(link, struct Shrinker, link);
+    cprintf("%-20s %10lu %10lu\n",
+            shrinker->name, shrinker->calls, shrinker->freed);
+  }
+
+  spin_unlock(&shrinkers.lock);
+}
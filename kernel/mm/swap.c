@@ -0,0 +1,260 @@
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <string.h>
+
+#include <cprintf.h>
+#include <drivers/sd.h>
+#include <fs/buf.h>
+#include <fs/ext2.h>
+#include <mm/kmalloc.h>
+#include <mm/page.h>
+#include <sync.h>
+#include <sys/meminfo.h>
+#include <types.h>
+
+#include <mm/swap.h>
+
+// Anonymous user pages evicted by the page replacement clock (see
+// vm_swap_out()) are written to a dedicated region of the SD card that
+// follows the root filesystem. The region is divided into page-sized slots.
+//
+// A slot is referenced by the translation table entries that held the page
+// before it was swapped out. After fork, the parent and the child share the
+// same slot, so each slot has a reference count, and the slot is released
+// when the last entry referencing it is either swapped in or unmapped.
+//
+// Slot 0 is never allocated, so that 0 can be used as an error value.
+//
+// The requests go directly to the SD card driver through a few statically
+// allocated buffers rather than through the buffer cache. This way, swapping
+// out a page never needs to allocate memory.
+
+// The number of filesystem blocks in a page.
+#define SWAP_BLOCKS   (PAGE_SIZE / BLOCK_SIZE)
+
+static struct {
+  unsigned long   start;          // First block of the swap area
+  unsigned long   nslots;         // Total number of slots
+  unsigned long   nfree;          // The number of free slots
+  unsigned long   next;           // Where to start looking for a free slot
+  uint16_t       *map;            // Reference count of each slot
+  struct SpinLock lock;           // Protects the slot map
+  struct Mutex    mutex;          // Serializes the I/O requests
+  unsigned long   nread;          // The number of pages read
+  unsigned long   nwritten;       // The number of pages written
+} swap = {
+  .lock = SPIN_INITIALIZER("swap"),
+};
+
+static struct Buf swap_bufs[SWAP_BLOCKS];
+
+/**
+ * Initialize the swap area. Must be called after the root filesystem
+ * superblock has been read.
+ */
+void
+swap_init(void)
+{
+  unsigned i;
+
+  swap.map = (uint16_t *) kmalloc((SWAP_SIZE / PAGE_SIZE) * sizeof(uint16_t),
+                                  KMALLOC_ZERO);
+  if (swap.map == NULL)
+    panic("cannot allocate the swap map");
+
+  for (i = 0; i < SWAP_BLOCKS; i++) {
+    swap_bufs[i].dev        = 0;
+    swap_bufs[i].ref_count  = 1;
+    swap_bufs[i].block_size = BLOCK_SIZE;
+    list_init(&swap_bufs[i].wait_queue);
+    mutex_init(&swap_bufs[i].mutex, "swap_buf");
+  }
+
+  mutex_init(&swap.mutex, "swap");
+
+  spin_lock(&swap.lock);
+  swap.start  = sb.block_count;
+  swap.next   = 1;
+  swap.nfree  = SWAP_SIZE / PAGE_SIZE - 1;
+  swap.nslots = SWAP_SIZE / PAGE_SIZE;
+  spin_unlock(&swap.lock);
+
+  cprintf("Swap size = %dM, start block = %lu\n",
+          SWAP_SIZE / (1024 * 1024), swap.start);
+}
+
+/**
+ * Allocate a free swap slot. The new slot has the reference count of 1.
+ *
+ * @return The slot number, or 0 if the swap area is full.
+ */
+unsigned long
+swap_alloc(void)
+{
+  unsigned long slot, i;
+
+  spin_lock(&swap.lock);
+
+  slot = 0;
+
+  // Look for the next free slot after the last allocated one, so that pages
+  // swapped out together end up in consecutive slots.
+  if (swap.nfree > 0) {
+    for (i = 0; i < swap.nslots; i++) {
+      if (swap.next >= swap.nslots)
+        swap.next = 1;
+
+      if (swap.map[swap.next] == 0) {
+        slot = swap.next++;
+        break;
+      }
+
+      swap.next++;
+    }
+  }
+
+  if (slot != 0) {
+    swap.map[slot] = 1;
+    swap.nfree--;
+  }
+
+  spin_unlock(&swap.lock);
+
+  return slot;
+}
+
+/**
+ * Take an additional reference to a swap slot.
+ *
+ * @param slot The slot number.
+ */
+void
+swap_dup(unsigned long slot)
+{
+  spin_lock(&swap.lock);
+
+  assert((slot > 0) && (slot < swap.nslots) && (swap.map[slot] > 0));
+
+  if (swap.map[slot] == USHRT_MAX)
+    panic("too many references to swap slot %lu", slot);
+  swap.map[slot]++;
+
+  spin_unlock(&swap.lock);
+}
+
+/**
+ * Drop a reference to a swap slot. The slot becomes free when the last
+ * reference is dropped.
+ *
+ * @param slot The slot number.
+ */
+void
+swap_free(unsigned long slot)
+{
+  spin_lock(&swap.lock);
+
+  assert((slot > 0) && (slot < swap.nslots) && (swap.map[slot] > 0));
+
+  if (--swap.map[slot] == 0)
+    swap.nfree++;
+
+  spin_unlock(&swap.lock);
+}
+
+// Transfer the contents of the page to or from the swap slot.
+static int
+swap_io(unsigned long slot, struct Page *page, int write)
+{
+  struct Buf *buf;
+  uint8_t *kva;
+  unsigned i;
+  int r;
+
+  assert((slot > 0) && (slot < swap.nslots));
+
+  kva = (uint8_t *) page2kva(page);
+
+  mutex_lock(&swap.mutex);
+
+  for (i = 0, r = 0; (i < SWAP_BLOCKS) && (r == 0); i++) {
+    buf = &swap_bufs[i];
+
+    mutex_lock(&buf->mutex);
+
+    buf->block_no = swap.start + slot * SWAP_BLOCKS + i;
+
+    if (write) {
+      memcpy(buf->data, kva + i * BLOCK_SIZE, BLOCK_SIZE);
+      buf->flags = BUF_VALID | BUF_DIRTY;
+    } else {
+      buf->flags = 0;
+    }
+
+    sd_request(buf);
+
+    if (buf->flags & BUF_ERROR)
+      r = -EIO;
+    else if (!write)
+      memcpy(kva + i * BLOCK_SIZE, buf->data, BLOCK_SIZE);
+
+    mutex_unlock(&buf->mutex);
+  }
+
+  if (r == 0) {
+    if (write)
+      swap.nwritten++;
+    else
+      swap.nread++;
+  }
+
+  mutex_unlock(&swap.mutex);
+
+  return r;
+}
+
+/**
+ * Read the contents of a page from the swap slot. The caller may sleep.
+ *
+ * @param slot The slot number.
+ * @param page The page to read the data into.
+ *
+ * @return 0 on success, or a negative value if an I/O error occurs.
+ */
+int
+swap_read(unsigned long slot, struct Page *page)
+{
+  return swap_io(slot, page, 0);
+}
+
+/**
+ * Write the contents of a page to the swap slot. The caller may sleep.
+ *
+ * @param slot The slot number.
+ * @param page The page to be written.
+ *
+ * @return 0 on success, or a negative value if an I/O error occurs.
+ */
+int
+swap_write(unsigned long slot, struct Page *page)
+{
+  return swap_io(slot, page, 1);
+}
+
+/**
+ * Fill in the swap usage statistics.
+ *
+ * @param info Pointer to the structure to store the statistics.
+ */
+void
+swap_stats(struct meminfo *info)
+{
+  spin_lock(&swap.lock);
+
+  info->swap_total = swap.nslots > 0 ? swap.nslots - 1 : 0;
+  info->swap_free  = swap.nfree;
+  info->swap_in    = swap.nread;
+  info->swap_out   = swap.nwritten;
+
+  spin_unlock(&swap.lock);
+}
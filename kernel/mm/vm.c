@@ -4,18 +4,50 @@
 
 #include <armv7.h>
 #include <drivers/console.h>
+#include <cpu.h>
 #include <fs/fs.h>
+#include <sync.h>
 #include <types.h>
+#include <mm/filemap.h>
+#include <mm/kmalloc.h>
 #include <mm/kobject.h>
 #include <mm/page.h>
+#include <mm/swap.h>
 
 #include <mm/vm.h>
 
+// The number of small pages in a large page, and its log2.
+#define VM_LARGE_PAGES    (L2_PAGE_LG_SIZE / PAGE_SIZE)
+#define VM_LARGE_ORDER    4
+
+// The number of page tables in a physical page, and the size of the region
+// mapped by all of them.
+#define VM_PGTAB_TABLES   (PAGE_SIZE / L2_TABLE_SIZE)
+#define VM_PGTAB_SPAN     (VM_PGTAB_TABLES * L1_SECTION_SIZE)
+
 static l2_desc_t *vm_walk_trtab(l1_desc_t *, uintptr_t, int);
 static void   vm_static_map(l1_desc_t *, uintptr_t, uint32_t, size_t, int);
+static struct Page *vm_user_page(struct VM *, const void *, int);
+static void   vm_user_unmap(struct VM *, uint8_t *, uint8_t *);
+static int    vm_fault(struct VM *, uintptr_t, int);
+static int    vm_area_remove(struct VM *, uintptr_t, uintptr_t);
+static void   vm_clock_add(struct VM *);
+static void   vm_clock_remove(struct VM *);
+static int    vm_area_sync(struct VM *, struct VMArea *, uintptr_t, uintptr_t);
+static void   vm_large_demote(struct VM *, uintptr_t);
+static void   vm_tlb_invalidate(struct VM *, uintptr_t);
 
 static struct KObjectPool *vm_pool;
-// static struct KObjectPool *vm_area_pool;
+static struct KObjectPool *vm_area_pool;
+
+// Zero-filled user memory that has only been read so far is mapped to this
+// page copy-on-write. The kernel holds a permanent reference to the page, so
+// its reference count never drops to 1, and every write to it makes a copy.
+static struct Page *vm_zero_page;
+
+// User pages are shared between processes after fork, so their reference
+// counts can be changed on several CPUs at once.
+static struct SpinLock vm_page_lock = SPIN_INITIALIZER("vm_page");
 
 /*
  * ----------------------------------------------------------------------------
@@ -32,21 +64,37 @@ vm_init(void)
   extern uint8_t _start[];
 
   struct Page *page;
+  physaddr_t pa;
+  unsigned i;
 
   // Allocate the master translation table
-  if ((page = page_alloc_block(2, PAGE_ALLOC_ZERO)) == NULL)
+  if ((page = page_alloc_block(2, PAGE_ALLOC_ZERO |
+                                  PAGE_ALLOC_TAG(PAGE_TAG_PGTAB))) == NULL)
     panic("out of memory");
 
   kern_trtab = (l1_desc_t *) page2kva(page);
 
-  // Map all physical memory at KERNEL_BASE
+  // Map all physical memory at KERNEL_BASE. The address ranges between the
+  // detected RAM regions belong to memory-mapped devices, so disable caching
+  // for them.
   // Permissions: kernel RW, user NONE
-  vm_static_map(kern_trtab, KERNEL_BASE, 0, PHYS_TOP, VM_READ | VM_WRITE);
+  pa = 0;
+  for (i = 0; i < phys_nregions; i++) {
+    if (pa < phys_regions[i].start)
+      vm_static_map(kern_trtab, KERNEL_BASE + pa, pa,
+                    phys_regions[i].start - pa,
+                    VM_READ | VM_WRITE | VM_NOCACHE);
+
+    vm_static_map(kern_trtab, KERNEL_BASE + phys_regions[i].start,
+                  phys_regions[i].start,
+                  phys_regions[i].end - phys_regions[i].start,
+                  VM_READ | VM_WRITE);
+
+    pa = phys_regions[i].end;
+  }
 
-  // Map all devices 
-  vm_static_map(kern_trtab, KERNEL_BASE + PHYS_TOP, PHYS_TOP,
-              VECTORS_BASE - KERNEL_BASE - PHYS_TOP,
-              VM_READ | VM_WRITE | VM_NOCACHE);
+  vm_static_map(kern_trtab, KERNEL_BASE + pa, pa, PHYS_LIMIT - pa,
+                VM_READ | VM_WRITE | VM_NOCACHE);
 
   // Map exception vectors at VECTORS_BASE
   // Permissions: kernel R, user NONE
@@ -54,12 +102,40 @@ vm_init(void)
 
   vm_init_percpu();
 
-  vm_pool = kobject_pool_create("vm_pool", sizeof(struct VM), 0);
+  vm_pool = kobject_pool_create("vm_pool", sizeof(struct VM), 0, NULL, NULL);
+  if (vm_pool == NULL)
+    panic("cannot allocate vm_pool");
+
+  vm_area_pool = kobject_pool_create("vm_area_pool", sizeof(struct VMArea), 0,
+                                     NULL, NULL);
+  if (vm_area_pool == NULL)
+    panic("cannot allocate vm_area_pool");
+
+  if ((vm_zero_page = page_alloc_one(PAGE_ALLOC_ZERO)) == NULL)
+    panic("cannot allocate the zero page");
+  vm_zero_page->ref_count++;
 }
 
 void
 vm_init_percpu(void)
 {
+  // Enable TEX remap. The memory types selected by the TEX[0], C, and B bits
+  // are set up to mean the same as without remapping, and the remaining TEX
+  // bits become available to hold software flags.
+  cp15_prrr_set(PRRR_TR(0, PRRR_TR_SO) |
+                PRRR_TR(1, PRRR_TR_DEVICE) |
+                PRRR_TR(2, PRRR_TR_NORMAL) |
+                PRRR_TR(3, PRRR_TR_NORMAL) |
+                PRRR_TR(4, PRRR_TR_NORMAL) |
+                PRRR_TR(5, PRRR_TR_NORMAL) |
+                PRRR_TR(6, PRRR_TR_NORMAL) |
+                PRRR_TR(7, PRRR_TR_NORMAL) |
+                PRRR_DS1 | PRRR_NS1);
+  cp15_nmrr_set(NMRR_IR(2, NMRR_WT)    | NMRR_OR(2, NMRR_WT) |
+                NMRR_IR(3, NMRR_WB)    | NMRR_OR(3, NMRR_WB) |
+                NMRR_IR(7, NMRR_WB_WA) | NMRR_OR(7, NMRR_WB_WA));
+  cp15_sctlr_set(cp15_sctlr_get() | CP15_SCTLR_TRE);
+
   // Switch from the minimal entry translation table to the full translation
   // table.
   cp15_ttbr0_set(PADDR(kern_trtab));
@@ -68,6 +144,9 @@ vm_init_percpu(void)
   // Size of the TTBR0 translation table is 8KB.
   cp15_ttbcr_set(1);
 
+  // ASID 0 is reserved for the kernel.
+  cp15_contextidr_set(0);
+
   cp15_tlbiall();
 }
 
@@ -87,10 +166,83 @@ static int prot_to_ap[] = {
   [VM_USER | VM_READ | VM_WRITE] = AP_BOTH_RW, 
 };
 
-static inline void
-vm_L2_DESC_set_flags(l2_desc_t *pte, int flags)
+// Page tables hold nothing but the hardware descriptors, so that four of them
+// fit into a single page. The VM protection flags of an entry are decoded from
+// the descriptor itself (see vm_L2_DESC_get_flags()):
+//
+//  - VM_READ, VM_WRITE and VM_USER come from the AP and nG bits, VM_EXEC from
+//    XN, and VM_NOCACHE from C.
+//  - User pages are mapped with privileged-only AP values only while they are
+//    aged by the page replacement clock, which gives VM_OLD. AP[2] still tells
+//    whether the page is writeable.
+//  - VM_COW and VM_SHARED are kept in TEX[2:1], which are ignored by the MMU
+//    when TEX remap is enabled (see vm_init_percpu()).
+//  - Invalid entries of swapped-out pages hold the slot number and the flags.
+//  - Invalid entries of pages being migrated hold the physical address, the
+//    flags, and the VM_L2_MIGRATE bit.
+#define VM_L2_SM_COW        L2_DESC_SM_TEX(2)
+#define VM_L2_SM_SHARED     L2_DESC_SM_TEX(4)
+#define VM_L2_LG_COW        L2_DESC_LG_TEX(2)
+#define VM_L2_LG_SHARED     L2_DESC_LG_TEX(4)
+
+#define VM_L2_SWAP_PROT_SHIFT   2
+#define VM_L2_SWAP_PROT_MASK    (0xFF << VM_L2_SWAP_PROT_SHIFT)
+#define VM_L2_MIGRATE           (1 << 10)
+
+// Pages aged by the page replacement clock are made inaccessible from user
+// mode, so that the next access faults and marks them as used again.
+static inline int
+vm_prot_to_ap(int prot)
 {
-  *(pte + (L2_NR_ENTRIES * 2)) = flags;
+  if (prot & VM_OLD)
+    return (prot & VM_WRITE) ? AP_PRIV_RW : AP_PRIV_RO;
+  return prot_to_ap[prot & 7];
+}
+
+static inline int
+vm_L2_DESC_get_flags(l2_desc_t *pte)
+{
+  l2_desc_t desc = *pte;
+  int ap, prot;
+
+  switch (desc & L2_DESC_TYPE_MASK) {
+  case L2_DESC_TYPE_FAULT:
+    if (desc == 0)
+      return 0;
+    return ((desc & VM_L2_SWAP_PROT_MASK) >> VM_L2_SWAP_PROT_SHIFT) | VM_SWAP;
+
+  case L2_DESC_TYPE_LG:
+    prot = (desc & L2_DESC_LG_XN) ? 0 : VM_EXEC;
+    if (desc & VM_L2_LG_COW)
+      prot |= VM_COW;
+    if (desc & VM_L2_LG_SHARED)
+      prot |= VM_SHARED;
+    break;
+
+  default:
+    // Small page (bit 0 is XN)
+    prot = (desc & L2_DESC_SM_XN) ? 0 : VM_EXEC;
+    if (desc & VM_L2_SM_COW)
+      prot |= VM_COW;
+    if (desc & VM_L2_SM_SHARED)
+      prot |= VM_SHARED;
+    break;
+  }
+
+  if (!(desc & L2_DESC_C))
+    prot |= VM_NOCACHE;
+  if (desc & L2_DESC_NG)
+    prot |= VM_USER;
+
+  ap = (desc >> 4) & AP_MASK;
+  if (ap & AP_BOTH_RW)
+    prot |= VM_READ;
+  if ((ap == AP_PRIV_RW) || (ap == AP_BOTH_RW))
+    prot |= VM_WRITE;
+  if ((prot & VM_USER) && !(ap & AP_USER_RO))
+    prot |= VM_OLD;
+
+  return prot;
 }
 
 static inline void
@@ -98,21 +250,98 @@ vm_L2_DESC_set(l2_desc_t *pte, physaddr_t pa, int prot)
 {
   int flags;
 
-  flags = L2_DESC_AP(prot_to_ap[prot & 7]);
+  flags = L2_DESC_AP(vm_prot_to_ap(prot));
   if ((prot & VM_USER) && !(prot & VM_EXEC))
     flags |= L2_DESC_SM_XN;
+  // User mappings are tagged with the ASID of their address space.
+  if (prot & VM_USER)
+    flags |= L2_DESC_NG;
   if (!(prot & VM_NOCACHE))
     flags |= (L2_DESC_B | L2_DESC_C);
+  if (prot & VM_COW)
+    flags |= VM_L2_SM_COW;
+  if (prot & VM_SHARED)
+    flags |= VM_L2_SM_SHARED;
 
   *pte = pa | flags | L2_DESC_TYPE_SM;
-  vm_L2_DESC_set_flags(pte, prot);
+}
+
+// Large pages are mapped by 16 identical consecutive entries.
+static inline void
+vm_L2_DESC_set_large(l2_desc_t *pte, physaddr_t pa, int prot)
+{
+  int flags;
+  unsigned i;
+
+  flags = L2_DESC_AP(vm_prot_to_ap(prot));
+  if ((prot & VM_USER) && !(prot & VM_EXEC))
+    flags |= L2_DESC_LG_XN;
+  if (prot & VM_USER)
+    flags |= L2_DESC_NG;
+  if (!(prot & VM_NOCACHE))
+    flags |= (L2_DESC_B | L2_DESC_C);
+  if (prot & VM_COW)
+    flags |= VM_L2_LG_COW;
+  if (prot & VM_SHARED)
+    flags |= VM_L2_LG_SHARED;
+
+  for (i = 0; i < VM_LARGE_PAGES; i++)
+    pte[i] = pa | flags | L2_DESC_TYPE_LG;
+}
+
+static inline int
+vm_L2_DESC_is_large(l2_desc_t *pte)
+{
+  return (*pte & L2_DESC_TYPE_MASK) == L2_DESC_TYPE_LG;
 }
 
 static inline void
 vm_L2_DESC_clear(l2_desc_t *pte)
 {
   *pte = 0;
-  vm_L2_DESC_set_flags(pte, 0);
+}
+
+// A swapped-out page is represented by an invalid entry holding the number of
+// the swap slot (never 0, so the entry is never empty). The protection flags
+// are kept to be restored on swap-in.
+static inline void
+vm_L2_DESC_set_swap(l2_desc_t *pte, unsigned long slot, int prot)
+{
+  assert((slot > 0) && (slot < (1UL << (32 - L2_IDX_SHIFT))));
+
+  *pte = (slot << L2_IDX_SHIFT) |
+         ((prot << VM_L2_SWAP_PROT_SHIFT) & VM_L2_SWAP_PROT_MASK) |
+         L2_DESC_TYPE_FAULT;
+}
+
+static inline int
+vm_L2_DESC_is_swap(l2_desc_t *pte)
+{
+  return ((*pte & L2_DESC_TYPE_MASK) == L2_DESC_TYPE_FAULT) && (*pte != 0);
+}
+
+// A page being migrated is made inaccessible, while the entry keeps its
+// physical address and protection flags. Such entries exist only while the
+// mutexes of all address spaces are held (see vm_migrate_range()).
+static inline void
+vm_L2_DESC_set_migrate(l2_desc_t *pte, physaddr_t pa, int prot)
+{
+  *pte = pa |
+         ((prot << VM_L2_SWAP_PROT_SHIFT) & VM_L2_SWAP_PROT_MASK) |
+         VM_L2_MIGRATE | L2_DESC_TYPE_FAULT;
+}
+
+static inline int
+vm_L2_DESC_is_migrate(l2_desc_t *pte)
+{
+  return ((*pte & L2_DESC_TYPE_MASK) == L2_DESC_TYPE_FAULT) &&
+         (*pte & VM_L2_MIGRATE);
+}
+
+static inline unsigned long
+vm_L2_DESC_swap_slot(l2_desc_t *pte)
+{
+  return *pte >> L2_IDX_SHIFT;
 }
 
 static inline void
@@ -149,17 +378,23 @@ vm_walk_trtab(l1_desc_t *trtab, uintptr_t va, int alloc)
   tte = &trtab[L1_IDX(va)];
   if ((*tte & L1_DESC_TYPE_MASK) == L1_DESC_TYPE_FAULT) {
     struct Page *page;
+    unsigned i;
 
-    if (!alloc || (page = page_alloc_one(PAGE_ALLOC_ZERO)) == NULL)
+    if (!alloc || (page = page_alloc_one(PAGE_ALLOC_ZERO |
+                                         PAGE_ALLOC_TAG(PAGE_TAG_PGTAB))) == NULL)
       return NULL;
     
     page->ref_count++;
 
-    // We could fit four page tables into one physical page. But because we
-    // also need to associate some metadata with each entry, we store only two
-    // page tables in the bottom of the allocated physical page.
-    vm_L1_DESC_set_pgtab(&trtab[(L1_IDX(va) & ~1) + 0], page2pa(page));
-    vm_L1_DESC_set_pgtab(&trtab[(L1_IDX(va) & ~1) + 1], page2pa(page) + L2_TABLE_SIZE);
+    // Fill the whole physical page with page tables for the consecutive
+    // first-level entries (except for those already mapping sections in the
+    // kernel translation table).
+    tte = &trtab[ROUND_DOWN(L1_IDX(va), VM_PGTAB_TABLES)];
+    for (i = 0; i < VM_PGTAB_TABLES; i++)
+      if ((tte[i] & L1_DESC_TYPE_MASK) == L1_DESC_TYPE_FAULT)
+        vm_L1_DESC_set_pgtab(&tte[i], page2pa(page) + i * L2_TABLE_SIZE);
+
+    tte = &trtab[L1_IDX(va)];
   } else if ((*tte & L1_DESC_TYPE_MASK) != L1_DESC_TYPE_TABLE) {
     panic("not a page table");
   }
@@ -187,7 +422,7 @@ vm_static_map(l1_desc_t *trtab, uintptr_t va, uint32_t pa, size_t n, int prot)
     // management overhead.
     if ((va % L1_SECTION_SIZE == 0) &&
         (pa % L1_SECTION_SIZE == 0) &&
-        (n  % L1_SECTION_SIZE == 0)) {
+        (n  >= L1_SECTION_SIZE)) {
       l1_desc_t *tte;
 
       tte = &trtab[L1_IDX(va)];
@@ -216,6 +451,107 @@ vm_static_map(l1_desc_t *trtab, uintptr_t va, uint32_t pa, size_t n, int prot)
   }
 }
 
+/*
+ * ----------------------------------------------------------------------------
+ * Address Space Identifiers
+ * ----------------------------------------------------------------------------
+ */
+
+// TLB entries for user mappings are tagged with the 8-bit ASID of their
+// address space, so switching between address spaces doesn't require flushing
+// the TLB. ASID 0 is reserved for the kernel, which has no user mappings.
+//
+// ASIDs are handed out in generations: vm->asid holds the generation number in
+// the upper bits and the ASID in the lower bits. When all ASIDs are used up, a
+// new generation starts, and address spaces get new ASIDs when they are next
+// switched to. Each CPU flushes its TLB on the first switch after the rollover
+// to drop the entries tagged with ASIDs of the old generation.
+//
+// An address space that keeps running with an old ASID on one CPU may share
+// that ASID with an address space from the new generation running on another
+// CPU. This is harmless: TLBs are per-CPU, and the only effect is that TLB
+// maintenance for one of them also invalidates some entries of the other.
+
+#define ASID_BITS             8
+#define ASID_MASK             ((1UL << ASID_BITS) - 1)
+#define ASID_GENERATION_FIRST (1UL << ASID_BITS)
+
+static struct SpinLock asid_lock = SPIN_INITIALIZER("asid");
+static volatile unsigned long asid_generation = ASID_GENERATION_FIRST;
+static unsigned long asid_next = 1;
+
+// The generation at which each CPU last flushed its TLB.
+static unsigned long asid_cpu_generation[NCPU];
+
+// Make sure the address space has an ASID of the current generation, and
+// flush the local TLB if a rollover has happened since the last switch.
+static void
+vm_asid_check(struct VM *vm)
+{
+  unsigned long generation;
+  unsigned id;
+
+  generation = asid_generation;
+
+  if ((vm->asid & ~ASID_MASK) != generation) {
+    spin_lock(&asid_lock);
+
+    if ((vm->asid & ~ASID_MASK) != asid_generation) {
+      if (asid_next > ASID_MASK) {
+        asid_generation += ASID_GENERATION_FIRST;
+        asid_next = 1;
+      }
+
+      vm->asid = asid_generation | asid_next++;
+    }
+
+    generation = asid_generation;
+
+    spin_unlock(&asid_lock);
+  }
+
+  id = cpu_id();
+  if (asid_cpu_generation[id] != generation) {
+    cp15_tlbiall();
+    dsb();
+    isb();
+
+    asid_cpu_generation[id] = generation;
+  }
+}
+
+// Invalidate the TLB entries for the user virtual address va on all CPUs.
+static void
+vm_tlb_invalidate(struct VM *vm, uintptr_t va)
+{
+  // The address space has never been switched to, so nothing can be cached.
+  if (vm->asid == 0)
+    return;
+
+  // Make sure the translation table update is visible to the table walks.
+  dsb();
+
+  cp15_tlbimvais(ROUND_DOWN(va, PAGE_SIZE) | (vm->asid & ASID_MASK));
+
+  dsb();
+  isb();
+}
+
+// Invalidate all TLB entries of the address space on all CPUs.
+static void
+vm_tlb_invalidate_all(struct VM *vm)
+{
+  if (vm->asid == 0)
+    return;
+
+  dsb();
+
+  cp15_tlbiasidis(vm->asid & ASID_MASK);
+
+  dsb();
+  isb();
+}
+
 /*
  * ----------------------------------------------------------------------------
  * Translation Table Switch
@@ -228,20 +564,41 @@ vm_static_map(l1_desc_t *trtab, uintptr_t va, uint32_t pa, size_t n, int prot)
 void
 vm_switch_kernel(void)
 {
+  irq_save();
+
+  // Switch the table first, so the user ASID is never used with the kernel
+  // table. The kernel table has no user mappings, so no TLB entries can be
+  // created between the two steps.
   cp15_ttbr0_set(PADDR(kern_trtab));
-  cp15_tlbiall();
+  isb();
+  cp15_contextidr_set(0);
+  isb();
+
+  irq_restore();
 }
 
 /**
  * Load the user process translation table.
  * 
- * @param trtab Pointer to the translation table to be loaded.
+ * @param vm Pointer to the address space to be loaded.
  */
 void
 vm_switch_user(struct VM *vm)
 {
+  irq_save();
+
+  vm_asid_check(vm);
+
+  // Never let the new ASID be used with the previous translation table:
+  // switch to the kernel table (which has no user mappings) first.
+  cp15_ttbr0_set(PADDR(kern_trtab));
+  isb();
+  cp15_contextidr_set(vm->asid & ASID_MASK);
+  isb();
   cp15_ttbr0_set(PADDR(vm->trtab));
-  cp15_tlbiall();
+  isb();
+
+  irq_restore();
 }
 
 /*
@@ -263,30 +620,69 @@ vm_lookup_page(l1_desc_t *trtab, const void *va, l2_desc_t **L2_DESC_store)
   if (L2_DESC_store)
     *L2_DESC_store = pte;
 
-  if ((pte == NULL) || ((*pte & L2_DESC_TYPE_SM) != L2_DESC_TYPE_SM))
+  if (pte == NULL)
     return NULL;
 
-  return pa2page(L2_DESC_SM_BASE(*pte));
+  if ((*pte & L2_DESC_TYPE_SM) == L2_DESC_TYPE_SM)
+    return pa2page(L2_DESC_SM_BASE(*pte));
+
+  // Return the small page within the large page.
+  if (vm_L2_DESC_is_large(pte))
+    return pa2page(L2_DESC_LG_BASE(*pte)) + (L2_IDX(va) % VM_LARGE_PAGES);
+
+  return NULL;
+}
+
+/**
+ * Take a reference to a page that can be mapped into user address spaces.
+ *
+ * @param page Pointer to the page info structure.
+ */
+void
+vm_page_get(struct Page *page)
+{
+  spin_lock(&vm_page_lock);
+  page->ref_count++;
+  spin_unlock(&vm_page_lock);
+}
+
+/**
+ * Drop a reference to a page that can be mapped into user address spaces.
+ * The page is freed when the last reference is dropped.
+ *
+ * @param page Pointer to the page info structure.
+ */
+void
+vm_page_put(struct Page *page)
+{
+  int ref_count;
+
+  spin_lock(&vm_page_lock);
+  ref_count = --page->ref_count;
+  spin_unlock(&vm_page_lock);
+
+  if (ref_count == 0)
+    page_free_one(page);
 }
 
 int
-vm_insert_page(l1_desc_t *trtab, struct Page *page, void *va, unsigned perm)
+vm_insert_page(struct VM *vm, struct Page *page, void *va, unsigned perm)
 {
   l2_desc_t *pte;
 
   if ((uintptr_t) va >= KERNEL_BASE)
     panic("bad va: %p", va);
 
-  if ((pte = vm_walk_trtab(trtab, (uintptr_t ) va, 1)) == NULL)
+  if ((pte = vm_walk_trtab(vm->trtab, (uintptr_t ) va, 1)) == NULL)
     return -ENOMEM;
 
   // Incrementing the reference count before calling vm_remove_page() allows
   // us to elegantly handle the situation when the same page is re-inserted at
   // the same virtual address, but with different permissions.
-  page->ref_count++;
+  vm_page_get(page);
 
   // If present, remove the previous mapping.
-  vm_remove_page(trtab, va);
+  vm_remove_page(vm, va);
 
   vm_L2_DESC_set(pte, page2pa(page), perm);
 
@@ -294,7 +690,7 @@ vm_insert_page(l1_desc_t *trtab, struct Page *page, void *va, unsigned perm)
 }
 
 void
-vm_remove_page(l1_desc_t *trtab, void *va)
+vm_remove_page(struct VM *vm, void *va)
 {
   struct Page *page;
   l2_desc_t *pte;
@@ -302,224 +698,1515 @@ vm_remove_page(l1_desc_t *trtab, void *va)
   if ((uintptr_t) va >= KERNEL_BASE)
     panic("bad va: %p", va);
 
-  if ((page = vm_lookup_page(trtab, va, &pte)) == NULL)
+  if ((page = vm_lookup_page(vm->trtab, va, &pte)) == NULL) {
+    // Drop the reference to the slot holding a swapped-out page.
+    if ((pte != NULL) && vm_L2_DESC_is_swap(pte)) {
+      swap_free(vm_L2_DESC_swap_slot(pte));
+      vm_L2_DESC_clear(pte);
+    }
     return;
+  }
 
-  if (--page->ref_count == 0)
-    page_free_one(page);
+  if (vm_L2_DESC_is_large(pte))
+    vm_large_demote(vm, (uintptr_t) va);
+
+  vm_page_put(page);
 
   vm_L2_DESC_clear(pte);
 
-  cp15_tlbimva((uintptr_t) va);
+  vm_tlb_invalidate(vm, (uintptr_t) va);
 }
 
 /*
  * ----------------------------------------------------------------------------
- * Managing Regions of Memory
+ * Large Pages
  * ----------------------------------------------------------------------------
  */
 
-int
-vm_user_alloc(struct VM *vm, void *va, size_t n, int prot)
+// To reduce TLB pressure, anonymous memory is mapped with 64 KB large pages
+// whenever a naturally aligned 64 KB block fits entirely inside an area and
+// none of its pages is mapped yet. Large pages are always private: they are
+// split into small pages ("demoted") before they can be shared by fork, and
+// whenever a part of the block has to be unmapped or remapped.
+
+// Try to map a large page at the 64 KB block containing va. The caller must
+// check that the area is anonymous.
+static int
+vm_large_map(struct VM *vm, struct VMArea *area, uintptr_t va)
 {
   struct Page *page;
-  uint8_t *a, *start, *end;
-  int r;
+  l2_desc_t *pte;
+  uintptr_t block;
+  unsigned i;
 
-  start = ROUND_DOWN((uint8_t *) va, PAGE_SIZE);
-  end   = ROUND_UP((uint8_t *) va + n, PAGE_SIZE);
+  block = ROUND_DOWN(va, L2_PAGE_LG_SIZE);
+  if ((block < area->start) ||
+      (block + L2_PAGE_LG_SIZE > area->start + area->length))
+    return -EINVAL;
 
-  if ((start > end) || (end > (uint8_t *) KERNEL_BASE))
-    panic("invalid range [%p,%p)", start, end);
+  if ((pte = vm_walk_trtab(vm->trtab, block, 1)) == NULL)
+    return -ENOMEM;
 
-  for (a = start; a < end; a += PAGE_SIZE) {
-    if ((page = page_alloc_one(PAGE_ALLOC_ZERO)) == NULL) {
-      vm_user_dealloc(vm, start, a - start);
-      return -ENOMEM;
-    }
+  for (i = 0; i < VM_LARGE_PAGES; i++)
+    if (pte[i] != 0)
+      return -EBUSY;
 
-    if ((r = (vm_insert_page(vm->trtab, page, a, prot)) != 0)) {
-      page_free_one(page);
-      vm_user_dealloc(vm, start, a - start);
-      return r;
-    }
-  }
+  if ((page = page_alloc_block(VM_LARGE_ORDER,
+                               PAGE_ALLOC_ZERO | PAGE_ALLOC_USER)) == NULL)
+    return -ENOMEM;
+
+  page->ref_count++;
+
+  vm_L2_DESC_set_large(pte, page2pa(page), area->flags);
 
   return 0;
 }
 
-void
-vm_user_dealloc(struct VM *vm, void *va, size_t n)
+// Replace the large page mapping the address va with small page mappings of
+// the same physical pages.
+static void
+vm_large_demote(struct VM *vm, uintptr_t va)
 {
-  uint8_t *a, *end;
   struct Page *page;
   l2_desc_t *pte;
+  unsigned i;
+  int prot;
 
-  a   = ROUND_DOWN((uint8_t *) va, PAGE_SIZE);
-  end = ROUND_UP((uint8_t *) va + n, PAGE_SIZE);
+  va  = ROUND_DOWN(va, L2_PAGE_LG_SIZE);
+  pte = vm_walk_trtab(vm->trtab, va, 0);
 
-  if ((a > end) || (end > (uint8_t *) KERNEL_BASE))
-    panic("invalid range [%p,%p)", a, end);
+  assert((pte != NULL) && vm_L2_DESC_is_large(pte));
 
-  while (a < end) {
-    page = vm_lookup_page(vm->trtab, a, &pte);
+  page = pa2page(L2_DESC_LG_BASE(*pte));
+  prot = vm_L2_DESC_get_flags(pte);
 
-    if (pte == NULL) {
-      // Skip the rest of the page table 
-      a = ROUND_DOWN(a + PAGE_SIZE * L2_NR_ENTRIES, PAGE_SIZE * L2_NR_ENTRIES);
-      continue;
-    }
+  assert(page->ref_count == 1);
 
-    if (page != NULL)
-      vm_remove_page(vm->trtab, a);
+  // Changing the page size requires the old entries to be removed from the
+  // TLB before the new ones are written.
+  for (i = 0; i < VM_LARGE_PAGES; i++)
+    vm_L2_DESC_clear(&pte[i]);
+  vm_tlb_invalidate(vm, va);
 
-    a += PAGE_SIZE;
+  // Make each small page a separately freed page with its own reference.
+  page_block_split(page, VM_LARGE_ORDER);
+
+  for (i = 0; i < VM_LARGE_PAGES; i++) {
+    page[i].ref_count = 1;
+    vm_L2_DESC_set(&pte[i], page2pa(&page[i]), prot);
   }
 }
 
+// Remove the large page mapping at va (which must be 64 KB aligned) and free
+// the block.
+static void
+vm_large_remove(struct VM *vm, uintptr_t va)
+{
+  struct Page *page;
+  l2_desc_t *pte;
+  unsigned i;
+
+  pte = vm_walk_trtab(vm->trtab, va, 0);
+
+  assert((pte != NULL) && vm_L2_DESC_is_large(pte));
+
+  page = pa2page(L2_DESC_LG_BASE(*pte));
+
+  for (i = 0; i < VM_LARGE_PAGES; i++)
+    vm_L2_DESC_clear(&pte[i]);
+  vm_tlb_invalidate(vm, va);
+
+  if (--page->ref_count == 0)
+    page_free_block(page, VM_LARGE_ORDER);
+}
+
 /*
  * ----------------------------------------------------------------------------
- * Copying Data Between Address Spaces
+ * Managing Regions of Memory
  * ----------------------------------------------------------------------------
  */
 
-int
-vm_user_copy_out(struct VM *vm, void *dst_va, const void *src_va, size_t n)
-{
-  uint8_t *src = (uint8_t *) src_va;
-  uint8_t *dst = (uint8_t *) dst_va;
-
-  while (n != 0) {
-    struct Page *page;
-    uint8_t *kva;
-    size_t offset, ncopy;
+// Areas are kept in a list sorted by their starting addresses. Adjacent areas
+// with the same protection flags are merged, so a process typically has only
+// a few of them (text, data and heap, stack), and a linear search is enough.
 
-    if ((page = vm_lookup_page(vm->trtab, dst, NULL)) == NULL)
-      return -EFAULT;
-    
-    kva    = (uint8_t *) page2kva(page);
-    offset = (uintptr_t) dst % PAGE_SIZE;
-    ncopy  = MIN(PAGE_SIZE - offset, n);
+// Find the area containing the virtual address va.
+static struct VMArea *
+vm_area_lookup(struct VM *vm, uintptr_t va)
+{
+  struct ListLink *link;
+  struct VMArea *area;
 
-    memmove(kva + offset, src, ncopy);
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
 
-    src += ncopy;
-    dst += ncopy;
-    n   -= ncopy;
+    if (va < area->start)
+      break;
+    if (va - area->start < area->length)
+      return area;
   }
 
-  return 0;
+  return NULL;
 }
 
-int
-vm_user_copy_in(struct VM *vm, void *dst_va, const void *src_va, size_t n)
+// Allocate a new area descriptor.
+static struct VMArea *
+vm_area_alloc(uintptr_t start, size_t length, int prot, struct Inode *ip,
+              off_t offset, size_t file_size)
 {
-  uint8_t *dst = (uint8_t *) dst_va;
-  uint8_t *src = (uint8_t *) src_va;
+  struct VMArea *area;
 
-  while (n != 0) {
-    struct Page *page;
-    uint8_t *kva;
-    size_t offset, ncopy;
+  if ((area = (struct VMArea *) kobject_alloc(vm_area_pool)) == NULL)
+    return NULL;
 
-    if ((page = vm_lookup_page(vm->trtab, src, NULL)) == NULL)
-      return -EFAULT;
+  area->start     = start;
+  area->length    = length;
+  area->flags     = prot;
+  area->inode     = ip ? fs_inode_dup(ip) : NULL;
+  area->offset    = offset;
+  area->file_size = file_size;
 
-    kva    = (uint8_t *) page2kva(page);
-    offset = (uintptr_t) dst % PAGE_SIZE;
-    ncopy  = MIN(PAGE_SIZE - offset, n);
+  return area;
+}
 
-    memmove(dst, kva + offset, ncopy);
+// Free the area descriptor and drop the reference to the backing file.
+static void
+vm_area_free(struct VMArea *area)
+{
+  if (area->inode != NULL)
+    fs_inode_put(area->inode);
+  kobject_free(vm_area_pool, area);
+}
 
-    src += ncopy;
-    dst += ncopy;
-    n   -= ncopy;
-  }
+// Remove the first n bytes from the area.
+static void
+vm_area_trim_front(struct VMArea *area, size_t n)
+{
+  area->start  += n;
+  area->length -= n;
 
-  return 0;
+  if (area->inode != NULL) {
+    area->offset   += n;
+    area->file_size = area->file_size > n ? area->file_size - n : 0;
+  }
 }
 
-/*
- * ----------------------------------------------------------------------------
- * Check User Memory Permissions
- * ----------------------------------------------------------------------------
- */
-
-int
-vm_user_check_buf(struct VM *vm, const void *va, size_t n, unsigned perm)
+// Add the area [start, end) to the address space. The range must not overlap
+// any of the existing areas. Only anonymous areas are merged.
+static int
+vm_area_insert(struct VM *vm, uintptr_t start, uintptr_t end, int prot,
+               struct Inode *ip, off_t offset, size_t file_size)
 {
-  struct Page *page, *new_page;
-  const char *p, *end;
-  l2_desc_t *pte;
+  struct ListLink *link;
+  struct VMArea *area, *prev, *next;
 
-  p   = ROUND_DOWN((const char *) va, PAGE_SIZE);
-  end = ROUND_UP((const char *) va + n, PAGE_SIZE);
+  prev = next = NULL;
 
-  if ((p >= (char *) KERNEL_BASE) || (end > (char *) KERNEL_BASE))
-    return -EFAULT;
-
-  while (p != end) {
-    unsigned curr_perm;
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
 
-    if ((page = vm_lookup_page(vm->trtab, (void *) p, &pte)) == NULL)
-      return -EFAULT;
+    if (area->start >= end) {
+      next = area;
+      break;
+    }
+    prev = area;
+  }
 
-    curr_perm = vm_L2_DESC_get_flags(pte);
+  if (prev != NULL && (prev->inode != NULL || prev->flags != prot))
+    prev = NULL;
+  if (next != NULL && (next->inode != NULL || next->flags != prot))
+    next = NULL;
 
-    if ((perm & VM_WRITE) && (curr_perm & VM_COW)) {
-      curr_perm &= ~VM_COW;
-      curr_perm |= VM_WRITE;
+  // Try to extend one of the neighbors instead of creating a new area.
+  if ((ip == NULL) && (prev != NULL) && (prev->start + prev->length == start)) {
+    prev->length += end - start;
 
-      if ((curr_perm & perm) != perm)
-        return -EFAULT;
+    if ((next != NULL) && (next->start == end)) {
+      prev->length += next->length;
+      list_remove(&next->link);
+      vm_area_free(next);
+    }
 
-      if ((new_page = page_alloc_one(0)) == NULL)
-        return -EFAULT;
+    return 0;
+  }
 
-      memcpy(page2kva(new_page), page2kva(page), PAGE_SIZE);
+  if ((ip == NULL) && (next != NULL) && (next->start == end)) {
+    next->start   = start;
+    next->length += end - start;
+    return 0;
+  }
 
-      if ((vm_insert_page(vm->trtab, new_page, (void *) p, curr_perm)) != 0)
-        return -EFAULT;
-    } else {
-      if ((curr_perm & perm) != perm)
-        return -EFAULT;
-    }
+  area = vm_area_alloc(start, end - start, prot, ip, offset, file_size);
+  if (area == NULL)
+    return -ENOMEM;
 
-    p += PAGE_SIZE;
-  }
+  if (next != NULL)
+    list_add_back(&next->link, &area->link);
+  else
+    list_add_back(&vm->areas, &area->link);
 
   return 0;
 }
 
-int
-vm_user_check_str(struct VM *vm, const char *s, unsigned perm)
+// Remove all areas from the address space.
+static void
+vm_area_remove_all(struct VM *vm)
 {
-  struct Page *page;
-  const char *p;
-  unsigned off;
-  l2_desc_t *pte;
+  struct VMArea *area;
 
-  assert(KERNEL_BASE % PAGE_SIZE == 0);
-
-  while (s < (char *) KERNEL_BASE) {
-    page = vm_lookup_page(vm->trtab, s, &pte);
-    if ((page == NULL) || ((*(pte + (L2_NR_ENTRIES * 2)) & perm) != perm))
-      return -EFAULT;
-
-    p = (const char *) page2kva(page);
-    for (off = (uintptr_t) s % PAGE_SIZE; off < PAGE_SIZE; off++)
-      if (p[off] == '\0')
-        return 0;
-    s += off;
+  while (!list_empty(&vm->areas)) {
+    area = LIST_CONTAINER(vm->areas.next, struct VMArea, link);
+    list_remove(&area->link);
+    vm_area_free(area);
   }
-
-  return -EFAULT;
 }
 
-/*
- * ----------------------------------------------------------------------------
- * Loading Binaries
- * ----------------------------------------------------------------------------
+/**
+ * Map a region of anonymous zero-filled memory into the user address space.
+ *
+ * Only the area is recorded; physical pages are allocated on first access by
+ * vm_handle_fault(). Any previous mappings in the range are removed.
+ *
+ * @param vm   The address space.
+ * @param va   Starting virtual address.
+ * @param n    The size of the region in bytes.
+ * @param prot Protection flags for the region.
+ *
+ * @return 0 on success, -ENOMEM if out of memory.
+ */
+int
+vm_user_alloc(struct VM *vm, void *va, size_t n, int prot)
+{
+  uint8_t *start, *end;
+  int r;
+
+  start = ROUND_DOWN((uint8_t *) va, PAGE_SIZE);
+  end   = ROUND_UP((uint8_t *) va + n, PAGE_SIZE);
+
+  if ((start > end) || (end > (uint8_t *) KERNEL_BASE))
+    panic("invalid range [%p,%p)", start, end);
+
+  if (start == end)
+    return 0;
+
+  mutex_lock(&vm->mutex);
+
+  r = vm_area_remove(vm, (uintptr_t) start, (uintptr_t) end);
+  if (r == 0)
+    r = vm_area_insert(vm, (uintptr_t) start, (uintptr_t) end, prot,
+                       NULL, 0, 0);
+
+  mutex_unlock(&vm->mutex);
+
+  return r;
+}
+
+/**
+ * Map a region of a file into the user address space.
+ *
+ * The first file_size bytes of the region are read from the file on first
+ * access to each page, and the rest of the region is filled with zeros. Any
+ * previous mappings in the range are removed.
+ *
+ * @param vm        The address space.
+ * @param va        Starting virtual address.
+ * @param n         The size of the region in bytes.
+ * @param prot      Protection flags for the region.
+ * @param ip        The file to map.
+ * @param offset    File offset corresponding to va. Must have the same offset
+ *                  within a page as va.
+ * @param file_size The number of bytes to read from the file.
+ *
+ * @return 0 on success, -EINVAL if the arguments are invalid, or -ENOMEM if
+ *         out of memory.
+ */
+int
+vm_user_map_file(struct VM *vm, void *va, size_t n, int prot,
+                 struct Inode *ip, off_t offset, size_t file_size)
+{
+  uint8_t *start, *end;
+  size_t delta;
+  int r;
+
+  if ((file_size > n) || ((uintptr_t) va % PAGE_SIZE != offset % PAGE_SIZE))
+    return -EINVAL;
+
+  start = ROUND_DOWN((uint8_t *) va, PAGE_SIZE);
+  end   = ROUND_UP((uint8_t *) va + n, PAGE_SIZE);
+
+  if ((start > end) || (end > (uint8_t *) KERNEL_BASE))
+    panic("invalid range [%p,%p)", start, end);
+
+  if (start == end)
+    return 0;
+
+  // The area starts at a page boundary, so the file contents before va that
+  // share the same page are mapped as well.
+  delta = (uint8_t *) va - start;
+
+  mutex_lock(&vm->mutex);
+
+  r = vm_area_remove(vm, (uintptr_t) start, (uintptr_t) end);
+  if (r == 0)
+    r = vm_area_insert(vm, (uintptr_t) start, (uintptr_t) end, prot,
+                       ip, offset - delta, file_size + delta);
+
+  mutex_unlock(&vm->mutex);
+
+  return r;
+}
+
+/**
+ * Unmap a region of the user address space and free the pages mapped there.
+ *
+ * @param vm The address space.
+ * @param va Starting virtual address.
+ * @param n  The size of the region in bytes.
+ *
+ * @return 0 on success, -ENOMEM if an area has to be split in two but there
+ *         is no memory for the new area descriptor.
+ */
+int
+vm_user_dealloc(struct VM *vm, void *va, size_t n)
+{
+  uintptr_t start, end;
+  int r;
+
+  start = ROUND_DOWN((uintptr_t) va, PAGE_SIZE);
+  end   = ROUND_UP((uintptr_t) va + n, PAGE_SIZE);
+
+  if ((start > end) || (end > KERNEL_BASE))
+    panic("invalid range [%p,%p)", start, end);
+
+  mutex_lock(&vm->mutex);
+  r = vm_area_remove(vm, start, end);
+  mutex_unlock(&vm->mutex);
+
+  return r;
+}
+
+// Remove the range [start, end) from the areas of the address space and unmap
+// the pages. The caller must hold vm->mutex.
+static int
+vm_area_remove(struct VM *vm, uintptr_t start, uintptr_t end)
+{
+  struct ListLink *link, *next;
+  struct VMArea *area, *split;
+  uintptr_t area_end;
+
+  // Write the changes in shared file mappings back before removing them.
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+    if ((area->start < end) && (area->start + area->length > start))
+      vm_area_sync(vm, area, start, end);
+  }
+
+  // Removing a range from the middle of an area splits it in two. Allocate
+  // the descriptor for the second part before changing anything.
+  split = NULL;
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+
+    if ((area->start < start) && (area->start + area->length > end)) {
+      split = vm_area_alloc(area->start, area->length, area->flags,
+                            area->inode, area->offset, area->file_size);
+      if (split == NULL)
+        return -ENOMEM;
+      break;
+    }
+  }
+
+  for (link = vm->areas.next; link != &vm->areas; link = next) {
+    next = link->next;
+
+    area = LIST_CONTAINER(link, struct VMArea, link);
+    area_end = area->start + area->length;
+
+    if ((area_end <= start) || (area->start >= end))
+      continue;
+
+    if ((area->start >= start) && (area_end <= end)) {
+      list_remove(&area->link);
+      vm_area_free(area);
+      continue;
+    }
+    
+    if ((area->start < start) && (area_end > end)) {
+      // The split descriptor is a copy of the area, keep only its tail.
+      vm_area_trim_front(split, end - split->start);
+      list_add_front(&area->link, &split->link);
+    }
+
+    if (area->start < start) {
+      area->length    = start - area->start;
+      area->file_size = MIN(area->file_size, area->length);
+    } else {
+      vm_area_trim_front(area, end - area->start);
+    }
+  }
+
+  vm_user_unmap(vm, (uint8_t *) start, (uint8_t *) end);
+
+  return 0;
+}
+
+// Free the pages holding page tables for the range [start, end) that have no
+// entries left.
+static void
+vm_trtab_free_unused(struct VM *vm, uintptr_t start, uintptr_t end)
+{
+  struct Page *page;
+  l1_desc_t *tte;
+  l2_desc_t *pgtab;
+  uintptr_t va;
+  unsigned i;
+  int freed;
+
+  freed = 0;
+
+  for (va = ROUND_DOWN(start, VM_PGTAB_SPAN);
+       (va < end) && (va < KERNEL_BASE);
+       va += VM_PGTAB_SPAN) {
+    tte = &vm->trtab[L1_IDX(va)];
+    if ((*tte & L1_DESC_TYPE_MASK) != L1_DESC_TYPE_TABLE)
+      continue;
+
+    pgtab = KADDR(L1_DESC_TABLE_BASE(*tte));
+    for (i = 0; i < VM_PGTAB_TABLES * L2_NR_ENTRIES; i++)
+      if (pgtab[i] != 0)
+        break;
+    if (i < VM_PGTAB_TABLES * L2_NR_ENTRIES)
+      continue;
+
+    for (i = 0; i < VM_PGTAB_TABLES; i++)
+      tte[i] = 0;
+
+    page = kva2page(pgtab);
+    if (--page->ref_count == 0)
+      page_free_one(page);
+
+    freed = 1;
+  }
+
+  // The MMU may cache the first-level entries as well.
+  if (freed)
+    vm_tlb_invalidate_all(vm);
+}
+
+// Remove all pages mapped in the range [a, end), and free the page tables that
+// become empty.
+static void
+vm_user_unmap(struct VM *vm, uint8_t *a, uint8_t *end)
+{
+  uint8_t *start = a;
+  struct Page *page;
+  l2_desc_t *pte;
+
+  while (a < end) {
+    page = vm_lookup_page(vm->trtab, a, &pte);
+
+    if (pte == NULL) {
+      // Skip the rest of the page table 
+      a = ROUND_DOWN(a + PAGE_SIZE * L2_NR_ENTRIES, PAGE_SIZE * L2_NR_ENTRIES);
+      continue;
+    }
+
+    // Free whole large pages at once, without demoting them.
+    if ((page != NULL) && vm_L2_DESC_is_large(pte) &&
+        ((uintptr_t) a % L2_PAGE_LG_SIZE == 0) &&
+        (a + L2_PAGE_LG_SIZE <= end)) {
+      vm_large_remove(vm, (uintptr_t) a);
+      a += L2_PAGE_LG_SIZE;
+      continue;
+    }
+
+    if ((page != NULL) || vm_L2_DESC_is_swap(pte))
+      vm_remove_page(vm, a);
+
+    a += PAGE_SIZE;
+  }
+
+  vm_trtab_free_unused(vm, (uintptr_t) start, (uintptr_t) end);
+}
+
+// Fill the page at va with the contents of the file backing the area.
+static int
+vm_area_read_page(struct VMArea *area, struct Page *page, uintptr_t va)
+{
+  struct Inode *ip = area->inode;
+  uint8_t *kva;
+  size_t n;
+  off_t off;
+  ssize_t r;
+  int locked;
+
+  kva = (uint8_t *) page2kva(page);
+  off = area->offset + (va - area->start);
+  n   = MIN(area->file_size - (va - area->start), PAGE_SIZE);
+
+  // The fault may be triggered by the kernel accessing user memory while
+  // holding the inode lock already.
+  if (!(locked = mutex_holding(&ip->mutex)))
+    fs_inode_lock(ip);
+
+  r = fs_inode_read(ip, kva, n, &off);
+
+  if (!locked)
+    fs_inode_unlock(ip);
+
+  if (r < 0)
+    return r;
+
+  // Zero the rest of the page (and the part beyond the end of the file, if
+  // the file has been truncated).
+  memset(kva + r, 0, PAGE_SIZE - r);
+
+  return 0;
+}
+
+// Map the cached page of the file backing the area at va with the given
+// protection flags.
+static int
+vm_area_map_cached(struct VM *vm, struct VMArea *area, uintptr_t va, int prot)
+{
+  struct Page *page;
+  unsigned long index;
+  int r;
+
+  assert(area->offset % PAGE_SIZE == 0);
+
+  index = (area->offset + (va - area->start)) / PAGE_SIZE;
+  if ((r = filemap_get_page(area->inode, index, &page)) < 0)
+    return r;
+
+  r = vm_insert_page(vm, page, (void *) va, prot);
+
+  // Drop the reference returned by filemap_get_page().
+  vm_page_put(page);
+
+  return r;
+}
+
+// Write the pages of a shared file mapping in the range [start, end) that
+// have been modified back to the file, and make them read-only again.
+static int
+vm_area_sync(struct VM *vm, struct VMArea *area, uintptr_t start,
+             uintptr_t end)
+{
+  struct Inode *ip = area->inode;
+  struct Page *page;
+  l2_desc_t *pte;
+  uintptr_t va;
+  off_t off;
+  size_t n;
+  ssize_t r;
+  int prot, locked;
+
+  if (!(area->flags & VM_SHARED) || !(area->flags & VM_WRITE) || (ip == NULL))
+    return 0;
+
+  start = MAX(start, area->start);
+  end   = MIN(end, area->start + area->length);
+
+  if (!(locked = mutex_holding(&ip->mutex)))
+    fs_inode_lock(ip);
+
+  r = 0;
+  for (va = start; va < end; va += PAGE_SIZE) {
+    page = vm_lookup_page(vm->trtab, (void *) va, &pte);
+
+    if (pte == NULL) {
+      // Skip the rest of the page table
+      va = ROUND_DOWN(va + PAGE_SIZE * L2_NR_ENTRIES,
+                      PAGE_SIZE * L2_NR_ENTRIES) - PAGE_SIZE;
+      continue;
+    }
+
+    if ((page == NULL) || !((prot = vm_L2_DESC_get_flags(pte)) & VM_WRITE))
+      continue;
+
+    // Catch further changes before writing the page.
+    vm_L2_DESC_set(pte, page2pa(page), prot & ~VM_WRITE);
+    vm_tlb_invalidate(vm, va);
+
+    // Changes beyond the end of the file are discarded.
+    off = area->offset + (va - area->start);
+    if ((va - area->start >= area->file_size) || (off >= ip->size))
+      continue;
+
+    n = MIN(PAGE_SIZE, ip->size - off);
+    if ((r = fs_inode_write(ip, page2kva(page), n, &off)) < 0)
+      break;
+  }
+
+  if (!locked)
+    fs_inode_unlock(ip);
+
+  return r < 0 ? r : 0;
+}
+
+/**
+ * Write the changes made to shared file mappings in the given region of the
+ * user address space back to the files.
+ *
+ * @param vm The address space.
+ * @param va Starting virtual address.
+ * @param n  The size of the region in bytes.
+ *
+ * @return 0 on success, -ENOMEM if some part of the region is not mapped, or
+ *         a negative value if writing to a file fails.
+ */
+int
+vm_user_sync(struct VM *vm, void *va, size_t n)
+{
+  struct ListLink *link;
+  struct VMArea *area;
+  uintptr_t start, end, next;
+  int r;
+
+  start = ROUND_DOWN((uintptr_t) va, PAGE_SIZE);
+  end   = ROUND_UP((uintptr_t) va + n, PAGE_SIZE);
+
+  if ((start > end) || (end > KERNEL_BASE))
+    return -ENOMEM;
+
+  mutex_lock(&vm->mutex);
+
+  r = 0;
+  next = start;
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+
+    if (area->start >= end)
+      break;
+    if (area->start + area->length <= start)
+      continue;
+
+    // The whole region must be mapped.
+    if (area->start > next)
+      break;
+    next = area->start + area->length;
+
+    if ((r = vm_area_sync(vm, area, start, end)) < 0)
+      break;
+  }
+
+  mutex_unlock(&vm->mutex);
+
+  if (r < 0)
+    return r;
+  return next >= end ? 0 : -ENOMEM;
+}
+
+/**
+ * Check whether no part of the given region of the user address space is
+ * mapped.
+ *
+ * @param vm    The address space.
+ * @param start Starting virtual address.
+ * @param end   Ending virtual address (exclusive).
+ *
+ * @return 1 if the region is free, 0 otherwise.
+ */
+int
+vm_user_is_free(struct VM *vm, uintptr_t start, uintptr_t end)
+{
+  struct ListLink *link;
+  struct VMArea *area;
+
+  start = ROUND_DOWN(start, PAGE_SIZE);
+  end   = ROUND_UP(end, PAGE_SIZE);
+
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+
+    if (area->start >= end)
+      break;
+    if (area->start + area->length > start)
+      return 0;
+  }
+
+  return 1;
+}
+
+/**
+ * Find the highest free region of the given size between two addresses.
+ *
+ * @param vm   The address space.
+ * @param n    The size of the region in bytes.
+ * @param base The lowest address the region may start at.
+ * @param top  The highest address the region may end at.
+ *
+ * @return The starting address of the region, or 0 if there is no free
+ *         region large enough.
+ */
+uintptr_t
+vm_user_find_free(struct VM *vm, size_t n, uintptr_t base, uintptr_t top)
+{
+  struct ListLink *link;
+  struct VMArea *area;
+  uintptr_t gap_start, gap_end, found;
+
+  n    = ROUND_UP(n, PAGE_SIZE);
+  base = ROUND_UP(base, PAGE_SIZE);
+  top  = ROUND_DOWN(top, PAGE_SIZE);
+
+  if ((n == 0) || (base >= top) || (top - base < n))
+    return 0;
+
+  // Areas are sorted by address, so the last gap that fits is the highest.
+  found = 0;
+  gap_start = base;
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+
+    gap_end = MIN(area->start, top);
+    if ((gap_end > gap_start) && (gap_end - gap_start >= n))
+      found = gap_end - n;
+
+    gap_start = MAX(gap_start, area->start + area->length);
+    if (gap_start >= top)
+      break;
+  }
+
+  if ((gap_start < top) && (top - gap_start >= n))
+    found = top - n;
+
+  return found;
+}
+
+/**
+ * Handle a page fault in the user address space.
+ *
+ * If the address belongs to one of the areas, allocate the missing page, read
+ * a swapped-out page back, or make a private copy of a copy-on-write page on a
+ * write access. If there is not enough memory, swap out some pages and retry.
+ *
+ * @param vm     The address space.
+ * @param va     The faulting virtual address.
+ * @param access The type of the access that caused the fault: VM_READ,
+ *               VM_WRITE, or VM_EXEC (for instruction fetches).
+ *
+ * @return 0 if the fault has been handled, -EFAULT if the access is invalid,
+ *         or -ENOMEM if out of memory.
+ */
+int
+vm_handle_fault(struct VM *vm, uintptr_t va, int access)
+{
+  int r;
+
+  for (;;) {
+    mutex_lock(&vm->mutex);
+    r = vm_fault(vm, va, access);
+    mutex_unlock(&vm->mutex);
+
+    if ((r != -ENOMEM) || (vm_swap_out(SWAP_CLUSTER) == 0))
+      return r;
+  }
+}
+
+// Read the swapped-out page at va back from the swap area.
+static int
+vm_swap_in(struct VM *vm, uintptr_t va, l2_desc_t *pte)
+{
+  struct Page *page;
+  unsigned long slot;
+  int prot, r;
+
+  slot = vm_L2_DESC_swap_slot(pte);
+  prot = vm_L2_DESC_get_flags(pte) & ~VM_SWAP;
+
+  if ((page = page_alloc_one(PAGE_ALLOC_USER)) == NULL)
+    return -ENOMEM;
+
+  if ((r = swap_read(slot, page)) < 0) {
+    page_free_one(page);
+    return r;
+  }
+
+  // Replacing the entry also drops the reference to the swap slot.
+  if ((r = vm_insert_page(vm, page, (void *) va, prot)) < 0)
+    page_free_one(page);
+
+  return r;
+}
+
+// Handle a page fault caused by the given type of access (VM_READ, VM_WRITE,
+// or VM_EXEC). The caller must hold vm->mutex.
+static int
+vm_fault(struct VM *vm, uintptr_t va, int access)
+{
+  struct VMArea *area;
+  struct Page *page, *new_page;
+  l2_desc_t *pte;
+  int prot, write, r;
+
+  if (va >= KERNEL_BASE)
+    return -EFAULT;
+
+  if ((area = vm_area_lookup(vm, va)) == NULL)
+    return -EFAULT;
+
+  if (!(area->flags & VM_READ) || !(area->flags & access))
+    return -EFAULT;
+
+  write = (access == VM_WRITE);
+
+  va = ROUND_DOWN(va, PAGE_SIZE);
+
+  if ((page = vm_lookup_page(vm->trtab, (void *) va, &pte)) == NULL) {
+    if ((pte != NULL) && vm_L2_DESC_is_swap(pte))
+      return vm_swap_in(vm, va, pte);
+
+    // First access to the page.
+
+    // Shared file pages are mapped read-only until the first write, so that
+    // only the modified pages are written back to the file.
+    if ((area->flags & VM_SHARED) && (area->inode != NULL) &&
+        ((va - area->start) < area->file_size)) {
+      prot = write ? area->flags : (area->flags & ~VM_WRITE);
+      return vm_area_map_cached(vm, area, va, prot);
+    }
+
+    // Reading private memory does not need a page of its own until the first
+    // write. Zero-filled pages are mapped to the zero page, and pages filled
+    // entirely from the file (such as program text) are mapped from the page
+    // cache, so that all processes running the same program share them.
+    if (!write && !(area->flags & VM_SHARED)) {
+      prot = area->flags;
+      if (prot & VM_WRITE)
+        prot = (prot & ~VM_WRITE) | VM_COW;
+
+      if ((va - area->start) >= area->file_size)
+        return vm_insert_page(vm, vm_zero_page, (void *) va, prot);
+
+      if ((va - area->start) + PAGE_SIZE <= area->file_size)
+        return vm_area_map_cached(vm, area, va, prot);
+    }
+
+    if ((area->inode == NULL) && (vm_large_map(vm, area, va) == 0))
+      return 0;
+
+    if ((va - area->start) < area->file_size) {
+      if ((new_page = page_alloc_one(PAGE_ALLOC_USER)) == NULL)
+        return -ENOMEM;
+
+      if ((r = vm_area_read_page(area, new_page, va)) < 0) {
+        page_free_one(new_page);
+        return r;
+      }
+    } else {
+      new_page = page_alloc_one(PAGE_ALLOC_ZERO | PAGE_ALLOC_USER);
+      if (new_page == NULL)
+        return -ENOMEM;
+    }
+
+    prot = area->flags;
+  } else {
+    prot = vm_L2_DESC_get_flags(pte);
+
+    // The page has been aged by the replacement clock. Make it accessible
+    // again (large pages are aged as a whole).
+    if (prot & VM_OLD) {
+      prot &= ~VM_OLD;
+
+      if (vm_L2_DESC_is_large(pte))
+        vm_L2_DESC_set_large(pte - (L2_IDX(va) % VM_LARGE_PAGES),
+                             L2_DESC_LG_BASE(*pte), prot);
+      else
+        vm_L2_DESC_set(pte, page2pa(page), prot);
+
+      vm_tlb_invalidate(vm, va);
+    }
+
+    // The page may have been already mapped in the meantime. Otherwise, the
+    // entry does not allow the access (e.g., an instruction fetch from an XN
+    // page), and retrying it would fault forever.
+    if (!write)
+      return (prot & access) ? 0 : -EFAULT;
+    if (prot & VM_WRITE)
+      return 0;
+
+    // Shared pages are mapped read-only until the first write, to find out
+    // which pages need to be written back to the file.
+    if (prot & VM_SHARED) {
+      vm_L2_DESC_set(pte, page2pa(page), prot | VM_WRITE);
+      vm_tlb_invalidate(vm, va);
+      return 0;
+    }
+
+    if (!(prot & VM_COW))
+      return -EFAULT;
+
+    prot &= ~VM_COW;
+    prot |= VM_WRITE;
+
+    // If the other processes sharing the page have already made their own
+    // copies or exited, make the page writeable in place.
+    spin_lock(&vm_page_lock);
+    if (page->ref_count == 1) {
+      vm_L2_DESC_set(pte, page2pa(page), prot);
+      spin_unlock(&vm_page_lock);
+
+      vm_tlb_invalidate(vm, va);
+      return 0;
+    }
+    spin_unlock(&vm_page_lock);
+
+    if ((new_page = page_alloc_one(PAGE_ALLOC_USER)) == NULL)
+      return -ENOMEM;
+
+    memcpy(page2kva(new_page), page2kva(page), PAGE_SIZE);
+  }
+
+  if (vm_insert_page(vm, new_page, (void *) va, prot) != 0) {
+    page_free_one(new_page);
+    return -ENOMEM;
+  }
+
+  return 0;
+}
+
+// Return the page mapped at va, handling the page fault first if the page is
+// not present or if it is copy-on-write and write is not zero. The caller must
+// hold vm->mutex, which is released temporarily if some pages have to be
+// swapped out.
+static struct Page *
+vm_user_page(struct VM *vm, const void *va, int write)
+{
+  struct Page *page;
+  l2_desc_t *pte;
+  int r;
+
+  if ((uintptr_t) va >= KERNEL_BASE)
+    return NULL;
+
+  page = vm_lookup_page(vm->trtab, va, &pte);
+
+  while ((page == NULL) || (write && (vm_L2_DESC_get_flags(pte) & VM_COW))) {
+    r = vm_fault(vm, (uintptr_t) va, write ? VM_WRITE : VM_READ);
+    if (r == -ENOMEM) {
+      mutex_unlock(&vm->mutex);
+      r = vm_swap_out(SWAP_CLUSTER) > 0 ? 0 : -ENOMEM;
+      mutex_lock(&vm->mutex);
+    }
+
+    if (r != 0)
+      return NULL;
+
+    page = vm_lookup_page(vm->trtab, va, &pte);
+  }
+
+  return page;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Swapping
+ * ----------------------------------------------------------------------------
+ */
+
+// When a page fault cannot be handled for lack of memory, some user pages are
+// written to the swap area and freed. The victims are chosen by the clock
+// algorithm: the clock hand sweeps over all user address spaces, one after
+// another. The MMU does not record accesses to pages, so this is emulated in
+// software. Every page passed by the hand is marked as old (VM_OLD) and made
+// inaccessible from user mode; the next access faults, and vm_fault() marks
+// the page as used again. A page that is still old when the hand comes back
+// has not been used for a whole revolution and is swapped out.
+//
+// Only private pages with a single reference can be swapped out, since there
+// is no way to find all translation table entries pointing to a shared page.
+// Large pages are aged as a whole and demoted before swapping out.
+//
+// The hand may scan the address space of another process, so it must not race
+// with the owner changing the translation table. All such changes are made
+// while holding vm->mutex, and the hand skips address spaces whose mutex is
+// busy.
+
+static struct {
+  struct ListLink head;           // List of all user address spaces
+  unsigned long   count;          // The number of address spaces in the list
+  struct VM      *vm;             // The address space the hand points to
+  uintptr_t       va;             // The next address to look at in 'vm'
+  struct SpinLock lock;           // Protects the list and the hand
+} vm_clock = {
+  LIST_INITIALIZER(vm_clock.head),
+  0,
+  NULL,
+  0,
+  SPIN_INITIALIZER("vm_clock"),
+};
+
+// Add the address space to the clock list.
+static void
+vm_clock_add(struct VM *vm)
+{
+  spin_lock(&vm_clock.lock);
+  list_add_back(&vm_clock.head, &vm->link);
+  vm_clock.count++;
+  spin_unlock(&vm_clock.lock);
+}
+
+// Move the hand to the beginning of the next address space in the list. The
+// caller must hold vm_clock.lock.
+static void
+vm_clock_next(void)
+{
+  struct ListLink *next;
+
+  assert(spin_holding(&vm_clock.lock));
+
+  next = (vm_clock.vm != NULL) ? vm_clock.vm->link.next : vm_clock.head.next;
+  if (next == &vm_clock.head)
+    next = next->next;
+
+  vm_clock.vm = (next != &vm_clock.head)
+              ? LIST_CONTAINER(next, struct VM, link)
+              : NULL;
+  vm_clock.va = 0;
+}
+
+// Remove the address space from the clock list.
+static void
+vm_clock_remove(struct VM *vm)
+{
+  spin_lock(&vm_clock.lock);
+
+  if (vm_clock.vm == vm) {
+    vm_clock_next();
+    if (vm_clock.vm == vm)
+      vm_clock.vm = NULL;
+  }
+
+  list_remove(&vm->link);
+  vm_clock.count--;
+
+  spin_unlock(&vm_clock.lock);
+}
+
+// Write the page mapped at va to a free swap slot and replace the mapping with
+// a reference to that slot. The caller must hold vm->mutex.
+static int
+vm_swap_page(struct VM *vm, uintptr_t va, l2_desc_t *pte)
+{
+  struct Page *page;
+  unsigned long slot;
+  int prot, ref_count, r;
+
+  page = pa2page(L2_DESC_SM_BASE(*pte));
+  prot = vm_L2_DESC_get_flags(pte) & ~VM_OLD;
+
+  // New references to the page can be created only through this translation
+  // table, so the count cannot grow while vm->mutex is held.
+  spin_lock(&vm_page_lock);
+  ref_count = page->ref_count;
+  spin_unlock(&vm_page_lock);
+
+  if (ref_count != 1)
+    return -EBUSY;
+
+  if ((slot = swap_alloc()) == 0)
+    return -ENOMEM;
+
+  // Unmap the page first, so that no changes made by the owner can be lost.
+  vm_L2_DESC_set_swap(pte, slot, prot);
+  vm_tlb_invalidate(vm, va);
+
+  if ((r = swap_write(slot, page)) < 0) {
+    vm_L2_DESC_set(pte, page2pa(page), prot);
+    swap_free(slot);
+    return r;
+  }
+
+  vm_page_put(page);
+
+  return 0;
+}
+
+// Advance the clock hand over the address space starting from va, until the
+// total number of swapped out pages reaches nr or the end of the address space
+// is reached. Return the address where the hand has stopped. The caller must
+// hold vm->mutex.
+static uintptr_t
+vm_swap_scan(struct VM *vm, uintptr_t va, unsigned long nr,
+             unsigned long *freed)
+{
+  l2_desc_t *pte;
+  int prot, aged;
+
+  aged = 0;
+
+  for ( ; (va < KERNEL_BASE) && (*freed < nr); va += PAGE_SIZE) {
+    if ((pte = vm_walk_trtab(vm->trtab, va, 0)) == NULL) {
+      // Skip the rest of the page table
+      va = ROUND_DOWN(va + PAGE_SIZE * L2_NR_ENTRIES,
+                      PAGE_SIZE * L2_NR_ENTRIES) - PAGE_SIZE;
+      continue;
+    }
+
+    prot = vm_L2_DESC_get_flags(pte);
+    if (!(prot & VM_USER) || (prot & VM_SHARED))
+      continue;
+
+    if (vm_L2_DESC_is_large(pte)) {
+      if (!(prot & VM_OLD)) {
+        vm_L2_DESC_set_large(pte - (L2_IDX(va) % VM_LARGE_PAGES),
+                             L2_DESC_LG_BASE(*pte), prot | VM_OLD);
+        aged = 1;
+
+        va = ROUND_DOWN(va, L2_PAGE_LG_SIZE) + L2_PAGE_LG_SIZE - PAGE_SIZE;
+        continue;
+      }
+
+      // Not used for a whole revolution: the small pages inherit the VM_OLD
+      // flag and are swapped out one by one.
+      vm_large_demote(vm, va);
+    }
+
+    if (((*pte & L2_DESC_TYPE_SM) != L2_DESC_TYPE_SM) ||
+        (L2_DESC_SM_BASE(*pte) == page2pa(vm_zero_page)))
+      continue;
+
+    if (!(prot & VM_OLD)) {
+      vm_L2_DESC_set(pte, L2_DESC_SM_BASE(*pte), prot | VM_OLD);
+      aged = 1;
+      continue;
+    }
+
+    if (vm_swap_page(vm, va, pte) == 0)
+      (*freed)++;
+  }
+
+  // Make sure the aged pages are no longer accessible through the TLB.
+  if (aged)
+    vm_tlb_invalidate_all(vm);
+
+  return va;
+}
+
+/**
+ * Reclaim memory by swapping out user pages that have not been used recently.
+ * The caller may sleep and must not hold the mutex of any address space.
+ *
+ * @param nr The number of pages to swap out.
+ *
+ * @return The number of pages swapped out.
+ */
+unsigned long
+vm_swap_out(unsigned long nr)
+{
+  struct VM *vm;
+  uintptr_t va;
+  unsigned long freed, visits;
+
+  freed = 0;
+
+  // Two full revolutions of the hand are enough to age and then swap out all
+  // pages that are not in use.
+  for (visits = 0; freed < nr; visits++) {
+    spin_lock(&vm_clock.lock);
+
+    if (vm_clock.vm == NULL)
+      vm_clock_next();
+
+    if ((vm_clock.vm == NULL) || (visits > 2 * vm_clock.count)) {
+      spin_unlock(&vm_clock.lock);
+      break;
+    }
+
+    vm = vm_clock.vm;
+    va = vm_clock.va;
+
+    // The owner is busy changing the address space.
+    if (!mutex_trylock(&vm->mutex)) {
+      vm_clock_next();
+      spin_unlock(&vm_clock.lock);
+      continue;
+    }
+
+    spin_unlock(&vm_clock.lock);
+
+    va = vm_swap_scan(vm, va, nr, &freed);
+
+    // The address space cannot be destroyed while its mutex is held, but the
+    // hand may have been moved away from it.
+    spin_lock(&vm_clock.lock);
+    if (vm_clock.vm == vm) {
+      if (va >= KERNEL_BASE)
+        vm_clock_next();
+      else
+        vm_clock.va = va;
+    }
+    spin_unlock(&vm_clock.lock);
+
+    mutex_unlock(&vm->mutex);
+  }
+
+  return freed;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Page Migration
+ * ----------------------------------------------------------------------------
+ */
+
+// To free a range of physical memory lent to user processes, the pages mapped
+// there are copied elsewhere and the mappings are changed to the copies. There
+// is no way to find all translation table entries pointing to a given page, so
+// every address space is scanned, and all of them are locked for the whole
+// operation. Otherwise, a page shared after fork could be copied twice.
+//
+// The migration is done in three steps:
+//
+// 1. All entries mapping pages in the range are made inaccessible, so that
+//    user processes cannot change the contents during the copy.
+// 2. Each page is copied once into a newly allocated page.
+// 3. The entries are pointed to the copies, and the old pages are released.
+//    If a copy could not be allocated, the old mapping is restored instead.
+
+enum {
+  VM_MIGRATE_UNMAP,
+  VM_MIGRATE_COPY,
+  VM_MIGRATE_REMAP,
+};
+
+// Perform the given migration step for all pages in [start, end) mapped into
+// the address space. 'moved' holds the copy of each page in the range. The
+// caller must hold vm->mutex.
+static int
+vm_migrate_scan(struct VM *vm, physaddr_t start, physaddr_t end,
+                struct Page **moved, int step)
+{
+  struct Page *page, **copy;
+  l2_desc_t *pgtab, *pte;
+  physaddr_t pa;
+  unsigned i, j;
+  int prot, unmapped, r;
+
+  r = unmapped = 0;
+
+  for (i = 0; i < L1_IDX(KERNEL_BASE); i++) {
+    if ((vm->trtab[i] & L1_DESC_TYPE_MASK) != L1_DESC_TYPE_TABLE)
+      continue;
+
+    pgtab = KADDR(L1_DESC_TABLE_BASE(vm->trtab[i]));
+
+    for (j = 0; j < L2_NR_ENTRIES; j++) {
+      pte = &pgtab[j];
+
+      if (step == VM_MIGRATE_UNMAP) {
+        // Pages of a large page are migrated one by one.
+        if (vm_L2_DESC_is_large(pte) &&
+            (L2_DESC_LG_BASE(*pte) < end) &&
+            (L2_DESC_LG_BASE(*pte) + L2_PAGE_LG_SIZE > start))
+          vm_large_demote(vm, (i << L1_IDX_SHIFT) | (j << L2_IDX_SHIFT));
+
+        if ((*pte & L2_DESC_TYPE_SM) != L2_DESC_TYPE_SM)
+          continue;
+
+        pa = L2_DESC_SM_BASE(*pte);
+        if ((pa < start) || (pa >= end))
+          continue;
+
+        vm_L2_DESC_set_migrate(pte, pa, vm_L2_DESC_get_flags(pte));
+        unmapped = 1;
+        continue;
+      }
+
+      if (!vm_L2_DESC_is_migrate(pte))
+        continue;
+
+      pa   = L2_DESC_SM_BASE(*pte);
+      prot = (*pte & VM_L2_SWAP_PROT_MASK) >> VM_L2_SWAP_PROT_SHIFT;
+      page = pa2page(pa);
+      copy = &moved[(pa - start) / PAGE_SIZE];
+
+      if (step == VM_MIGRATE_COPY) {
+        if (*copy != NULL)
+          continue;
+
+        if ((*copy = page_alloc_one(PAGE_ALLOC_USER)) == NULL) {
+          r = -ENOMEM;
+          continue;
+        }
+
+        memcpy(page2kva(*copy), page2kva(page), PAGE_SIZE);
+      } else if (*copy == NULL) {
+        vm_L2_DESC_set(pte, pa, prot);
+      } else {
+        vm_page_get(*copy);
+        vm_L2_DESC_set(pte, page2pa(*copy), prot);
+        vm_page_put(page);
+      }
+    }
+  }
+
+  // The entries being migrated must not be accessible through the TLB.
+  if (unmapped)
+    vm_tlb_invalidate_all(vm);
+
+  return r;
+}
+
+/**
+ * Move all user pages in the physical memory range elsewhere. Pages allocated
+ * during the migration are never taken from the contiguous memory reserve, so
+ * the caller must stop lending it first if the range lies there.
+ *
+ * The caller may sleep and must not hold the mutex of any address space.
+ *
+ * @param start The starting physical address (page-aligned).
+ * @param end   The ending physical address (page-aligned).
+ *
+ * @return 0 on success, -EBUSY if an address space is being changed at the
+ *         moment, or -ENOMEM if there is not enough memory to copy the pages.
+ */
+int
+vm_migrate_range(physaddr_t start, physaddr_t end)
+{
+  struct Page **moved;
+  struct ListLink *link;
+  struct VM **vms;
+  unsigned long count, max, i;
+  int r;
+
+  assert((start % PAGE_SIZE == 0) && (end % PAGE_SIZE == 0));
+
+  moved = (struct Page **) kmalloc((end - start) / PAGE_SIZE * sizeof(*moved),
+                                   KMALLOC_ZERO);
+  if (moved == NULL)
+    return -ENOMEM;
+
+  // Allocate the array of address spaces without holding the clock lock.
+  for (vms = NULL, max = 0; ; max = count + 8) {
+    spin_lock(&vm_clock.lock);
+    if ((count = vm_clock.count) <= max)
+      break;
+    spin_unlock(&vm_clock.lock);
+
+    kfree(vms);
+    if ((vms = (struct VM **) kmalloc((count + 8) * sizeof(*vms), 0)) == NULL) {
+      kfree(moved);
+      return -ENOMEM;
+    }
+  }
+
+  // Lock all address spaces. Since no other mutexes are held, a busy one means
+  // that its owner is in the middle of changing it, and the caller should
+  // retry later. An address space cannot be destroyed while its mutex is held.
+  count = 0;
+  LIST_FOREACH(&vm_clock.head, link) {
+    vms[count] = LIST_CONTAINER(link, struct VM, link);
+    if (!mutex_trylock(&vms[count]->mutex))
+      break;
+    count++;
+  }
+
+  r = (count == vm_clock.count) ? 0 : -EBUSY;
+
+  spin_unlock(&vm_clock.lock);
+
+  if (r == 0) {
+    for (i = 0; i < count; i++)
+      vm_migrate_scan(vms[i], start, end, moved, VM_MIGRATE_UNMAP);
+    for (i = 0; i < count; i++)
+      if (vm_migrate_scan(vms[i], start, end, moved, VM_MIGRATE_COPY) < 0)
+        r = -ENOMEM;
+    for (i = 0; i < count; i++)
+      vm_migrate_scan(vms[i], start, end, moved, VM_MIGRATE_REMAP);
+  }
+
+  for (i = 0; i < count; i++)
+    mutex_unlock(&vms[i]->mutex);
+
+  kfree(vms);
+  kfree(moved);
+
+  return r;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Copying Data Between Address Spaces
+ * ----------------------------------------------------------------------------
+ */
+
+int
+vm_user_copy_out(struct VM *vm, void *dst_va, const void *src_va, size_t n)
+{
+  uint8_t *src = (uint8_t *) src_va;
+  uint8_t *dst = (uint8_t *) dst_va;
+  int r;
+
+  mutex_lock(&vm->mutex);
+
+  for (r = 0; n != 0; ) {
+    struct Page *page;
+    uint8_t *kva;
+    size_t offset, ncopy;
+
+    if ((page = vm_user_page(vm, dst, 1)) == NULL) {
+      r = -EFAULT;
+      break;
+    }
+    
+    kva    = (uint8_t *) page2kva(page);
+    offset = (uintptr_t) dst % PAGE_SIZE;
+    ncopy  = MIN(PAGE_SIZE - offset, n);
+
+    memmove(kva + offset, src, ncopy);
+
+    src += ncopy;
+    dst += ncopy;
+    n   -= ncopy;
+  }
+
+  mutex_unlock(&vm->mutex);
+
+  return r;
+}
+
+int
+vm_user_copy_in(struct VM *vm, void *dst_va, const void *src_va, size_t n)
+{
+  uint8_t *dst = (uint8_t *) dst_va;
+  uint8_t *src = (uint8_t *) src_va;
+  int r;
+
+  mutex_lock(&vm->mutex);
+
+  for (r = 0; n != 0; ) {
+    struct Page *page;
+    uint8_t *kva;
+    size_t offset, ncopy;
+
+    if ((page = vm_user_page(vm, src, 0)) == NULL) {
+      r = -EFAULT;
+      break;
+    }
+
+    kva    = (uint8_t *) page2kva(page);
+    offset = (uintptr_t) src % PAGE_SIZE;
+    ncopy  = MIN(PAGE_SIZE - offset, n);
+
+    memmove(dst, kva + offset, ncopy);
+
+    src += ncopy;
+    dst += ncopy;
+    n   -= ncopy;
+  }
+
+  mutex_unlock(&vm->mutex);
+
+  return r;
+}
+
+/*
+ * ----------------------------------------------------------------------------
+ * Loading Binaries
+ * ----------------------------------------------------------------------------
  */
 
 int
@@ -532,10 +2219,13 @@ vm_user_load(struct VM *vm, void *va, struct Inode *ip, size_t n, off_t off)
 
   dst = (uint8_t *) va;
 
-  while (n != 0) {
-    page = vm_lookup_page(vm->trtab, dst, NULL);
-    if (page == NULL)
-      return -EFAULT;
+  mutex_lock(&vm->mutex);
+
+  for (r = 0; n != 0; ) {
+    if ((page = vm_user_page(vm, dst, 1)) == NULL) {
+      r = -EFAULT;
+      break;
+    }
 
     kva = (uint8_t *) page2kva(page);
 
@@ -543,13 +2233,16 @@ vm_user_load(struct VM *vm, void *va, struct Inode *ip, size_t n, off_t off)
     ncopy  = MIN(PAGE_SIZE - offset, n);
 
     if ((r = fs_inode_read(ip, kva + offset, ncopy, &off)) != ncopy)
-      return r;
+      break;
 
     dst += ncopy;
     n   -= ncopy;
+    r    = 0;
   }
 
-  return 0;
+  mutex_unlock(&vm->mutex);
+
+  return r;
 }
 
 struct VM   *
@@ -561,7 +2254,8 @@ vm_create(void)
   if ((vm = (struct VM *) kobject_alloc(vm_pool)) == NULL)
     return NULL;
 
-  if ((trtab_page = page_alloc_block(1, PAGE_ALLOC_ZERO)) == NULL) {
+  if ((trtab_page = page_alloc_block(1, PAGE_ALLOC_ZERO |
+                                        PAGE_ALLOC_TAG(PAGE_TAG_PGTAB))) == NULL) {
     kobject_free(vm_pool, vm);
     return NULL;
   }
@@ -569,7 +2263,11 @@ vm_create(void)
   trtab_page->ref_count++;
 
   vm->trtab = page2kva(trtab_page);
+  vm->asid  = 0;
   list_init(&vm->areas);
+  mutex_init(&vm->mutex, "vm");
+
+  vm_clock_add(vm);
 
   return vm;
 }
@@ -579,10 +2277,29 @@ vm_destroy(struct VM *vm)
 {
   struct Page *page;
   unsigned i;
+  struct ListLink *link;
+  struct VMArea *area;
+
+  // Hide the address space from the page replacement clock, and wait until
+  // the clock hand leaves it.
+  vm_clock_remove(vm);
+  mutex_lock(&vm->mutex);
+
+  // The caller must make sure the translation table is not loaded on any CPU.
+  // ASIDs are not reused until all TLBs are flushed on rollover, so the stale
+  // entries are harmless, and there is no need to invalidate them one by one
+  // while removing the pages.
+  vm->asid = 0;
+
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+    vm_area_sync(vm, area, area->start, area->start + area->length);
+  }
 
-  vm_user_dealloc(vm, (void *) 0, KERNEL_BASE);
+  vm_area_remove_all(vm);
+  vm_user_unmap(vm, (uint8_t *) 0, (uint8_t *) KERNEL_BASE);
 
-  for (i = 0; i < L1_IDX(KERNEL_BASE); i += 2) {
+  for (i = 0; i < L1_IDX(KERNEL_BASE); i += VM_PGTAB_TABLES) {
     if (!vm->trtab[i])
       continue;
 
@@ -595,6 +2312,8 @@ vm_destroy(struct VM *vm)
   if (--page->ref_count == 0)
       page_free_one(page);
 
+  mutex_unlock(&vm->mutex);
+
   kobject_free(vm_pool, vm);
 }
 
@@ -602,57 +2321,105 @@ struct VM   *
 vm_clone(struct VM *vm)
 {
   struct VM *new_vm;
-  struct Page *src_page, *dst_page;
-  uint8_t *va;
-  l2_desc_t *pte;
+  struct Page *page;
+  struct ListLink *link;
+  struct VMArea *area, *new_area;
+  l2_desc_t *src_pgtab, *dst_pgtab;
+  uintptr_t va;
+  unsigned i, j, perm;
+  int downgraded;
 
   if ((new_vm = vm_create()) == NULL)
     return NULL;
 
-  va = (uint8_t *) 0;
+  mutex_lock(&vm->mutex);
+  mutex_lock(&new_vm->mutex);
 
-  while (va < (uint8_t *) KERNEL_BASE) {
-    src_page = vm_lookup_page(vm->trtab, va, &pte);
-    if (pte == NULL) {
-      // Skip the rest of the page table 
-      va = ROUND_DOWN(va + PAGE_SIZE * L2_NR_ENTRIES, PAGE_SIZE * L2_NR_ENTRIES);
+  LIST_FOREACH(&vm->areas, link) {
+    area = LIST_CONTAINER(link, struct VMArea, link);
+
+    new_area = vm_area_alloc(area->start, area->length, area->flags,
+                             area->inode, area->offset, area->file_size);
+    if (new_area == NULL)
+      goto fail;
+
+    list_add_back(&new_vm->areas, &new_area->link);
+  }
+
+  // Share all pages with the child. Writeable pages become copy-on-write in
+  // both address spaces. The parent's entries are changed in place, and its
+  // stale TLB entries are invalidated all at once at the end.
+  downgraded = 0;
+
+  for (i = 0; i < L1_IDX(KERNEL_BASE); i++) {
+    if ((vm->trtab[i] & L1_DESC_TYPE_MASK) != L1_DESC_TYPE_TABLE)
       continue;
-    }
 
-    if (src_page != NULL) {
-      unsigned perm;
+    src_pgtab = KADDR(L1_DESC_TABLE_BASE(vm->trtab[i]));
 
-      perm = vm_L2_DESC_get_flags(pte);
+    // Skip page tables with no pages mapped.
+    for (j = 0; j < L2_NR_ENTRIES; j++)
+      if (src_pgtab[j] != 0)
+        break;
+    if (j == L2_NR_ENTRIES)
+      continue;
 
-      if ((perm & VM_WRITE) || (perm & VM_COW)) {
-        perm &= ~VM_WRITE;
-        perm |= VM_COW;
+    va = i << L1_IDX_SHIFT;
+    if ((dst_pgtab = vm_walk_trtab(new_vm->trtab, va, 1)) == NULL)
+      goto fail;
 
-        if (vm_insert_page(vm->trtab, src_page, va, perm) < 0)
-          panic("Cannot change page permissions");
+    spin_lock(&vm_page_lock);
 
-        if (vm_insert_page(new_vm->trtab, src_page, va, perm) < 0) {
-          vm_destroy(new_vm);
-          return NULL;
-        }
-      } else {
-        if ((dst_page = page_alloc_one(0)) == NULL) {
-          vm_destroy(new_vm);
-          return NULL;
-        }
+    for ( ; j < L2_NR_ENTRIES; j++) {
+      // Large pages are never shared.
+      if (vm_L2_DESC_is_large(&src_pgtab[j]))
+        vm_large_demote(vm, va | (j << L2_IDX_SHIFT));
 
-        if (vm_insert_page(new_vm->trtab, dst_page, va, perm) < 0) {
-          page_free_one(dst_page);
-          vm_destroy(new_vm);
-          return NULL;
-        }
+      // Swapped-out pages are read back into separate pages by each process.
+      if (vm_L2_DESC_is_swap(&src_pgtab[j])) {
+        swap_dup(vm_L2_DESC_swap_slot(&src_pgtab[j]));
+
+        dst_pgtab[j] = src_pgtab[j];
+        continue;
+      }
+
+      if ((src_pgtab[j] & L2_DESC_TYPE_SM) != L2_DESC_TYPE_SM)
+        continue;
+
+      page = pa2page(L2_DESC_SM_BASE(src_pgtab[j]));
+      perm = vm_L2_DESC_get_flags(&src_pgtab[j]);
+
+      // Shared pages remain writeable in both address spaces.
+      if ((perm & (VM_WRITE | VM_COW)) && !(perm & VM_SHARED)) {
+        perm &= ~VM_WRITE;
+        perm |= VM_COW;
 
-        memcpy(page2kva(dst_page), page2kva(src_page), PAGE_SIZE);
+        vm_L2_DESC_set(&src_pgtab[j], page2pa(page), perm);
+        downgraded = 1;
       }
+
+      vm_L2_DESC_set(&dst_pgtab[j], page2pa(page), perm);
+      page->ref_count++;
     }
 
-    va += PAGE_SIZE;
+    spin_unlock(&vm_page_lock);
   }
 
+  if (downgraded)
+    vm_tlb_invalidate_all(vm);
+
+  mutex_unlock(&new_vm->mutex);
+  mutex_unlock(&vm->mutex);
+
   return new_vm;
-}
\ No newline at end of file
+
+fail:
+  if (downgraded)
+    vm_tlb_invalidate_all(vm);
+
+  mutex_unlock(&new_vm->mutex);
+  mutex_unlock(&vm->mutex);
+
+  vm_destroy(new_vm);
+  return NULL;
+}
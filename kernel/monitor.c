@@ -2,10 +2,15 @@
 
 #include <armv7.h>
 #include <drivers/console.h>
+#include <drivers/l2cc.h>
 #include <cprintf.h>
 #include <kdebug.h>
+#include <mm/cma.h>
 #include <mm/kobject.h>
 #include <mm/memlayout.h>
+#include <mm/page.h>
+#include <mm/swap.h>
+#include <sys/meminfo.h>
 #include <trap.h>
 #include <types.h>
 
@@ -90,7 +95,10 @@ static struct Command commands[] = {
   { "help", "Print this list of commands", mon_help },
   { "kerninfo", "Print this list of commands", mon_kerninfo },
   { "backtrace", "Display a list of function call frames", mon_backtrace },
-  { "poolinfo", "Display the list of object pools", mon_poolinfo },
+  { "poolinfo", "Display object pools; [name] to dump one", mon_poolinfo },
+  { "pageinfo", "Display the page allocator statistics", mon_pageinfo },
+  { "meminfo", "Display the physical memory usage", mon_meminfo },
+  { "l2cache", "Display the L2 cache; [reset] the counters", mon_l2cache },
 };
 
 #define MAXARGS 16
@@ -218,12 +226,84 @@ mon_backtrace(int argc, char **argv, struct TrapFrame *tf)
 
 int
 mon_poolinfo(int argc, char **argv, struct TrapFrame *tf)
+{
+  struct KObjectPool *pool;
+
+  (void) tf;
+
+  if (argc < 2) {
+    kobject_pool_info();
+    return 0;
+  }
+
+  if ((pool = kobject_pool_lookup(argv[1])) == NULL) {
+    cprintf("No such pool: %s\n", argv[1]);
+    return 0;
+  }
+
+  kobject_dump(pool);
+
+  return 0;
+}
+
+int
+mon_pageinfo(int argc, char **argv, struct TrapFrame *tf)
 {
   (void) argc;
   (void) argv;
   (void) tf;
 
-  kobject_pool_info();
+  page_info();
+  cma_info();
+
+  return 0;
+}
+
+int
+mon_meminfo(int argc, char **argv, struct TrapFrame *tf)
+{
+  struct meminfo info;
+  unsigned order;
+
+  (void) argc;
+  (void) argv;
+  (void) tf;
+
+  page_stats(&info);
+  swap_stats(&info);
+
+  cprintf("Total:  %8lu KB\n", info.total * (info.page_size / 1024));
+  cprintf("Used:   %8lu KB\n", info.used * (info.page_size / 1024));
+  cprintf("Free:   %8lu KB (cached %lu KB)\n",
+          info.free * (info.page_size / 1024),
+          info.cached * (info.page_size / 1024));
+
+  cprintf("  slab %lu, pgtab %lu, user %lu, kstack %lu, buf %lu, kernel %lu "
+          "pages\n", info.slab, info.pgtab, info.user, info.kstack, info.buf,
+          info.kernel);
+
+  cprintf("order    free  frag\n");
+  for (order = 0; order < __MEMINFO_ORDERS; order++)
+    cprintf("%5u %7lu %5d\n",
+            order, info.free_blocks[order], info.frag_index[order]);
+
+  cprintf("Swap:   %8lu KB (free %lu KB), in %lu, out %lu pages\n",
+          info.swap_total * (info.page_size / 1024),
+          info.swap_free * (info.page_size / 1024),
+          info.swap_in, info.swap_out);
+
+  return 0;
+}
+
+int
+mon_l2cache(int argc, char **argv, struct TrapFrame *tf)
+{
+  (void) tf;
+
+  l2cc_info();
+
+  if ((argc > 1) && (strcmp(argv[1], "reset") == 0))
+    l2cc_reset_counters();
 
   return 0;
 }
@@ -14,6 +14,7 @@
 #include <hash.h>
 #include <mm/kobject.h>
 #include <mm/page.h>
+#include <mm/swap.h>
 #include <mm/vm.h>
 #include <monitor.h>
 #include <sync.h>
@@ -38,6 +39,8 @@ static struct SpinLock process_lock;
 
 static void process_run(void);
 static void process_pop_tf(struct TrapFrame *);
+static int  process_ctor(void *);
+static void process_dtor(void *);
 
 static struct Process *init_process;
 
@@ -46,7 +49,8 @@ process_init(void)
 {
   extern uint8_t _binary_obj_user_init_start[];
 
-  process_pool = kobject_pool_create("process_pool", sizeof(struct Process), 0);
+  process_pool = kobject_pool_create("process_pool", sizeof(struct Process), 0,
+                                     process_ctor, process_dtor);
   if (process_pool == NULL)
     panic("cannot allocate process_pool");
 
@@ -60,24 +64,58 @@ process_init(void)
     panic("Cannot create the init process");
 }
 
+// Object pool constructor. Process descriptors are kept in the pool together
+// with their kernel stacks. When a descriptor is freed, its wait queue and
+// list of children are empty, it is not linked into the siblings list, and all
+// its file descriptors are closed.
+static int
+process_ctor(void *obj)
+{
+  struct Process *process = (struct Process *) obj;
+  struct Page *page;
+  int i;
+
+  // Allocate per-process kernel stack
+  if ((page = page_alloc_one(PAGE_ALLOC_TAG(PAGE_TAG_KSTACK))) == NULL)
+    return -ENOMEM;
+
+  process->kstack = (uint8_t *) page2kva(page);
+  page->ref_count++;
+
+  list_init(&process->wait_queue);
+  list_init(&process->children);
+  process->sibling.next = NULL;
+  process->sibling.prev = NULL;
+
+  for (i = 0; i < OPEN_MAX; i++)
+    process->files[i] = NULL;
+
+  return 0;
+}
+
+// Object pool destructor.
+static void
+process_dtor(void *obj)
+{
+  struct Process *process = (struct Process *) obj;
+  struct Page *kstack_page;
+
+  // Free the kernel stack
+  kstack_page = kva2page(process->kstack);
+  kstack_page->ref_count--;
+  page_free_one(kstack_page);
+}
+
 struct Process *
 process_alloc(void)
 {
   static pid_t next_pid;
-  int i;
 
-  struct Page *page;
   struct Process *process;
   uint8_t *sp;
 
-  process = (struct Process *) kobject_alloc(process_pool);
-
-  // Allocate per-process kernel stack
-  if ((page = page_alloc_one(0)) == NULL)
-    goto fail1;
-
-  process->kstack = (uint8_t *) page2kva(page);
-  page->ref_count++;
+  if ((process = (struct Process *) kobject_alloc(process_pool)) == NULL)
+    return NULL;
 
   sp = process->kstack + PAGE_SIZE;
 
@@ -86,15 +124,13 @@ process_alloc(void)
   process->tf = (struct TrapFrame *) sp;
 
   // Setup new context to start executing at task_run.
-  if ((process->task = task_create(process, process_run, sp)) == NULL)
-    goto fail2;
+  if ((process->task = task_create(process, process_run, sp)) == NULL) {
+    kobject_free(process_pool, process);
+    return NULL;
+  }
 
   process->parent = NULL;
   process->zombie = 0;
-  list_init(&process->wait_queue);
-  list_init(&process->children);
-  process->sibling.next = NULL;
-  process->sibling.prev = NULL;
 
   spin_lock(&pid_hash.lock);
 
@@ -105,17 +141,7 @@ process_alloc(void)
 
   spin_unlock(&pid_hash.lock);
 
-  for (i = 0; i < OPEN_MAX; i++)
-    process->files[i] = NULL;
-
   return process;
-
-fail2:
-  page->ref_count--;
-  page_free_one(page);
-fail1:
-  kobject_free(process_pool, process);
-  return NULL;
 }
 
 int
@@ -152,7 +178,7 @@ process_load_binary(struct Process *proc, const void *binary)
       return -EINVAL;
     
     if ((r = vm_user_alloc(proc->vm, (void *) ph->vaddr, ph->memsz,
-                             VM_READ | VM_WRITE | VM_EXEC | VM_USER) < 0))
+                           VM_READ | VM_WRITE | VM_EXEC | VM_USER)) < 0)
       return r;
 
     if ((r = vm_user_copy_out(proc->vm, (void *) ph->vaddr,
@@ -163,7 +189,7 @@ process_load_binary(struct Process *proc, const void *binary)
   }
 
   if ((r = vm_user_alloc(proc->vm, (void *) (proc->stack), USTACK_SIZE,
-                           VM_READ | VM_WRITE | VM_USER) < 0))
+                         VM_READ | VM_WRITE | VM_USER)) < 0)
     return r;
 
   proc->tf->r0  = 0;                   // argc
@@ -220,15 +246,12 @@ fail1:
 void
 process_free(struct Process *process)
 {
-  struct Page *kstack_page;
-
   // Destroy the task descriptor
   task_destroy(process->task);
 
-  // Free the kernel stack
-  kstack_page = kva2page(process->kstack);
-  kstack_page->ref_count--;
-  page_free_one(kstack_page);
+  // A zombie is still linked into its own wait queue by task_sleep(), reset
+  // the queue to return the descriptor to the pool in the constructed state.
+  list_init(&process->wait_queue);
 
   // Remove the pid hash link
   spin_lock(&pid_hash.lock);
@@ -264,13 +287,24 @@ process_destroy(int status)
 {
   struct ListLink *l;
   struct Process *child, *current = my_process();
+  struct VM *vm;
   int fd, has_zombies;
 
-  vm_destroy(current->vm);
+  // The translation tables must not stay loaded while they are being freed,
+  // or speculative table walks could fetch entries from reused memory. Detach
+  // the address space first, so that the scheduler does not load them again
+  // if vm_destroy() sleeps.
+  vm = current->vm;
+  current->vm = NULL;
+  vm_switch_kernel();
+  vm_destroy(vm);
 
-  for (fd = 0; fd < OPEN_MAX; fd++)
-    if (current->files[fd])
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    if (current->files[fd]) {
       file_close(current->files[fd]);
+      current->files[fd] = NULL;
+    }
+  }
 
   fs_inode_put(current->cwd);
 
@@ -345,6 +379,110 @@ process_copy(void)
   return child->pid;
 }
 
+// Perform the file actions requested by posix_spawn() on the file descriptors
+// of the new process.
+static int
+process_spawn_actions(struct Process *proc,
+                      const posix_spawn_file_actions_t *file_actions)
+{
+  const struct spawn_action *action;
+  struct File *f;
+  int i, r;
+
+  for (i = 0; i < file_actions->count; i++) {
+    action = &file_actions->actions[i];
+
+    if ((action->sa_fd < 0) || (action->sa_fd >= OPEN_MAX))
+      return -EBADF;
+
+    switch (action->sa_type) {
+    case SPAWN_ACTION_CLOSE:
+      f = NULL;
+      break;
+    case SPAWN_ACTION_OPEN:
+      if ((r = file_open(action->sa_path, action->sa_oflag, action->sa_mode,
+                         &f)) < 0)
+        return r;
+      break;
+    default:
+      return -EINVAL;
+    }
+
+    if (proc->files[action->sa_fd] != NULL)
+      file_close(proc->files[action->sa_fd]);
+    proc->files[action->sa_fd] = f;
+  }
+
+  return 0;
+}
+
+/**
+ * Create a child process executing a new program. The child gets a fresh
+ * address space built directly from the executable file, so the cost does not
+ * depend on the size of the parent, as it would with process_copy() followed
+ * by process_exec().
+ *
+ * @param path         The path name of the executable file.
+ * @param argv         The argument list.
+ * @param envp         The environment.
+ * @param file_actions The actions to perform on the inherited file descriptors
+ *                     (can be NULL). Path names must be in kernel memory.
+ *
+ * @return The process ID of the child, or a negative value on error.
+ */
+pid_t
+process_spawn(const char *path, char *const argv[], char *const envp[],
+              const posix_spawn_file_actions_t *file_actions)
+{
+  struct Process *child, *current = my_process();
+  int fd, r;
+
+  if ((child = process_alloc()) == NULL)
+    return -ENOMEM;
+
+  memset(child->tf, 0, sizeof(*child->tf));
+  child->tf->psr = PSR_M_USR | PSR_F;   // user mode, interrupts enabled
+
+  if ((r = process_load(child, path, argv, envp)) < 0) {
+    process_free(child);
+    return r;
+  }
+
+  child->parent = current;
+
+  for (fd = 0; fd < OPEN_MAX; fd++) {
+    child->files[fd] = current->files[fd] ? file_dup(current->files[fd]) : NULL;
+  }
+
+  child->uid   = current->uid;
+  child->gid   = current->gid;
+  child->cmask = current->cmask;
+  child->cwd   = fs_inode_dup(current->cwd);
+
+  if ((file_actions != NULL) &&
+      ((r = process_spawn_actions(child, file_actions)) < 0)) {
+    for (fd = 0; fd < OPEN_MAX; fd++) {
+      if (child->files[fd]) {
+        file_close(child->files[fd]);
+        child->files[fd] = NULL;
+      }
+    }
+
+    fs_inode_put(child->cwd);
+    vm_destroy(child->vm);
+    process_free(child);
+    return r;
+  }
+
+  spin_lock(&process_lock);
+  list_add_back(&current->children, &child->sibling);
+  spin_unlock(&process_lock);
+
+  task_enqueue(child->task);
+
+  return child->pid;
+}
+
 pid_t
 process_wait(pid_t pid, int *stat_loc, int options)
 {
@@ -417,6 +555,7 @@ process_run(void)
     first = 1;
 
     fs_init();
+    swap_init();
 
     if ((proc->cwd == NULL) && (fs_name_lookup("/", &proc->cwd) < 0))
       panic("root not found");
@@ -459,6 +598,10 @@ process_grow(ptrdiff_t increment)
     if ((n < o) || (n > (current->stack + PAGE_SIZE)))
       // Overflow
       return (void *) -1;
+    if (!vm_user_is_free(current->vm, ROUND_UP(o, PAGE_SIZE),
+                         ROUND_UP(n, PAGE_SIZE)))
+      // Collision with a memory mapping
+      return (void *) -1;
     if (vm_user_alloc(current->vm, (void *) ROUND_UP(o, PAGE_SIZE),
                         ROUND_UP(n, PAGE_SIZE) - ROUND_UP(o, PAGE_SIZE),
                         VM_READ | VM_WRITE | VM_USER) != 0)
@@ -6,6 +6,7 @@
 #include <cpu.h>
 #include <list.h>
 #include <mm/kobject.h>
+#include <mm/page.h>
 #include <mm/vm.h>
 #include <process.h>
 #include <sync.h>
@@ -26,7 +27,8 @@ void context_switch(struct Context **, struct Context *);
 void
 scheduler_init(void)
 {
-  task_pool = kobject_pool_create("task_pool", sizeof(struct Task), 0);
+  task_pool = kobject_pool_create("task_pool", sizeof(struct Task), 0,
+                                  NULL, NULL);
   if (task_pool == NULL)
     panic("cannot allocate task pool");
 
@@ -55,7 +57,8 @@ scheduler_start(void)
       next->state = TASK_RUNNING;
       my_cpu()->task = next;
 
-      if (next->process != NULL)
+      // An exiting process no longer has an address space.
+      if ((next->process != NULL) && (next->process->vm != NULL))
         vm_switch_user(next->process->vm);
 
       context_switch(&my_cpu()->scheduler, next->context);
@@ -69,7 +72,11 @@ scheduler_start(void)
 
     spin_unlock(&sched.lock);
 
-    wfi();
+    // Use the idle time to reclaim memory if it runs low, or to zero free
+    // pages in advance. Only one page is zeroed per iteration, so that newly
+    // runnable tasks don't have to wait long.
+    if (!page_reclaim_idle() && !page_zero_idle())
+      wfi();
   }
 }
 
@@ -77,6 +77,54 @@ spin_lock(struct SpinLock *lock)
   spin_save_caller_pcs(lock);
 }
 
+/**
+ * Try to acquire the spinlock without waiting.
+ *
+ * @param lock A pointer to the spinlock to be acquired.
+ * @return 1 if the spinlock has been acquired, 0 if it is held by another CPU
+ *         or by the current CPU.
+ */
+int
+spin_trylock(struct SpinLock *lock)
+{
+  int t1, t2;
+
+  irq_save();
+
+  if (spin_holding(lock)) {
+    irq_restore();
+    return 0;
+  }
+
+  asm volatile(
+    "\tmov     %2, #1\n"        // Load the "lock acquired" value
+    "\t1:\n"
+    "\tldrex   %1, [%0]\n"      // Read the lock field
+    "\tcmp     %1, #0\n"        // Is the lock free?
+    "\tbne     2f\n"            // No - give up
+    "\tstrex   %1, %2, [%0]\n"  // Try and acquire the lock
+    "\tcmp     %1, #0\n"        // Did this succeed?
+    "\tbne     1b\n"            // No - try again
+    "\tb       3f\n"
+    "\t2:\n"
+    "\tclrex\n"                 // Give up the exclusive access
+    "\t3:\n"
+    : "+r"(lock), "=r"(t1), "=r"(t2)
+    :
+    : "memory", "cc");
+
+  if (t1 != 0) {
+    irq_restore();
+    return 0;
+  }
+
+  // Record information about lock acquisition for debugging purposes.
+  lock->cpu = my_cpu();
+  spin_save_caller_pcs(lock);
+
+  return 1;
+}
+
 /**
  * Release the spinlock.
  * 
@@ -208,6 +256,27 @@ mutex_lock(struct Mutex *mutex)
   spin_unlock(&mutex->lock);
 }
 
+/**
+ * Try to acquire the mutex without sleeping.
+ * 
+ * @param lock A pointer to the mutex to be acquired.
+ * @return 1 if the mutex has been acquired, 0 if it is held by another task.
+ */
+int
+mutex_trylock(struct Mutex *mutex)
+{
+  int acquired;
+
+  spin_lock(&mutex->lock);
+
+  if ((acquired = (mutex->task == NULL)))
+    mutex->task = my_task();
+
+  spin_unlock(&mutex->lock);
+
+  return acquired;
+}
+
 /**
  * Release the mutex.
  * 
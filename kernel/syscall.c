@@ -1,9 +1,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <limits.h>
+#include <spawn.h>
 #include <stddef.h>
 #include <string.h>
 #include <syscall.h>
+#include <sys/meminfo.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/utsname.h>
 
@@ -12,6 +15,10 @@
 #include <drivers/rtc.h>
 #include <fs/file.h>
 #include <fs/fs.h>
+#include <mm/kmalloc.h>
+#include <mm/page.h>
+#include <mm/swap.h>
+#include <mm/uaccess.h>
 #include <mm/vm.h>
 #include <process.h>
 #include <types.h>
@@ -19,6 +26,9 @@
 
 #include <sys.h>
 
+/** The maximum number of bytes transferred via a kernel buffer at a time. */
+#define SYS_BUF_SIZE  PAGE_SIZE
+
 static int     sys_get_num(void);
 static int32_t sys_get_arg(int);
 
@@ -46,6 +56,11 @@ static int32_t (*syscalls[])(void) = {
   [__SYS_SBRK]     = sys_sbrk,
   [__SYS_UNAME]    = sys_uname,
   [__SYS_CHMOD]    = sys_chmod,
+  [__SYS_MEMINFO]  = sys_meminfo,
+  [__SYS_MMAP]     = sys_mmap,
+  [__SYS_MUNMAP]   = sys_munmap,
+  [__SYS_MSYNC]    = sys_msync,
+  [__SYS_SPAWN]    = sys_spawn,
 };
 
 int32_t
@@ -74,16 +89,18 @@ static int
 sys_get_num(void)
 {
   struct Process *current = my_process();
-  int *pc = (int *) (current->tf->pc - 4);
+  uint32_t insn;
   int r;
 
-  if ((r = vm_user_check_buf(current->vm, pc, sizeof(int), VM_READ)) < 0)
+  if ((r = copy_from_user(&insn, (void *) (current->tf->pc - 4),
+                          sizeof(insn))) < 0)
     return r;
 
-  return *pc & 0xFFFFFF;
+  return insn & 0xFFFFFF;
 }
 
-// Get the n-th argument from the current process' trap frame.
+// Get the n-th argument from the current process' trap frame. System calls
+// take up to six arguments passed in R0-R5 (see __syscall6).
 static int32_t
 sys_get_arg(int n)
 {
@@ -98,11 +115,12 @@ sys_get_arg(int n)
     return current->tf->r2;
   case 3:
     return current->tf->r3;
+  case 4:
+    return current->tf->r4;
+  case 5:
+    return current->tf->r5;
   default:
-    if (n < 0)
-      panic("Invalid argument number: %d", n);
-
-    // TODO: grab additional parameters from the user's stack.
+    panic("Invalid argument number: %d", n);
     return 0;
   }
 }
@@ -147,53 +165,56 @@ sys_arg_long(int n, long *ip)
 }
 
 /**
- * Fetch the nth system call argument as pointer to a buffer of the specified
- * length. Check that the pointer is valid and the user has right permissions.
+ * Fetch the nth system call argument as a pointer to user memory. The pointer
+ * is not checked; the memory must be accessed only via copy_from_user() and
+ * copy_to_user() which return -EFAULT for invalid addresses.
  * 
- * @param n    The argument number.
- * @param pp   Pointer to the memory address to store the argument value.
- * @param len  The length of the memory region pointed to.
- * @param perm The permissions to be checked.
+ * @param n  The argument number.
+ * @param pp Pointer to the memory address to store the argument value.
  * 
  * @retval 0 on success.
- * @retval -EFAULT if the arguments doesn't point to a valid memory region.
  */
 static int32_t
-sys_arg_buf(int n, void **pp, size_t len, int perm)
+sys_arg_ptr(int n, void **pp)
 { 
-  void *ptr = (void *) sys_get_arg(n);
-  int r;
-
-  if ((r = vm_user_check_buf(my_process()->vm, ptr, len, perm)) < 0)
-    return r;
-
-  *pp = ptr;
-
+  *pp = (void *) sys_get_arg(n);
   return 0;
 }
 
 /**
- * Fetch the nth system call argument as a string pointer. Check that the
- * pointer is valid, the user has right permissions and the string is
- * null-terminated.
+ * Fetch the nth system call argument as a path name and copy it into a newly
+ * allocated kernel buffer. The caller is responsible for freeing the buffer
+ * with kfree().
  * 
- * @param n    The argument number.
- * @param strp Pointer to the memory address to store the argument value.
- * @param perm The permissions to be checked.
+ * @param n     The argument number.
+ * @param pathp Pointer to the memory address to store the kernel copy.
  * 
  * @retval 0 on success.
  * @retval -EFAULT if the arguments doesn't point to a valid string.
+ * @retval -ENAMETOOLONG if the string is longer than PATH_MAX.
+ * @retval -ENOMEM if out of memory.
  */
 static int32_t
-sys_arg_str(int n, const char **strp, int perm)
+sys_arg_path(int n, char **pathp)
 {
-  char *str = (char *) sys_get_arg(n);
-  int r;
+  const char *upath = (const char *) sys_get_arg(n);
+  char *path;
+  ssize_t r;
+
+  if ((path = (char *) kmalloc(PATH_MAX, 0)) == NULL)
+    return -ENOMEM;
 
-  if ((r = vm_user_check_str(my_process()->vm, str, perm)) < 0)
+  if ((r = strncpy_from_user(path, upath, PATH_MAX)) < 0) {
+    kfree(path);
     return r;
+  }
 
-  *strp = str;
+  if (r == PATH_MAX) {
+    kfree(path);
+    return -ENAMETOOLONG;
+  }
+
+  *pathp = path;
 
   return 0;
 }
@@ -227,33 +248,179 @@ sys_arg_fd(int n, int *fdstore, struct File **fstore)
   return 0;
 }
 
+/**
+ * Fetch the nth system call argument as a null-terminated array of string
+ * pointers (such as argv or envp) and copy the strings into a newly allocated
+ * kernel buffer of ARG_MAX bytes, followed by the array of pointers to the
+ * copies. The caller is responsible for freeing the buffer with kfree().
+ * 
+ * @param n     The argument number.
+ * @param bufp  Pointer to the memory address to store the kernel buffer.
+ * @param store Pointer to the memory address to store the array.
+ * 
+ * @retval 0 on success.
+ * @retval -EFAULT if the argument doesn't point to a valid array.
+ * @retval -E2BIG if the strings don't fit into ARG_MAX bytes.
+ * @retval -ENOMEM if out of memory.
+ */
 static int
-sys_arg_args(int n, char ***store)
+sys_arg_args(int n, char **bufp, char ***store)
 {
-  struct Process *current = my_process();
-  char **args;
-  int i;
+  char **uargs, *uarg, **args;
+  char *buf, *p, *end;
+  ssize_t len;
+  int i, j, r;
 
-  args = (char **) sys_get_arg(n);
-  
-  for (i = 0; ; i++) {
-    int r;
+  uargs = (char **) sys_get_arg(n);
 
-    if ((r = vm_user_check_buf(current->vm, args + i, sizeof(args[i]),
-                               VM_READ)) < 0)
-      return r;
+  if ((buf = (char *) kmalloc(ARG_MAX, 0)) == NULL)
+    return -ENOMEM;
 
-    if (args[i] == NULL)
+  end = buf + ARG_MAX;
+
+  // Copy the strings one after another.
+  for (i = 0, p = buf; ; i++) {
+    if ((r = copy_from_user(&uarg, &uargs[i], sizeof(uarg))) < 0)
+      goto fail;
+
+    if (uarg == NULL)
       break;
-    
-    if ((r = vm_user_check_str(current->vm, args[i], VM_READ)) < 0)
-      return r;
+
+    if ((len = strncpy_from_user(p, uarg, end - p)) < 0) {
+      r = len;
+      goto fail;
+    }
+
+    if (len == end - p) {
+      r = -E2BIG;
+      goto fail;
+    }
+
+    p += len + 1;
+  }
+
+  // Build the array of pointers to the copies.
+  args = (char **) ROUND_UP((uintptr_t) p, sizeof(char *));
+  if ((char *) &args[i + 1] > end) {
+    r = -E2BIG;
+    goto fail;
+  }
+
+  for (j = 0, p = buf; j < i; j++) {
+    args[j] = p;
+    p += strlen(p) + 1;
+  }
+  args[i] = NULL;
+
+  *bufp  = buf;
+  *store = args;
+
+  return 0;
+
+fail:
+  kfree(buf);
+  return r;
+}
+
+// Free the list of file actions copied by sys_arg_file_actions().
+static void
+sys_free_file_actions(posix_spawn_file_actions_t *file_actions)
+{
+  int i;
+
+  if (file_actions == NULL)
+    return;
+
+  for (i = 0; i < file_actions->count; i++)
+    if (file_actions->actions[i].sa_path != NULL)
+      kfree((void *) file_actions->actions[i].sa_path);
+
+  kfree(file_actions);
+}
+
+/**
+ * Fetch the nth system call argument as a pointer to a list of posix_spawn()
+ * file actions, and copy the list and the path names it refers to into kernel
+ * memory. The caller is responsible for freeing the copy with
+ * sys_free_file_actions().
+ *
+ * @param n     The argument number.
+ * @param store Pointer to the memory address to store the copy (NULL if the
+ *              argument is NULL).
+ *
+ * @retval 0 on success.
+ * @retval -EFAULT if the argument doesn't point to a valid list.
+ * @retval -EINVAL if the list is invalid.
+ * @retval -ENAMETOOLONG if a path name is longer than PATH_MAX.
+ * @retval -ENOMEM if out of memory.
+ */
+static int
+sys_arg_file_actions(int n, posix_spawn_file_actions_t **store)
+{
+  posix_spawn_file_actions_t *file_actions;
+  struct spawn_action *action;
+  const char *upath;
+  char *path;
+  ssize_t len;
+  int i, r;
+
+  if ((void *) sys_get_arg(n) == NULL) {
+    *store = NULL;
+    return 0;
+  }
+
+  if ((file_actions = kmalloc(sizeof(*file_actions), 0)) == NULL)
+    return -ENOMEM;
+
+  if ((r = copy_from_user(file_actions, (void *) sys_get_arg(n),
+                          sizeof(*file_actions))) < 0) {
+    kfree(file_actions);
+    return r;
+  }
+
+  if ((file_actions->count < 0) ||
+      (file_actions->count > SPAWN_ACTIONS_MAX)) {
+    kfree(file_actions);
+    return -EINVAL;
   }
 
-  if (store)
-    *store = args;
+  // Replace the user path names with kernel copies.
+  for (i = 0; i < file_actions->count; i++) {
+    action = &file_actions->actions[i];
+
+    upath = action->sa_path;
+    action->sa_path = NULL;
+
+    if (action->sa_type != SPAWN_ACTION_OPEN)
+      continue;
+
+    if ((path = (char *) kmalloc(PATH_MAX, 0)) == NULL) {
+      r = -ENOMEM;
+      goto fail;
+    }
+
+    action->sa_path = path;
+
+    if ((len = strncpy_from_user(path, upath, PATH_MAX)) < 0) {
+      r = len;
+      goto fail;
+    }
+
+    if (len == PATH_MAX) {
+      r = -ENAMETOOLONG;
+      goto fail;
+    }
+  }
+
+  *store = file_actions;
 
   return 0;
+
+fail:
+  // Only the path names copied so far are not NULL.
+  file_actions->count = i + 1;
+  sys_free_file_actions(file_actions);
+  return r;
 }
 
 /*
@@ -271,34 +438,77 @@ sys_fork(void)
 int32_t
 sys_exec(void)
 {
-  const char *path;
+  char *path, *argv_buf, *envp_buf;
   char **argv, **envp;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
-    return r;
-  if ((r = sys_arg_args(1, &argv)) < 0)
-    return r;
-  if ((r = sys_arg_args(2, &envp)) < 0)
+  if ((r = sys_arg_path(0, &path)) < 0)
     return r;
+  if ((r = sys_arg_args(1, &argv_buf, &argv)) < 0)
+    goto out1;
+  if ((r = sys_arg_args(2, &envp_buf, &envp)) < 0)
+    goto out2;
+
+  r = process_exec(path, argv, envp);
+
+  kfree(envp_buf);
+out2:
+  kfree(argv_buf);
+out1:
+  kfree(path);
+  return r;
+}
 
-  return process_exec(path, argv, envp);
+int32_t
+sys_spawn(void)
+{
+  posix_spawn_file_actions_t *file_actions;
+  char *path, *argv_buf, *envp_buf;
+  char **argv, **envp;
+  int r;
+
+  if ((r = sys_arg_path(0, &path)) < 0)
+    return r;
+  if ((r = sys_arg_args(1, &argv_buf, &argv)) < 0)
+    goto out1;
+  if ((r = sys_arg_args(2, &envp_buf, &envp)) < 0)
+    goto out2;
+  if ((r = sys_arg_file_actions(3, &file_actions)) < 0)
+    goto out3;
+
+  r = process_spawn(path, argv, envp, file_actions);
+
+  sys_free_file_actions(file_actions);
+out3:
+  kfree(envp_buf);
+out2:
+  kfree(argv_buf);
+out1:
+  kfree(path);
+  return r;
 }
 
 int32_t
 sys_wait(void)
 {
   pid_t pid;
-  int *stat_loc;
+  int *stat_loc, status;
   int r;
   
   if ((r = sys_arg_int(0, &pid)) < 0)
     return r;
 
-  if ((r = sys_arg_buf(1, (void **) &stat_loc, sizeof(int), VM_WRITE)) < 0)
+  if ((r = sys_arg_ptr(1, (void **) &stat_loc)) < 0)
+    return r;
+
+  if ((pid = process_wait(pid, &status, 0)) < 0)
+    return pid;
+
+  if ((stat_loc != NULL) &&
+      ((r = copy_to_user(stat_loc, &status, sizeof(status))) < 0))
     return r;
 
-  return process_wait(pid, stat_loc, 0);
+  return pid;
 }
 
 int32_t
@@ -335,7 +545,7 @@ sys_time(void)
 int32_t
 sys_getdents(void)
 {
-  void *buf;
+  void *buf, *kbuf;
   size_t n;
   struct File *f;
   int r;
@@ -346,23 +556,41 @@ sys_getdents(void)
   if ((r = sys_arg_int(2, (int *) &n)) < 0)
     return r;
 
-  if ((r = sys_arg_buf(1, &buf, n, VM_READ)) < 0)
+  if ((r = sys_arg_ptr(1, &buf)) < 0)
     return r;
 
-  return file_getdents(f, buf, n);
+  // Entries are never split, so a shorter read is not a problem.
+  n = MIN(n, SYS_BUF_SIZE);
+  if (n == 0)
+    return 0;
+
+  if ((kbuf = kmalloc(n, 0)) == NULL)
+    return -ENOMEM;
+
+  if (((r = file_getdents(f, kbuf, n)) > 0) &&
+      (copy_to_user(buf, kbuf, r) < 0))
+    r = -EFAULT;
+
+  kfree(kbuf);
+
+  return r;
 }
 
 int32_t
 sys_chdir(void)
 {
-  const char *path;
+  char *path;
   struct Inode *ip;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
+  if ((r = sys_arg_path(0, &path)) < 0)
     return r;
   
-  if ((r = fs_name_lookup(path, &ip)) < 0)
+  r = fs_name_lookup(path, &ip);
+
+  kfree(path);
+
+  if (r < 0)
     return r;
   
   return fs_chdir(ip);
@@ -371,17 +599,21 @@ sys_chdir(void)
 int32_t
 sys_chmod(void)
 {
-  const char *path;
+  char *path;
   mode_t mode;
   struct Inode *ip;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
-    return r;
   if ((r = sys_arg_short(1, (short *) &mode)) < 0)
     return r;
+  if ((r = sys_arg_path(0, &path)) < 0)
+    return r;
 
-  if ((r = fs_name_lookup(path, &ip)) < 0)
+  r = fs_name_lookup(path, &ip);
+
+  kfree(path);
+
+  if (r < 0)
     return r;
 
   r = fs_chmod(ip, mode);
@@ -424,18 +656,22 @@ int32_t
 sys_open(void)
 {
   struct File *f;
-  const char *path;
+  char *path;
   int oflag, r;
   mode_t mode;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
-    return r;
   if ((r = sys_arg_int(1, &oflag)) < 0)
     return r;
   if ((r = sys_arg_short(2, (short *) &mode)) < 0)
     return r;
+  if ((r = sys_arg_path(0, &path)) < 0)
+    return r;
+
+  r = file_open(path, oflag, mode, &f);
+
+  kfree(path);
 
-  if ((r = file_open(path, oflag, mode, &f)) < 0)
+  if (r < 0)
     return r;
 
   if ((r = fd_alloc(f)) < 0)
@@ -463,73 +699,95 @@ sys_umask(void)
 int32_t
 sys_link(void)
 {
-  const char *path1, *path2;
+  char *path1, *path2;
   int r;
 
-  if ((r = sys_arg_str(0, &path1, VM_READ)) < 0)
+  if ((r = sys_arg_path(0, &path1)) < 0)
     return r;
-  if ((r = sys_arg_str(1, &path2, VM_READ)) < 0)
+  if ((r = sys_arg_path(1, &path2)) < 0) {
+    kfree(path1);
     return r;
+  }
+
+  r = fs_link(path1, path2);
+
+  kfree(path2);
+  kfree(path1);
 
-  return fs_link((char *) path1, (char *) path2);
+  return r;
 }
 
 int32_t
 sys_mknod(void)
 {
-  const char *path;
+  char *path;
   mode_t mode;
   dev_t dev;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
-    return r;
   if ((r = sys_arg_short(1, (short *) &mode)) < 0)
     return r;
   if ((r = sys_arg_short(2, &dev)) < 0)
     return r;
+  if ((r = sys_arg_path(0, &path)) < 0)
+    return r;
+
+  r = fs_create(path, mode, dev, NULL);
 
-  return fs_create(path, mode, dev, NULL);
+  kfree(path);
+
+  return r;
 }
 
 int32_t
 sys_unlink(void)
 {
-  const char *path;
+  char *path;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
+  if ((r = sys_arg_path(0, &path)) < 0)
     return r;
 
-  return fs_unlink(path);
+  r = fs_unlink(path);
+
+  kfree(path);
+
+  return r;
 }
 
 int32_t
 sys_rmdir(void)
 {
-  const char *path;
+  char *path;
   int r;
 
-  if ((r = sys_arg_str(0, &path, VM_READ)) < 0)
+  if ((r = sys_arg_path(0, &path)) < 0)
     return r;
 
-  return fs_rmdir(path);
+  r = fs_rmdir(path);
+
+  kfree(path);
+
+  return r;
 }
 
 int32_t
 sys_stat(void)
 {
   struct File *f;
-  struct stat *buf;
+  struct stat *buf, st;
   int r;
 
   if ((r = sys_arg_fd(0, NULL, &f)) < 0)
     return r;
 
-  if ((r = sys_arg_buf(1, (void **) &buf, sizeof(*buf), VM_WRITE)) < 0)
+  if ((r = sys_arg_ptr(1, (void **) &buf)) < 0)
+    return r;
+
+  if ((r = file_stat(f, &st)) < 0)
     return r;
 
-  return file_stat(f, buf);
+  return copy_to_user(buf, &st, sizeof(st));
 }
 
 int32_t
@@ -550,10 +808,10 @@ sys_close(void)
 int32_t
 sys_read(void)
 {
-  void *buf;
-  size_t n;
+  char *buf, *kbuf;
+  size_t n, total, chunk;
   struct File *f;
-  int r;
+  ssize_t r;
 
   if ((r = sys_arg_fd(0, NULL, &f)) < 0)
     return r;
@@ -561,19 +819,47 @@ sys_read(void)
   if ((r = sys_arg_int(2, (int *) &n)) < 0)
     return r;
 
-  if ((r = sys_arg_buf(1, &buf, n, VM_READ)) < 0)
+  if ((r = sys_arg_ptr(1, (void **) &buf)) < 0)
     return r;
 
-  return file_read(f, buf, n);
+  if (n == 0)
+    return 0;
+
+  if ((kbuf = kmalloc(MIN(n, SYS_BUF_SIZE), 0)) == NULL)
+    return -ENOMEM;
+
+  // Read the data into a kernel buffer, chunk by chunk, and copy each chunk
+  // to the user buffer. Stop after the first short read.
+  for (total = 0; total < n; total += r) {
+    chunk = MIN(n - total, SYS_BUF_SIZE);
+
+    if ((r = file_read(f, kbuf, chunk)) <= 0)
+      break;
+
+    if (copy_to_user(buf + total, kbuf, r) < 0) {
+      r = -EFAULT;
+      break;
+    }
+
+    if ((size_t) r < chunk) {
+      total += r;
+      break;
+    }
+  }
+
+  kfree(kbuf);
+
+  return (total > 0) ? (ssize_t) total : r;
 }
 
 int32_t
 sys_write(void)
 {
-  void *buf;
-  size_t n;
+  const char *buf;
+  char *kbuf;
+  size_t n, total, chunk;
   struct File *f;
-  int r;
+  ssize_t r;
 
   if ((r = sys_arg_fd(0, NULL, &f)) < 0)
     return r;
@@ -581,10 +867,37 @@ sys_write(void)
   if ((r = sys_arg_int(2, (int *) &n)) < 0)
     return r;
 
-  if ((r = sys_arg_buf(1, &buf, n, VM_WRITE)) < 0)
+  if ((r = sys_arg_ptr(1, (void **) &buf)) < 0)
     return r;
 
-  return file_write(f, buf, n);
+  if (n == 0)
+    return 0;
+
+  if ((kbuf = kmalloc(MIN(n, SYS_BUF_SIZE), 0)) == NULL)
+    return -ENOMEM;
+
+  // Copy the data from the user buffer into a kernel buffer, chunk by chunk,
+  // and write each chunk. Stop after the first short write.
+  for (total = 0; total < n; total += r) {
+    chunk = MIN(n - total, SYS_BUF_SIZE);
+
+    if (copy_from_user(kbuf, buf + total, chunk) < 0) {
+      r = -EFAULT;
+      break;
+    }
+
+    if ((r = file_write(f, kbuf, chunk)) <= 0)
+      break;
+
+    if ((size_t) r < chunk) {
+      total += r;
+      break;
+    }
+  }
+
+  kfree(kbuf);
+
+  return (total > 0) ? (ssize_t) total : r;
 }
 
 int32_t
@@ -607,10 +920,163 @@ sys_uname(void)
   struct utsname *name;
   int r;
 
-  if ((r = sys_arg_buf(0, (void **) &name, sizeof(*name), VM_WRITE)) < 0)
+  if ((r = sys_arg_ptr(0, (void **) &name)) < 0)
     return r;
   
-  memcpy(name, &utsname, sizeof (*name));
+  return copy_to_user(name, &utsname, sizeof(*name));
+}
 
-  return 0;
+int32_t
+sys_meminfo(void)
+{
+  struct meminfo *info, kinfo;
+  int r;
+
+  if ((r = sys_arg_ptr(0, (void **) &info)) < 0)
+    return r;
+
+  page_stats(&kinfo);
+  swap_stats(&kinfo);
+
+  return copy_to_user(info, &kinfo, sizeof(kinfo));
+}
+
+int32_t
+sys_mmap(void)
+{
+  struct Process *current = my_process();
+  struct Inode *ip;
+  struct File *f;
+  uintptr_t va;
+  size_t n, file_size;
+  int prot, flags, vm_prot, r;
+  off_t off;
+
+  if ((r = sys_arg_ptr(0, (void **) &va)) < 0)
+    return r;
+  if ((r = sys_arg_int(1, (int *) &n)) < 0)
+    return r;
+  if ((r = sys_arg_int(2, &prot)) < 0)
+    return r;
+  if ((r = sys_arg_int(3, &flags)) < 0)
+    return r;
+  if ((r = sys_arg_long(5, (long *) &off)) < 0)
+    return r;
+
+  // The offset is passed as a signed long, reject negative values.
+  if ((n == 0) || (n > KERNEL_BASE) || ((long) off < 0) ||
+      (off % PAGE_SIZE != 0))
+    return -EINVAL;
+  if (!(flags & MAP_SHARED) == !(flags & MAP_PRIVATE))
+    return -EINVAL;
+  // Pages are shared only through the file page cache, so there is nothing
+  // to share anonymous pages first touched after fork through.
+  if ((flags & MAP_SHARED) && (flags & MAP_ANONYMOUS))
+    return -EINVAL;
+  if (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC))
+    return -EINVAL;
+
+  n = ROUND_UP(n, PAGE_SIZE);
+
+  // Pages cannot be writeable or executable without being readable.
+  vm_prot = VM_USER;
+  if (prot != PROT_NONE)
+    vm_prot |= VM_READ;
+  if (prot & PROT_WRITE)
+    vm_prot |= VM_WRITE;
+  if (prot & PROT_EXEC)
+    vm_prot |= VM_EXEC;
+  if (flags & MAP_SHARED)
+    vm_prot |= VM_SHARED;
+
+  ip = NULL;
+  file_size = 0;
+
+  if (!(flags & MAP_ANONYMOUS)) {
+    if ((r = sys_arg_fd(4, NULL, &f)) < 0)
+      return r;
+
+    if ((f->type != FD_INODE) || !f->readable)
+      return -EACCESS;
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writeable)
+      return -EACCESS;
+
+    ip = f->inode;
+
+    fs_inode_lock(ip);
+
+    if (S_ISREG(ip->mode))
+      file_size = (off < ip->size) ? MIN(n, ip->size - off) : 0;
+    else
+      r = -ENODEV;
+
+    fs_inode_unlock(ip);
+
+    if (r < 0)
+      return r;
+  }
+
+  if (flags & MAP_FIXED) {
+    if ((va % PAGE_SIZE != 0) || (va > KERNEL_BASE - n))
+      return -EINVAL;
+  } else {
+    // The address is only a hint, place the mapping below the stack.
+    va = vm_user_find_free(current->vm, n, current->heap, UMMAP_TOP);
+    if (va == 0)
+      return -ENOMEM;
+  }
+
+  if (ip != NULL)
+    r = vm_user_map_file(current->vm, (void *) va, n, vm_prot, ip, off,
+                         file_size);
+  else
+    r = vm_user_alloc(current->vm, (void *) va, n, vm_prot);
+
+  if (r < 0)
+    return r;
+
+  return va;
+}
+
+int32_t
+sys_munmap(void)
+{
+  uintptr_t va;
+  size_t n;
+  int r;
+
+  if ((r = sys_arg_ptr(0, (void **) &va)) < 0)
+    return r;
+  if ((r = sys_arg_int(1, (int *) &n)) < 0)
+    return r;
+
+  if ((n == 0) || (va % PAGE_SIZE != 0) || (n > KERNEL_BASE) ||
+      (va > KERNEL_BASE - n))
+    return -EINVAL;
+
+  return vm_user_dealloc(my_process()->vm, (void *) va, n);
+}
+
+int32_t
+sys_msync(void)
+{
+  uintptr_t va;
+  size_t n;
+  int flags, r;
+
+  if ((r = sys_arg_ptr(0, (void **) &va)) < 0)
+    return r;
+  if ((r = sys_arg_int(1, (int *) &n)) < 0)
+    return r;
+  if ((r = sys_arg_int(2, &flags)) < 0)
+    return r;
+
+  if ((va % PAGE_SIZE != 0) ||
+      (flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) ||
+      ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+    return -EINVAL;
+
+  // Writes are always synchronous, and the cached pages are always up to
+  // date, so MS_ASYNC and MS_INVALIDATE need no special handling.
+  return vm_user_sync(my_process()->vm, (void *) va, n);
 }
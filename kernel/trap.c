@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <errno.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -6,12 +7,14 @@
 #include <cprintf.h>
 #include <cpu.h>
 #include <drivers/console.h>
+#include <drivers/dma.h>
 #include <drivers/eth.h>
 #include <drivers/gic.h>
 #include <drivers/kbd.h>
 #include <drivers/sd.h>
 #include <drivers/uart.h>
 #include <mm/page.h>
+#include <mm/uaccess.h>
 #include <mm/vm.h>
 #include <process.h>
 #include <sys.h>
@@ -56,55 +59,87 @@ trap(struct TrapFrame *tf)
   }
 }
 
+// Find the fixup address for an instruction that is allowed to fault in
+// kernel mode, or return 0 if there is no such address.
+static uintptr_t
+trap_fixup_lookup(uintptr_t pc)
+{
+  extern struct ExTableEntry __ex_table_begin__[], __ex_table_end__[];
+  struct ExTableEntry *entry;
+
+  for (entry = __ex_table_begin__; entry < __ex_table_end__; entry++)
+    if (entry->insn == pc)
+      return entry->fixup;
+
+  return 0;
+}
+
+// Handle a fault at the given user address, expanding the stack if necessary.
+static int
+trap_user_fault(struct Process *process, uintptr_t address, int access)
+{
+  if (vm_handle_fault(process->vm, address, access) == 0)
+    return 0;
+
+  if ((address < process->stack) &&
+      (address >= (process->stack - PAGE_SIZE)) &&
+      (address >= (USTACK_TOP - USTACK_LIMIT)) &&
+      (process->heap < (process->stack - PAGE_SIZE)) &&
+      vm_user_is_free(process->vm, process->stack - PAGE_SIZE,
+                      process->stack)) {
+    // Expand stack
+    if (vm_user_alloc(process->vm, (void *) (process->stack - PAGE_SIZE),
+        PAGE_SIZE, VM_READ | VM_WRITE | VM_USER) == 0) {
+      process->stack -= PAGE_SIZE;
+
+      return vm_handle_fault(process->vm, address, access);
+    }
+  }
+
+  return -EFAULT;
+}
+
 static void
 trap_handle_abort(struct TrapFrame *tf)
 {
   uint32_t address, status;
-  struct Page *fault_page, *page;
   struct Process *process;
-  l2_desc_t *pte;
+  uintptr_t fixup;
+  int access;
 
   // Read the contents of the corresponsing Fault Address Register (FAR) and 
   // the Fault Status Register (FSR).
   address = tf->trapno == T_DABT ? cp15_dfar_get() : cp15_ifar_get();
-  status  = tf->trapno == T_DABT ? cp15_ifsr_get() : cp15_ifsr_get();
+  status  = tf->trapno == T_DABT ? cp15_dfsr_get() : cp15_ifsr_get();
 
-  // If abort happened in kernel mode, print the trap frame and call panic()
-  if ((tf->psr & PSR_M_MASK) != PSR_M_USR) {
-    print_trapframe(tf);
-    panic("kernel fault va %p status %#x", address, status);
-  }
+  // For data aborts, the WnR bit tells whether the access was a write.
+  if (tf->trapno == T_PABT)
+    access = VM_EXEC;
+  else
+    access = (status & DFSR_WNR) ? VM_WRITE : VM_READ;
 
   process = my_process();
-  assert(process != NULL);
 
-  fault_page = vm_lookup_page(process->vm->trtab, (void *) address, &pte);
-
-  if (fault_page == NULL) {
-    if ((address < process->stack) &&
-        (address >= (process->stack - PAGE_SIZE)) &&
-        (process->heap < (process->stack - PAGE_SIZE))) {
-      // Expand stack
-      if (vm_user_alloc(process->vm, (void *) (process->stack - PAGE_SIZE),
-          PAGE_SIZE, VM_WRITE | VM_USER) == 0) {
-        process->stack -= PAGE_SIZE;
-        return;
-      }
+  if ((tf->psr & PSR_M_MASK) != PSR_M_USR) {
+    // In kernel mode, only the routines accessing user memory may fault. Page
+    // in the user page and retry the access, or make the routine return an
+    // error if the address is invalid.
+    if ((tf->trapno == T_DABT) && ((fixup = trap_fixup_lookup(tf->pc)) != 0)) {
+      if ((process == NULL) ||
+          (trap_user_fault(process, address, access) != 0))
+        tf->pc = fixup;
+      return;
     }
-  } else {
-    int prot;
 
-    prot = vm_L2_DESC_get_flags(pte);
-    if ((prot & VM_COW) && ((page = page_alloc_one(0)) != NULL)) {
-      memcpy(page2kva(page), page2kva(fault_page), PAGE_SIZE);
+    // Otherwise, print the trap frame and call panic()
+    print_trapframe(tf);
+    panic("kernel fault va %p status %#x", address, status);
+  }
 
-      prot &= ~VM_COW;
-      prot |= VM_WRITE;
+  assert(process != NULL);
 
-      if (vm_insert_page(process->vm->trtab, page, (void *) address, prot) == 0)
-        return;
-    }
-  }
+  if (trap_user_fault(process, address, access) == 0)
+    return;
 
   // Abort happened in user mode.
   cprintf("user fault va %p status %#x\n", address, status);
@@ -141,6 +176,9 @@ trap_irq_dispatch(void)
   case IRQ_MCIA:
     sd_intr();
     break;
+  case IRQ_DMA:
+    dma_intr();
+    break;
   case IRQ_ETH:
     eth_intr();
     break;
@@ -63,6 +63,16 @@ LIB_SRCFILES += \
 	lib/setjmp/longjmp.S \
 	lib/setjmp/setjmp.S
 
+LIB_SRCFILES += \
+	lib/spawn/posix_spawn.c \
+	lib/spawn/posix_spawn_file_actions_addclose.c \
+	lib/spawn/posix_spawn_file_actions_addopen.c \
+	lib/spawn/posix_spawn_file_actions_destroy.c \
+	lib/spawn/posix_spawn_file_actions_init.c \
+	lib/spawn/posix_spawnattr_destroy.c \
+	lib/spawn/posix_spawnattr_init.c \
+	lib/spawn/posix_spawnp.c
+
 LIB_SRCFILES += \
 	lib/stdio/__files.c \
   lib/stdio/__printf.c \
@@ -132,6 +142,14 @@ LIB_SRCFILES += \
 	lib/sys/stat/stat.c \
 	lib/sys/stat/umask.c
 
+LIB_SRCFILES += \
+	lib/sys/meminfo/meminfo.c
+
+LIB_SRCFILES += \
+	lib/sys/mman/mmap.c \
+	lib/sys/mman/msync.c \
+	lib/sys/mman/munmap.c
+
 LIB_SRCFILES += \
 	lib/sys/utsname/uname.c
 
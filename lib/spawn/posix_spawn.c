@@ -0,0 +1,40 @@
+#include <errno.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <syscall.h>
+
+/**
+ * Create a new process executing the file. Unlike fork() followed by exec(),
+ * the address space of the calling process is not copied.
+ * 
+ * @param pid          Pointer to the memory location to store the process ID
+ *                     of the child (can be NULL).
+ * @param path         The path name of the file to execute.
+ * @param file_actions The file actions to perform in the child (can be NULL).
+ * @param attrp        The spawn attributes (can be NULL).
+ * @param argv         The argument list for the new process.
+ * @param envp         The environment for the new process.
+ * 
+ * @returns 0 on success, or an error number otherwise.
+ */
+int
+posix_spawn(pid_t *pid, const char *path,
+            const posix_spawn_file_actions_t *file_actions,
+            const posix_spawnattr_t *attrp,
+            char *const argv[], char *const envp[])
+{
+  int32_t r;
+
+  if ((attrp != NULL) && (attrp->flags != 0))
+    return EINVAL;
+
+  r = __syscall6(__SYS_SPAWN, (uint32_t) path, (uint32_t) argv,
+                 (uint32_t) envp, (uint32_t) file_actions, 0, 0);
+  if (r < 0)
+    return errno;
+
+  if (pid != NULL)
+    *pid = r;
+
+  return 0;
+}
@@ -0,0 +1,31 @@
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+
+/**
+ * Add an action to close a file descriptor in the new process.
+ * 
+ * @param file_actions The list of file actions.
+ * @param fd           The file descriptor to close.
+ * 
+ * @returns 0 on success, EBADF if the file descriptor is invalid, or ENOMEM
+ *          if there are too many actions.
+ */
+int
+posix_spawn_file_actions_addclose(posix_spawn_file_actions_t *file_actions,
+                                  int fd)
+{
+  struct spawn_action *action;
+
+  if ((fd < 0) || (fd >= OPEN_MAX))
+    return EBADF;
+
+  if (file_actions->count >= SPAWN_ACTIONS_MAX)
+    return ENOMEM;
+
+  action = &file_actions->actions[file_actions->count++];
+  action->sa_type = SPAWN_ACTION_CLOSE;
+  action->sa_fd   = fd;
+
+  return 0;
+}
@@ -0,0 +1,40 @@
+#include <errno.h>
+#include <limits.h>
+#include <spawn.h>
+
+/**
+ * Add an action to open a file at the given file descriptor in the new
+ * process. The path name is not copied, so it must remain valid until
+ * posix_spawn() is called.
+ * 
+ * @param file_actions The list of file actions.
+ * @param fd           The file descriptor to open the file at.
+ * @param path         The path name of the file.
+ * @param oflag        Flags for open().
+ * @param mode         Mode for open().
+ * 
+ * @returns 0 on success, EBADF if the file descriptor is invalid, or ENOMEM
+ *          if there are too many actions.
+ */
+int
+posix_spawn_file_actions_addopen(posix_spawn_file_actions_t *file_actions,
+                                 int fd, const char *path, int oflag,
+                                 mode_t mode)
+{
+  struct spawn_action *action;
+
+  if ((fd < 0) || (fd >= OPEN_MAX))
+    return EBADF;
+
+  if (file_actions->count >= SPAWN_ACTIONS_MAX)
+    return ENOMEM;
+
+  action = &file_actions->actions[file_actions->count++];
+  action->sa_type  = SPAWN_ACTION_OPEN;
+  action->sa_fd    = fd;
+  action->sa_oflag = oflag;
+  action->sa_mode  = mode;
+  action->sa_path  = path;
+
+  return 0;
+}
@@ -0,0 +1,13 @@
+#include <spawn.h>
+
+/**
+ * Initialize an empty list of file actions.
+ * 
+ * @returns 0 on success.
+ */
+int
+posix_spawn_file_actions_init(posix_spawn_file_actions_t *file_actions)
+{
+  file_actions->count = 0;
+  return 0;
+}
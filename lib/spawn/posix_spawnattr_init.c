@@ -0,0 +1,13 @@
+#include <spawn.h>
+
+/**
+ * Initialize spawn attributes with the default values.
+ * 
+ * @returns 0 on success.
+ */
+int
+posix_spawnattr_init(posix_spawnattr_t *attr)
+{
+  attr->flags = 0;
+  return 0;
+}
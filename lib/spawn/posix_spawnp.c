@@ -0,0 +1,65 @@
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+/**
+ * Create a new process executing the file. If the file name does not contain
+ * a slash, the file is searched for in the directories listed in the PATH
+ * environment variable. The search stops at the first directory that contains
+ * the file, so errors caused by the file actions (such as ENOENT for a missing
+ * input file) are reported as is.
+ * 
+ * @returns 0 on success, or an error number otherwise.
+ */
+int
+posix_spawnp(pid_t *pid, const char *file,
+             const posix_spawn_file_actions_t *file_actions,
+             const posix_spawnattr_t *attrp,
+             char *const argv[], char *const envp[])
+{
+  struct stat st;
+  char *pathenv;
+  size_t filelen;
+  int r;
+
+  if ((strchr(file, '/') != NULL) || ((pathenv = getenv("PATH")) == NULL))
+    return posix_spawn(pid, file, file_actions, attrp, argv, envp);
+
+  filelen = strlen(file);
+
+  r = ENOENT;
+  while (*pathenv != '\0') {
+    char *sep, *full;
+    size_t len;
+
+    if ((sep = strchr(pathenv, ':')) != NULL)
+      len = sep - pathenv;
+    else
+      len = strlen(pathenv);
+
+    if ((full = (char *) malloc(len + filelen + 2)) == NULL)
+      return ENOMEM;
+
+    strncpy(full, pathenv, len);
+    full[len] = '/';
+    strncpy(&full[len + 1], file, filelen + 1);
+
+    // Try the next directory only if the file is not found.
+    if (stat(full, &st) == 0) {
+      r = posix_spawn(pid, full, file_actions, attrp, argv, envp);
+      free(full);
+      break;
+    }
+
+    free(full);
+
+    if (sep == NULL)
+      break;
+
+    pathenv = sep + 1;
+  }
+
+  return r;
+}
@@ -0,0 +1,15 @@
+#include <syscall.h>
+#include <sys/meminfo.h>
+
+/**
+ * Get the physical memory usage statistics.
+ * 
+ * @param info Pointer to the structure to store the statistics.
+ * 
+ * @returns 0 on success, -1 otherwise.
+ */
+int
+meminfo(struct meminfo *info)
+{
+  return __syscall(__SYS_MEMINFO, (uintptr_t) info, 0, 0);
+}
@@ -0,0 +1,26 @@
+#include <syscall.h>
+#include <sys/mman.h>
+
+/**
+ * Map pages of memory.
+ * 
+ * @param addr  The address to place the mapping at (only with MAP_FIXED).
+ * @param len   The length of the mapping in bytes.
+ * @param prot  The access permissions (PROT_READ, PROT_WRITE, PROT_EXEC).
+ * @param flags MAP_SHARED or MAP_PRIVATE, optionally combined with MAP_FIXED.
+ *              MAP_ANONYMOUS is allowed only with MAP_PRIVATE.
+ * @param fd    The file to map.
+ * @param off   The offset within the file (must be a multiple of the page
+ *              size).
+ * 
+ * @returns The address of the mapping on success, MAP_FAILED otherwise.
+ */
+void *
+mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off)
+{
+  int32_t r;
+
+  r = __syscall6(__SYS_MMAP, (uint32_t) addr, len, prot, flags, fd, off);
+
+  return (r < 0) ? MAP_FAILED : (void *) r;
+}
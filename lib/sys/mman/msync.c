@@ -0,0 +1,17 @@
+#include <syscall.h>
+#include <sys/mman.h>
+
+/**
+ * Write the changes made to shared file mappings back to the files.
+ * 
+ * @param addr  The starting address (must be a multiple of the page size).
+ * @param len   The length of the region in bytes.
+ * @param flags MS_ASYNC or MS_SYNC, optionally combined with MS_INVALIDATE.
+ * 
+ * @returns 0 on success, -1 otherwise.
+ */
+int
+msync(void *addr, size_t len, int flags)
+{
+  return __syscall(__SYS_MSYNC, (uint32_t) addr, len, flags);
+}
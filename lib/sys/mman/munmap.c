@@ -0,0 +1,16 @@
+#include <syscall.h>
+#include <sys/mman.h>
+
+/**
+ * Unmap pages of memory.
+ * 
+ * @param addr The starting address (must be a multiple of the page size).
+ * @param len  The length of the region in bytes.
+ * 
+ * @returns 0 on success, -1 otherwise.
+ */
+int
+munmap(void *addr, size_t len)
+{
+  return __syscall(__SYS_MUNMAP, (uint32_t) addr, len, 0);
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/meminfo.h>
+
+static unsigned long
+kb(struct meminfo *info, unsigned long pages)
+{
+  return pages * (info->page_size / 1024);
+}
+
+int
+main(int argc, char **argv)
+{
+  struct meminfo info;
+  int i, verbose;
+
+  verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+  if (meminfo(&info) < 0) {
+    perror("meminfo");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("%8s %10s %10s %10s %10s\n", "", "total", "used", "free", "cached");
+  printf("%8s %10lu %10lu %10lu %10lu\n", "Mem:",
+         kb(&info, info.total), kb(&info, info.used), kb(&info, info.free),
+         kb(&info, info.cached));
+  printf("%8s %10lu %10lu %10lu\n", "Swap:",
+         kb(&info, info.swap_total),
+         kb(&info, info.swap_total - info.swap_free),
+         kb(&info, info.swap_free));
+
+  if (!verbose)
+    return 0;
+
+  printf("\nUsed memory by owner (KB):\n");
+  printf("  slab    %10lu\n", kb(&info, info.slab));
+  printf("  pgtab   %10lu\n", kb(&info, info.pgtab));
+  printf("  user    %10lu\n", kb(&info, info.user));
+  printf("  kstack  %10lu\n", kb(&info, info.kstack));
+  printf("  buf     %10lu\n", kb(&info, info.buf));
+  printf("  kernel  %10lu\n", kb(&info, info.kernel));
+
+  printf("\nSwap activity (pages):\n");
+  printf("  in      %10lu\n", info.swap_in);
+  printf("  out     %10lu\n", info.swap_out);
+
+  printf("\nFree blocks:\n");
+  printf("  order       free   frag\n");
+  for (i = 0; i < __MEMINFO_ORDERS; i++)
+    printf("  %5d %10lu %6d\n", i, info.free_blocks[i], info.frag_index[i]);
+
+  return 0;
+}
@@ -1,5 +1,7 @@
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -10,7 +12,8 @@
 struct Cmd;
 
 static struct Cmd *cmd_parse(char *);
-static void        cmd_run(const struct Cmd *);
+static void        cmd_run(const struct Cmd *, posix_spawn_file_actions_t *,
+                           int);
 static void        cmd_free(struct Cmd *);
 
 #define MAXBUF  1024
@@ -86,7 +89,6 @@ main(void)
 {
   struct Cmd *cmd;
   struct ExecCmd *ecmd;
-  pid_t pid;
   int status;
 
   umask(S_IWGRP | S_IWOTH);
@@ -97,6 +99,10 @@ main(void)
   }
 
   for (;;) {
+    // Clean up background commands that have finished.
+    while (waitpid(-1, &status, WNOHANG) > 0)
+      ;
+
     if ((cmd = cmd_parse(get_cmd())) == NULL)
       continue;
 
@@ -113,13 +119,7 @@ main(void)
         }
       }
     } else {
-      if ((pid = fork()) == 0) {
-        cmd_run(cmd);
-      } else if (pid > 0) {
-        waitpid(pid, &status, 0);
-      } else {
-        perror("fork");
-      }
+      cmd_run(cmd, NULL, 1);
     }
 
     cmd_free(cmd);
@@ -128,12 +128,16 @@ main(void)
   return 0;
 }
 
+// Run the command. Programs are started with posix_spawn() rather than fork()
+// and exec(), so that the address space of the shell is not copied for each
+// command. Redirections become file actions for the spawned program.
 static void
-cmd_run(const struct Cmd * cmd)
+cmd_run(const struct Cmd *cmd, posix_spawn_file_actions_t *file_actions,
+        int foreground)
 {
+  posix_spawn_file_actions_t actions;
   pid_t pid;
-  int fd;
-  int status;
+  int fd, r, status;
   struct ExecCmd *ecmd;
   struct ListCmd *lcmd;
   struct BgCmd *bcmd;
@@ -143,59 +147,68 @@ cmd_run(const struct Cmd * cmd)
   case CMD_EXEC:
     ecmd = (struct ExecCmd *) cmd;
 
-    execvp(ecmd->argv[0], ecmd->argv);
-    perror(ecmd->argv[0]);
-    exit(1);
+    if ((r = posix_spawnp(&pid, ecmd->argv[0], file_actions, NULL,
+                          ecmd->argv, environ)) != 0) {
+      errno = r;
+      perror(ecmd->argv[0]);
+      break;
+    }
+
+    if (foreground)
+      waitpid(pid, &status, 0);
 
     break;
 
   case CMD_BG:
     bcmd = (struct BgCmd *) cmd;
 
-    if ((pid = fork()) == 0) {
-      cmd_run(bcmd->cmd);
-      exit(0);
-    } else if (pid < 0) {
-      perror("fork");
-    }
+    cmd_run(bcmd->cmd, NULL, 0);
 
     break;
 
   case CMD_LIST:
     lcmd = (struct ListCmd *) cmd;
 
-    if (lcmd->left != NULL) {
-      if ((pid = fork()) == 0) {
-        cmd_run(lcmd->left);
-      } else if (pid > 0) {
-        waitpid(pid, &status, 0);
-      } else {
-        perror("fork");
-        exit(1);
-      }
-    }
+    if (lcmd->left != NULL)
+      cmd_run(lcmd->left, NULL, 1);
 
-    if (lcmd->right != NULL) {
-      cmd_run(lcmd->right);
-    }
+    if (lcmd->right != NULL)
+      cmd_run(lcmd->right, NULL, foreground);
 
     break;
 
   case CMD_REDIR:
     rcmd = (struct RedirCmd *) cmd;
 
-    close(rcmd->fd);
+    // Redirections only wrap a single program, the outermost one owns the
+    // list of actions.
+    if (file_actions == NULL) {
+      posix_spawn_file_actions_init(&actions);
+      file_actions = &actions;
+    }
 
+    // The file is opened again in the spawned program, but check it here, so
+    // that errors are reported against the file rather than the program.
     if ((fd = open(rcmd->name, rcmd->oflag, 0666)) < 0) {
       perror(rcmd->name);
-      exit(1);
+    } else {
+      close(fd);
+
+      if ((r = posix_spawn_file_actions_addopen(file_actions, rcmd->fd,
+                                                rcmd->name, rcmd->oflag,
+                                                0666)) != 0) {
+        errno = r;
+        perror(rcmd->name);
+      } else {
+        cmd_run(rcmd->cmd, file_actions, foreground);
+      }
     }
 
-    cmd_run(rcmd->cmd);
+    if (file_actions == &actions)
+      posix_spawn_file_actions_destroy(&actions);
+
     break;
   }
-
-  exit(0);
 }
 
 static struct Cmd *
@@ -1,5 +1,6 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/stat.h>
@@ -21,7 +22,7 @@ int
 main(void)
 {
   struct DevFile *df;
-  int status;
+  int r, status;
 
   char *const argv[] = { "/bin/sh", NULL };
   char *const envp[] = { "PATH=/bin", NULL };
@@ -39,13 +40,13 @@ main(void)
   open("/dev/console", O_WRONLY);     // Standard output
   open("/dev/console", O_WRONLY);     // Standard error
 
-  // Spawn the shell
-  if (fork() == 0) {
-    if (chdir("/home/root") != 0) {
-      perror("chdir");
-      exit(EXIT_FAILURE);
-    }
-    execve("/bin/sh", argv, envp);
+  // Spawn the shell in the home directory
+  if (chdir("/home/root") != 0)
+    perror("chdir");
+
+  if ((r = posix_spawn(NULL, "/bin/sh", NULL, NULL, argv, envp)) != 0) {
+    errno = r;
+    perror("/bin/sh");
   }
 
   for (;;)
@@ -0,0 +1,78 @@
+// Measure the cost of fork() followed by exit() in the child.
+//
+// Usage: forkbench [iterations] [kilobytes]
+//
+// Before each fork, the parent writes to every page of a buffer of the given
+// size, so all these pages have to be shared with the child. After the child
+// exits, the parent is again the only owner of the pages, and the writes in
+// the next iteration should not cause any copying.
+//
+// The time is measured in whole seconds, so choose enough iterations for the
+// run to take at least several seconds, and compare kernels by running the
+// same command line on each of them, e.g. "forkbench 2000 256" and
+// "forkbench 2000 4096" after booting with "make qemu".
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+
+static void
+touch(char *buf, size_t size, int value)
+{
+  size_t i;
+
+  for (i = 0; i < size; i += PAGE_SIZE)
+    buf[i] = value;
+}
+
+int
+main(int argc, char **argv)
+{
+  int iterations, i, status;
+  size_t size;
+  time_t start, elapsed;
+  char *buf;
+  pid_t pid;
+
+  iterations = (argc > 1) ? atoi(argv[1]) : 1000;
+  size       = (argc > 2) ? (size_t) atoi(argv[2]) * 1024 : 256 * 1024;
+
+  if ((buf = malloc(size)) == NULL) {
+    perror("malloc");
+    exit(EXIT_FAILURE);
+  }
+  memset(buf, 0, size);
+
+  start = time(NULL);
+
+  for (i = 0; i < iterations; i++) {
+    touch(buf, size, i);
+
+    if ((pid = fork()) < 0) {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+
+    if (pid == 0)
+      exit(0);
+
+    if (waitpid(pid, &status, 0) != pid) {
+      perror("waitpid");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  elapsed = time(NULL) - start;
+
+  printf("%d forks with %u KB touched in %ld s", iterations,
+         (unsigned) (size / 1024), (long) elapsed);
+  if (elapsed > 0)
+    printf(" (%ld forks/s)", (long) (iterations / elapsed));
+  printf("\n");
+
+  return 0;
+}
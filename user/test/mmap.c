@@ -0,0 +1,114 @@
+// Test anonymous and shared file mappings.
+//
+// Anonymous memory first touched after fork must stay private to each
+// process, and shared anonymous mappings are not supported.
+//
+// A file is mapped with MAP_SHARED by the parent and a child process. The
+// data written by the child through its mapping must be visible both in the
+// parent's mapping and in the file itself after msync().
+#include <assert.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PAGE_SIZE 4096
+#define FILE_NAME "mmaptest.tmp"
+#define FILE_SIZE (2 * PAGE_SIZE + 100)
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+int
+main(void)
+{
+  char buf[64], *anon, *shared;
+  int fd, fd2, i, status;
+  pid_t pid;
+
+  // Anonymous memory is zero-filled and private
+  anon = mmap(NULL, 4 * PAGE_SIZE, PROT_READ | PROT_WRITE,
+              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  assert(anon != MAP_FAILED);
+  assert(anon[0] == 0 && anon[4 * PAGE_SIZE - 1] == 0);
+  strcpy(anon + PAGE_SIZE, "anonymous");
+
+  // Pages touched by the child after fork are not visible to the parent
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    strcpy(anon + 2 * PAGE_SIZE, "child");
+    strcpy(anon + PAGE_SIZE, "child");
+    exit(strcmp(anon + 2 * PAGE_SIZE, "child") == 0 ? 0 : 1);
+  }
+
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WEXITSTATUS(status) == 0);
+  assert(anon[2 * PAGE_SIZE] == 0);
+  assert(strcmp(anon + PAGE_SIZE, "anonymous") == 0);
+
+  assert(munmap(anon, 4 * PAGE_SIZE) == 0);
+
+  // Shared anonymous memory is rejected
+  assert(mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+              MAP_SHARED | MAP_ANONYMOUS, -1, 0) == MAP_FAILED);
+
+  if ((fd = open(FILE_NAME, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+    perror("open");
+    exit(EXIT_FAILURE);
+  }
+
+  // The file ends with a block of 'x' characters, zeros before that
+  memset(buf, 0, sizeof(buf));
+  for (i = 0; i < FILE_SIZE - (int) sizeof(buf); i += sizeof(buf))
+    assert(write(fd, buf, MIN(sizeof(buf), FILE_SIZE - sizeof(buf) - i)) > 0);
+  memset(buf, 'x', sizeof(buf));
+  assert(write(fd, buf, sizeof(buf)) == sizeof(buf));
+
+  shared = mmap(NULL, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  assert(shared != MAP_FAILED);
+  assert(shared[0] == 0 && shared[FILE_SIZE - 1] == 'x');
+
+  if ((pid = fork()) < 0) {
+    perror("fork");
+    exit(EXIT_FAILURE);
+  }
+
+  if (pid == 0) {
+    strcpy(shared + PAGE_SIZE, "written by the child");
+    exit(msync(shared, FILE_SIZE, MS_SYNC) == 0 ? 0 : 1);
+  }
+
+  assert(waitpid(pid, &status, 0) == pid);
+  assert(WEXITSTATUS(status) == 0);
+
+  // The child's changes are visible through the parent's mapping...
+  assert(strcmp(shared + PAGE_SIZE, "written by the child") == 0);
+
+  // ...and in the file itself
+  assert((fd2 = open(FILE_NAME, O_RDONLY)) >= 0);
+  for (i = 0; i < PAGE_SIZE; i += sizeof(buf))
+    assert(read(fd2, buf, sizeof(buf)) == sizeof(buf));
+  assert(read(fd2, buf, sizeof(buf)) == sizeof(buf));
+  assert(strcmp(buf, "written by the child") == 0);
+  close(fd2);
+
+  // Data written to the file is visible through the mapping
+  assert((fd2 = open(FILE_NAME, O_WRONLY)) >= 0);
+  assert(write(fd2, "hello", 6) == 6);
+  assert(strcmp(shared, "hello") == 0);
+  close(fd2);
+
+  assert(munmap(shared, FILE_SIZE) == 0);
+  close(fd);
+  unlink(FILE_NAME);
+
+  printf("SUCCESS testing <sys/mman.h>\n");
+
+  return 0;
+}
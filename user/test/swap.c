@@ -0,0 +1,53 @@
+// Exercise the swap space by touching more anonymous memory than there is
+// free RAM.
+//
+// Usage: swap [megabytes]
+//
+// Every page of the region is first filled with a pattern derived from its
+// index, and then checked. The pages written first have to be swapped out to
+// make room for the later ones, and read back during the check.
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#define PAGE_SIZE 4096
+
+int
+main(int argc, char **argv)
+{
+  size_t size, npages, i, j;
+  unsigned *page;
+  char *buf;
+
+  size   = (size_t) ((argc > 1) ? atoi(argv[1]) : 256) * 1024 * 1024;
+  npages = size / PAGE_SIZE;
+
+  buf = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+             -1, 0);
+  if (buf == MAP_FAILED) {
+    perror("mmap");
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < npages; i++) {
+    page = (unsigned *) (buf + i * PAGE_SIZE);
+    for (j = 0; j < PAGE_SIZE / sizeof(unsigned); j++)
+      page[j] = i ^ j;
+  }
+
+  for (i = 0; i < npages; i++) {
+    page = (unsigned *) (buf + i * PAGE_SIZE);
+    for (j = 0; j < PAGE_SIZE / sizeof(unsigned); j++) {
+      if (page[j] != (i ^ j)) {
+        printf("FAILED: page %u, word %u\n", (unsigned) i, (unsigned) j);
+        exit(EXIT_FAILURE);
+      }
+    }
+  }
+
+  munmap(buf, size);
+
+  printf("SUCCESS testing swap with %u MB\n", (unsigned) (size >> 20));
+
+  return 0;
+}
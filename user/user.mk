@@ -10,6 +10,7 @@ USER_SRCFILES += \
   user/bin/cat.c \
 	user/bin/chmod.c \
 	user/bin/echo.c \
+	user/bin/free.c \
 	user/bin/link.c \
 	user/bin/ls.c \
 	user/bin/mkdir.c \
@@ -28,11 +29,14 @@ USER_SRCFILES += \
 	user/test/errno.c \
 	user/test/float.c \
 	user/test/fork.c \
+	user/test/forkbench.c \
 	user/test/limits.c \
 	user/test/math.c \
+	user/test/mmap.c \
 	user/test/setjmp.c \
 	user/test/stdlib.c \
-	user/test/string.c
+	user/test/string.c \
+	user/test/swap.c
 
 USER_APPS := $(patsubst %.c, $(OBJ)/%, $(USER_SRCFILES))
 